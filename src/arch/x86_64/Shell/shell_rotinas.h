@@ -23,6 +23,8 @@ Este arquivo fonte possui o código de um shell
 #include "../drivers/smbios/smbios.h"
 #include "cache.h"
 #include "mm/vmalloc.h"
+#include "mm/slab.h"
+#include "mm/color.h"
 #include "btree.h"
 #include "interrupt.h"
 #include "../include/time.h"
@@ -37,6 +39,8 @@ Este arquivo fonte possui o código de um shell
 #include "io.h"
 #include "smp.h"
 #include "runq.h"
+#include "proc/runq_prio.h"
+#include "proc/nohz.h"
 #include "kernel.h"
 #include "../user/printf.h"
 #include "../user/fork.h"
@@ -180,6 +184,19 @@ static int kshell_execute(int argc, const char **argv)
 
         printf("\n\nCACHE L2 - Size=%d kbytes", L2_cache_size());
         printf("\nCACHE L2 - line size=%d bytes", L2_cache_line_size());
+        printf("\nCACHE L2 - colors=%d", cache_colors());
+    }
+    else if (!strcmp(cmd, "color-bench"))
+    {
+        cache_color_bench();
+    }
+    else if (!strcmp(cmd, "balance"))
+    {
+        runq_balance_show();
+    }
+    else if (!strcmp(cmd, "nohz"))
+    {
+        tick_nohz_show();
     }
     else if (!strcmp(cmd, "bitwise"))
     {
@@ -584,6 +601,10 @@ static int kshell_execute(int argc, const char **argv)
     {
         show_heap_memory();
     }
+    else if (!strcmp(cmd, "slab"))
+    {
+        show_slab_caches();
+    }
     else if (!strcmp(cmd, "UTC"))
     {
         tm_t utc = timestamp_to_utc(xtime.tv_sec);
@@ -681,10 +702,14 @@ static inline void shell_help(void)
     printf("\nkmalloc");
     printf("\nbuddy");
     printf("\nheap");
+    printf("\nslab");
     printf("\nlapic");
     printf("\nlista");
     printf("\nzonas");
     printf("\nmm-size");
+    printf("\ncolor-bench");
+    printf("\nbalance");
+    printf("\nnohz");
     printf("\nvirtual");
     printf("\nhelp");
     printf("\nnode");
@@ -759,4 +784,5 @@ static inline void shell_mmsize(void)
     printf("\nnode_t(sizeof(node_t))=%d bytes", sizeof(node_t));
     printf("\nmm_struct_t(sizeof(mm_struct_t))=%d bytes", sizeof(mm_struct_t));
     printf("\nvm_struct_t(sizeof(vm_struct_t))=%d bytes", sizeof(vm_struct_t));
+    printf("\npages em quarentena=%d", quarantined_pages_nr());
 }
\ No newline at end of file
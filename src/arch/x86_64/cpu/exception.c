@@ -16,6 +16,8 @@ IDT e seus descritores, necessários para a manipulação das interrupções.
 #include "debug.h"
 #include "bits.h"
 #include "scheduler.h"
+#include "mm/vmap.h"
+#include "mm/cow.h"
 
 static const char *const exception_messages[32] = {
     "Division by zero",
@@ -109,6 +111,16 @@ static void page_fault_handler(cpu_regs_t *tsk_contxt)
     int reserved = tsk_contxt->err_code & 0x8;   // Overwritten CPU-reserved bits of page entry?
     int id = tsk_contxt->err_code & 0x10;        // Caused by an instruction fetch?
 
+    /* Page ausente no kernel: pode ser o primeiro acesso a um page de uma área
+    VM_LAZY do vmalloc. Se o page foi mapeado, a instrução é repetida. */
+    if (present && !us && vmalloc_fault(faulting_address))
+        return;
+
+    /* Escrita num page protegido do user space: o page pode estar compartilhado
+    com outro processo desde o fork(copy-on-write). */
+    if (!present && rw && cow_handle_write(faulting_address))
+        return;
+
     /*
     // The fault was likely due to an access in kernel space, so give up
     if (faulting_address & (1ULL << 63))
@@ -76,6 +76,15 @@ __read_cr4:
     mov rax, cr4
     ret
 
+;---------------------------------------------------------------------------
+;void __write_cr4(u64_t cr4)
+;Grava o registro cr4
+;---------------------------------------------------------------------------
+global __write_cr4
+__write_cr4:
+    mov cr4, rdi
+    ret
+
 ;---------------------------------------------------------------------------
 ;Ler o RIP na atual posição do código
 ;u64_t __read_rip(void) 
@@ -368,6 +377,31 @@ __enable_nxe_bit:
 	or eax, (1 << 8) | (1 << 11)
 	wrmsr
 
+;---------------------------------------------------------------------------
+;void __clear_frame_nt(virt_addr_t frame)
+;Zera um frame de 4KiB com stores non-temporal(movnti). As linhas escritas não
+;passam pelo cache, o que não descarta o working set dos tasks. Usada pelo idle
+;task para preencher o pool de pages zerados.
+;---------------------------------------------------------------------------
+global __clear_frame_nt
+__clear_frame_nt:
+    xor eax, eax
+    mov ecx, 4096 / 64
+.loop:
+    movnti [rdi], rax
+    movnti [rdi + 8], rax
+    movnti [rdi + 16], rax
+    movnti [rdi + 24], rax
+    movnti [rdi + 32], rax
+    movnti [rdi + 40], rax
+    movnti [rdi + 48], rax
+    movnti [rdi + 56], rax
+    add rdi, 64
+    dec ecx
+    jnz .loop
+    sfence                      ; Os stores non-temporal são fracamente ordenados.
+    ret
+
 ;---------------------------------------------------------------------------
 ;Rotina para fazer a invalidação de toda a TLB
 ;void __vm_flush_tlb(void)
@@ -15,6 +15,7 @@
 #include "mm/pgtable_types.h"
 #include "mm/mm.h"
 #include "mm/vmm.h"
+#include "mm/pat.h"
 #include "../graphic/vga.h"
 
 u64_t *virt_vga_address = NULL;
@@ -163,12 +164,63 @@ u32_t pci_io_bar_size(PCIAddress pci_addr, e_pci_header_offset_t offset)
 {
     u32_t bar_ant = pci_read_config_header(pci_addr, offset);
 
-    u32_t bar_new = set_pci_io_bar0(pci_addr, 0xfffffff0);
+    pci_write_config_header(pci_addr, offset, 0xfffffff0);
+    u32_t bar_new = pci_read_config_header(pci_addr, offset);
     u32_t size = (~(bar_new & 0xfffffff0) + 1);
 
-    set_pci_io_bar0(pci_addr, bar_ant);
+    pci_write_config_header(pci_addr, offset, bar_ant);
     return size;
 }
+
+/**
+ * @brief Proteção utilizada no mapeamento de um BAR de memória. Um BAR
+ * prefetchable não tem efeitos colaterais na leitura e pode ser mapeado como
+ * write-combining. Os demais(registros de controle) continuam sem cache.
+ *
+ * @param pci_addr
+ * @param offset
+ * @return u64_t
+ */
+u64_t pci_bar_pgprot(PCIAddress pci_addr, e_pci_header_offset_t offset)
+{
+    u32_t bar = pci_read_config_header(pci_addr, offset);
+
+    if (bar & PCI_BAR_PREFETCH)
+        return pgprot_writecombine;
+
+    return (PG_FLAG_P | PG_FLAG_W | PG_FLAG_NC);
+}
+
+/**
+ * @brief Mapeia o BAR de memória indicado em 'offset' a partir do endereço
+ * virtual 'vaddr', com a proteção de pci_bar_pgprot().
+ *
+ * @param pci_addr
+ * @param offset
+ * @param vaddr
+ * @return o endereço virtual ou NULL se o BAR for de I/O.
+ */
+virt_addr_t pci_map_bar(PCIAddress pci_addr, e_pci_header_offset_t offset, virt_addr_t vaddr)
+{
+    u32_t bar = pci_read_config_header(pci_addr, offset);
+    u64_t prot = pci_bar_pgprot(pci_addr, offset);
+    phys_addr_t phys = bar & PCI_BAR_MEM_MASK;
+    size_t size = 0;
+
+    if (bar & PCI_BAR_IO)
+        return NULL;
+
+    /* BAR de 64 bits: a parte alta do endereço fica no BAR seguinte. */
+    if ((bar & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64)
+        phys |= (u64_t)pci_read_config_header(pci_addr, offset + 4) << 32;
+
+    size = align_up(pci_io_bar_size(pci_addr, offset), PAGE_SIZE);
+
+    for (size_t i = 0; i < size; i += PAGE_SIZE)
+        kmap_frame(incptr(vaddr, i), phys + i, prot);
+
+    return vaddr;
+}
 static u32_t pci_io_header_bar1(PCIAddress pci_addr)
 {
     return pci_read_config_header(pci_addr, ePCI_HEADER_BAR1);
@@ -25,6 +25,13 @@ Este header reune estruturas para o Gerenciamento de Memória
 
 #define PCI_HEADER_TYPE_MF 0x80
 
+// Base address register
+#define PCI_BAR_IO 0x01
+#define PCI_BAR_TYPE_MASK 0x06
+#define PCI_BAR_TYPE_64 0x04
+#define PCI_BAR_PREFETCH 0x08
+#define PCI_BAR_MEM_MASK 0xFFFFFFF0
+
 typedef enum
 {
     ePCI_HEADER_REG0 = 0x0,
@@ -92,5 +99,7 @@ u32_t pci_io_bar0(PCIAddress pci_addr);
 u32_t set_pci_io_bar0(PCIAddress pci_addr, u32_t value);
 
 u32_t pci_io_bar_size(PCIAddress pci_addr, e_pci_header_offset_t offset);
+u64_t pci_bar_pgprot(PCIAddress pci_addr, e_pci_header_offset_t offset);
+virt_addr_t pci_map_bar(PCIAddress pci_addr, e_pci_header_offset_t offset, virt_addr_t vaddr);
 
 #endif
\ No newline at end of file
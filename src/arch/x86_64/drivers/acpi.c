@@ -18,6 +18,7 @@ páginas físicas.
 #include "info.h"
 #include "lapic.h"
 #include "mm/fixmap.h"
+#include "mm/numa.h"
 
 // Ponteiro para a raiz de tabelas do ACPI.
 rsdp_t *acpi_rsdp;
@@ -285,6 +286,79 @@ static int parse_pmtt(acpi_header_t *p_pmtt)
 
     return 0;
 }
+/*
+ * The SRAT (System Resource Affinity Table) associa cada local APIC e cada
+ * faixa de memória a um proximity domain(node NUMA).
+ */
+static int parse_srat(acpi_header_t *htable)
+{
+    srat_t *srat = (srat_t *)htable;
+
+    if (check_sum(srat, srat->header.len) != 0)
+    {
+        kprintf("WARNING: checksum of SRAT invalid.\n");
+        return -1;
+    }
+
+    size_t size = srat->header.len - sizeof(srat_t);
+
+    srat_entry_head_t *head;
+    srat_lapic_t *elapic;
+    srat_memory_t *emem;
+    srat_x2apic_t *ex2apic;
+
+    for (size_t offset = 0; offset < size; offset += head->len)
+    {
+        head = (void *)&srat->entry[offset];
+        if (head->len == 0)
+            break;
+
+        switch (head->type)
+        {
+        case SRAT_TYPE_LAPIC:
+            elapic = (srat_lapic_t *)(virt_addr_t)head;
+            if (elapic->flags & SRAT_ENABLED)
+            {
+                u32_t pxm = elapic->pxm_lo | (elapic->pxm_hi[0] << 8) |
+                            (elapic->pxm_hi[1] << 16) | (elapic->pxm_hi[2] << 24);
+                numa_add_cpu(pxm, elapic->apic_id);
+            }
+            break;
+        case SRAT_TYPE_MEMORY:
+            emem = (srat_memory_t *)(virt_addr_t)head;
+            if (emem->flags & SRAT_ENABLED)
+                numa_add_memblk(emem->pxm, emem->base, emem->length);
+            break;
+        case SRAT_TYPE_X2APIC:
+            ex2apic = (srat_x2apic_t *)(virt_addr_t)head;
+            if (ex2apic->flags & SRAT_ENABLED)
+                numa_add_cpu(ex2apic->pxm, ex2apic->x2apic_id);
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+/* The SLIT (System Locality Information Table) informa a distância relativa
+entre os proximity domains. A distância local é sempre 10. */
+static int parse_slit(acpi_header_t *htable)
+{
+    slit_t *slit = (slit_t *)htable;
+
+    if (check_sum(slit, slit->header.len) != 0)
+    {
+        kprintf("WARNING: checksum of SLIT invalid.\n");
+        return -1;
+    }
+
+    /* A tabela fica no mapeamento direto: os proximity domains do SRAT são
+    convertidos em nid e buscados na matriz por setup_numa(). */
+    numa_set_slit(slit->entry, slit->nr_localities);
+    return 0;
+}
+
 /* Parser da FADT table. */
 static int parse_fadt(acpi_header_t *htable)
 {
@@ -371,6 +445,14 @@ static void parse_rsdt(void)
             kprintf("\nTable: %s", sign);
             parse_fadt(htable);
         }
+        else if (!memcmp(sign, SRAT_SIGNATURE, 4))
+        {
+            parse_srat(htable);
+        }
+        else if (!memcmp(sign, SLIT_SIGNATURE, 4))
+        {
+            parse_slit(htable);
+        }
     }
     // pause_enter();
     kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
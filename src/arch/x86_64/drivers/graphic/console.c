@@ -14,6 +14,7 @@ See the file LICENSE for details.
 #include "sync/mutex.h"
 #include "debug.h"
 #include "scheduler.h"
+#include "mm/slab.h"
 
 static bool graphic_mode_on = false;
 console_t console_root = {0};
@@ -23,6 +24,9 @@ static struct graphics_color fgcolor = {255, 255, 255, 0};
 struct graphics *graphic_obj;
 console_t *console_obj;
 
+/* Cache dos consoles criados por console_create(). O console_root é estático. */
+static kmem_cache_t *console_cachep = NULL;
+
 #define CURSOR_PULSE_MS_TIME 300
 static u64_t time_ini = 0;
 static u64_t time_ms = 0;
@@ -276,7 +280,7 @@ void console_putstring(console_t *c, const char *str)
 
 console_t *console_create(struct graphics *g)
 {
-	console_t *c = kmalloc(sizeof(*c));
+	console_t *c = kmem_cache_alloc(console_cachep);
 
 	c->gx = graphics_addref(g);
 	c->refcount = 1;
@@ -297,7 +301,7 @@ void console_delete(console_t *c)
 	{
 		graphics_delete(c->gx);
 		if (c != &console_root)
-			kfree(c);
+			kmem_cache_free(console_cachep, c);
 	}
 }
 
@@ -309,6 +313,10 @@ void console_size(console_t *c, int *xsize, int *ysize)
 
 console_t *console_init(struct graphics *g)
 {
+	console_cachep = kmem_cache_create("console", sizeof(console_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (console_cachep == NULL)
+		WARN_ERROR("console: falha ao criar o cache.");
+
 	console_root.gx = g;
 	console_reset(&console_root);
 	console_putstring(&console_root, "\nconsole: initialized\n");
@@ -18,6 +18,7 @@ See the file LICENSE for details.
 // #include "utils.h"
 #include "stdio.h"
 #include "debug.h"
+#include "mm/slab.h"
 
 #define FACTOR 256
 
@@ -44,9 +45,17 @@ static struct graphics_color color_white = {255, 255, 255, 0};
 
 struct graphics graphics_root;
 
+/* Cache dos objetos criados por graphics_create(). O root é estático. */
+static kmem_cache_t *graphics_cachep = NULL;
+
 struct graphics *graphics_create_root()
 {
 	struct graphics *g = &graphics_root;
+
+	graphics_cachep = kmem_cache_create("graphics", sizeof(struct graphics), 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (graphics_cachep == NULL)
+		WARN_ERROR("graphics: falha ao criar o cache.");
+
 	g->pixmap = pixmap_create_root();
 	g->fgcolor = color_white;
 	g->bgcolor = color_black;
@@ -62,7 +71,7 @@ struct graphics *graphics_create_root()
 struct graphics *graphics_create(struct graphics *parent)
 {
 
-	struct graphics *g = kmalloc(sizeof(*g));
+	struct graphics *g = kmem_cache_alloc(graphics_cachep);
 
 	if (!g)
 		return 0;
@@ -94,7 +103,7 @@ void graphics_delete(struct graphics *g)
 	if (g->refcount == 0)
 	{
 		graphics_delete(g->parent);
-		kfree(g);
+		kmem_cache_free(graphics_cachep, g);
 	}
 }
 
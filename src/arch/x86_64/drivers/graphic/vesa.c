@@ -16,6 +16,7 @@ Rotinas para manipulação de vídeo svga
 #include "mm/fixmap.h"
 #include "console.h"
 #include "lapic.h"
+#include "mm/pat.h"
 
 static struct
 {
@@ -36,7 +37,9 @@ uint16_t video_yres;
 uint8_t video_bpp;
 uint8_t *video_buffer;
 
-u64_t mm_video_pgprot = (PG_FLAG_P | PG_FLAG_W | PG_FLAG_NC | PG_FLAG_U);
+/* O framebuffer é mapeado como write-combining: as escritas do plot_pixel()
+são agrupadas em rajadas, em vez de uma escrita no barramento por pixel. */
+u64_t mm_video_pgprot = (pgprot_writecombine | PG_FLAG_U);
 // u64_t mm_video_pgprot = (PG_FLAG_P | PG_FLAG_W | PG_FLAG_NC);
 
 /**
@@ -18,6 +18,9 @@
 #include "time.h"
 #include "../drivers/time/tsc.h"
 #include "syscall/syscalls.h"
+#include "mm/meminit.h"
+#include "mm/numa.h"
+#include "mm/color.h"
 
 mm_addr_t _stack_rsp = 0;
 mm_addr_t _stack_rbp = 0;
@@ -58,6 +61,11 @@ void kmain(uint32_t __attribute__((unused)) phy_maps)
 
     setup_acpi();
 
+    /* Os nodes NUMA dependem do SRAT/SLIT e devem estar prontos antes dos APs. */
+    setup_numa();
+
+    setup_cache_color();
+
     setup_apic();
 
     ioapic_ini();
@@ -75,6 +83,9 @@ void kmain(uint32_t __attribute__((unused)) phy_maps)
 
     smp_init();
 
+    /* Os page_t acima do limite baixo são inicializados por todos os cores. */
+    deferred_init_start();
+
     // time_init();
 
     // clear_screen();
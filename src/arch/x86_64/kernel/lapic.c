@@ -26,6 +26,10 @@
 #include "msr.h"
 #include "scheduler.h"
 #include "sync/spin.h"
+#include "smp/tlb.h"
+#include "proc/nohz.h"
+#include "proc/sched_fair.h"
+#include "../drivers/time/tsc.h"
 
 // Contém os endereços físico e virtual do lapic
 // lapic_base_t lapic_base;
@@ -296,6 +300,7 @@ void setup_apic(void)
 
     add_handler_irq(ISR_VECTOR_ERROR, error_interrupt_handler);
     add_handler_irq(ISR_VECTOR_SPURIOUS, spurious_interrupt_handler);
+    setup_tlb_shootdown();
 
     kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
 }
@@ -395,6 +400,11 @@ bool is_apic_timer_constant(void)
  * Cada core precisa iniciar o seu timer
  * @retval None
  */
+/* Ticks por ms e contagem inicial do tick periódico de cada core, guardados
+para religar o tick após o idle sem tick sem uma nova calibração. */
+static u32_t lapic_timer_ticks_ms[MAX_CORES];
+static u32_t lapic_timer_count[MAX_CORES];
+
 void init_lapic_timer(uint32_t ms)
 {
     spinlock_lock(&spinlock_timer);
@@ -404,6 +414,9 @@ void init_lapic_timer(uint32_t ms)
     uint32_t inicial_count = ticks_ms * ms;
     kprintf("\nLAPIC-TIMER[ %u ] - Freq:[ %d ] ticks/mill - inicial_count=%u Ticks", id, ticks_ms, inicial_count);
 
+    lapic_timer_ticks_ms[id] = ticks_ms;
+    lapic_timer_count[id] = inicial_count;
+
     spinlock_unlock(&spinlock_timer);
 
     /* Indicamos o número do vector que será utilizando
@@ -421,6 +434,60 @@ void init_lapic_timer(uint32_t ms)
     apic_eoi();
 }
 
+bool lapic_has_tsc_deadline(void)
+{
+    cpuid_regs_t cpuid_var = cpuid_get(0x1);
+    return (cpuid_var.ecx & CPUID_ECX_TSC_DEADLINE);
+}
+
+/**
+ * @brief Programa um único disparo do timer do core corrente, 'ns' à frente.
+ * Usa o modo TSC-deadline quando disponível e o TSC está calibrado; caso con-
+ * trário, o modo one-shot com a contagem medida em init_lapic_timer().
+ *
+ * @param ns
+ */
+void lapic_timer_oneshot(u64_t ns)
+{
+    uint8_t id = apic_id();
+    u64_t cycles = sched_clock_cycles(ns);
+    u64_t count;
+
+    if (cycles != 0 && lapic_has_tsc_deadline())
+    {
+        apic_write(APIC_LVT_TIMER, ISR_VECTOR_TIMER | LAPIC_TIMER_TSC_DEADLINE);
+
+        /* A escrita no LVT precisa estar visível antes da escrita no MSR. */
+        __sync_mfence();
+        msr_write(MSR_IA32_TSC_DEADLINE, tsc_read() + cycles);
+        return;
+    }
+
+    count = ((u64_t)lapic_timer_ticks_ms[id] * ns) / 1000000;
+    if (count == 0)
+        count = 1;
+    if (count > 0xFFFFFFFF)
+        count = 0xFFFFFFFF;
+
+    apic_write(APIC_LVT_TIMER, ISR_VECTOR_TIMER | LAPIC_TIMER_ONESHOT);
+    apic_write(APIC_TIMER_DIVIDE_CONFIG, TIMER_DIVISOR);
+    apic_write(APIC_TIMER_INIT_COUNT, (u32_t)count);
+}
+
+/* Religa o tick periódico do core corrente. */
+void lapic_timer_periodic(void)
+{
+    uint8_t id = apic_id();
+
+    /* Desarma o TSC-deadline pendente. */
+    if (lapic_has_tsc_deadline())
+        msr_write(MSR_IA32_TSC_DEADLINE, 0);
+
+    apic_write(APIC_LVT_TIMER, ISR_VECTOR_TIMER | TIMER_PERIODIC);
+    apic_write(APIC_TIMER_DIVIDE_CONFIG, TIMER_DIVISOR);
+    apic_write(APIC_TIMER_INIT_COUNT, lapic_timer_count[id]);
+}
+
 /*
     Calcula e retorna o número de ticks do timer do APIC em um milissegundo,
     utilizando o relógio de alta precisão HPET.
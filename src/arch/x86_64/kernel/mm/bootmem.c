@@ -27,6 +27,8 @@ nitivas tenham sido criadas.
 #include "sysinfo.h"
 #include "mm/vm_area.h"
 #include "x86.h"
+#include "mm/pgwalk.h"
+#include "mm/meminit.h"
 
 /**
  * @brief Aqui eu calculo o tamanho e crio uma matriz de bits para
@@ -196,6 +198,69 @@ static void setup_bootmem_mbitmap(void)
 
     kprintf("\n(*)%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
 }
+/* O bitmap do bootmem guarda o pfn n no bit n%64 da palavra n/64. As rotinas
+abaixo alteram e percorrem ranges inteiros, uma palavra(64 frames) por vez,
+em vez de um bit por chamada. */
+#define BITMAP_WORD_BITS 64
+
+static inline u64_t *bootmem_bitmap_words(void)
+{
+    return (u64_t *)pgdat.bdata.bitmap_mem.data;
+}
+
+/* Marca os frames [start, end) como em uso(used==true) ou livres. */
+static void bootmem_bitmap_range(size_t start, size_t end, bool used)
+{
+    u64_t *map = bootmem_bitmap_words();
+
+    while (start < end)
+    {
+        size_t bit = start % BITMAP_WORD_BITS;
+        size_t nr = BITMAP_WORD_BITS - bit;
+        u64_t mask = 0;
+
+        if (nr > end - start)
+            nr = end - start;
+        mask = (nr == BITMAP_WORD_BITS) ? ~0UL : (((1UL << nr) - 1) << bit);
+
+        if (used)
+            map[start / BITMAP_WORD_BITS] |= mask;
+        else
+            map[start / BITMAP_WORD_BITS] &= ~mask;
+
+        start += nr;
+    }
+}
+
+/* Intervalo de pfns [start, end). */
+struct pfn_range
+{
+    size_t start;
+    size_t end;
+};
+
+/* Libera no bitmap os frames de [start, end) que não estão em nenhum dos
+intervalos 'hole'. */
+static void bootmem_free_region(size_t start, size_t end, const struct pfn_range *hole, size_t nr_holes)
+{
+    for (size_t i = 0; i < nr_holes && start < end; i++)
+    {
+        if (hole[i].end <= start || hole[i].start >= end)
+            continue;
+
+        if (hole[i].start > start)
+            bootmem_free_region(start, hole[i].start, hole + i + 1, nr_holes - i - 1);
+
+        start = hole[i].end;
+    }
+
+    if (start >= end)
+        return;
+
+    bootmem_bitmap_range(start, end, false);
+    pgdat.node_free_pages.value += end - start;
+}
+
 /**
  * @brief Faz a configuração da estrutura do "node", inicializando a estrutura
  * de bitmap que faz o gerenciamento inicial da memória física. Faz também  o
@@ -237,6 +302,16 @@ static void register_bootmem_frames_free(void)
     Para isso, fazemos uma varredura nas regiões da memória, sinalizando os bits corres-
     pondentes aos frames livres. */
 
+    /* Frames que nunca são liberados:
+        - o pfn==0 NÃO PODE ser utilizado. Gera erros;
+        - os frames ocupados pelo kernel;
+        - os frames utilizados pelo bitmap do bootmem. */
+    struct pfn_range holes[] = {
+        {0, 1},
+        {pfn_kernel_ini, pfn_kernel_pend},
+        {pfn_bitmap_ini, pfn_bitmap_pend},
+    };
+
     for (size_t i = 0; i < pgdat.mmap_regions.count; i++)
     {
 
@@ -245,30 +320,8 @@ static void register_bootmem_frames_free(void)
             start_pfn = phys_to_pfn(align_up(pgdat.mmap_regions.region[i].base, PAGE_SIZE));
             pend_pfn = phys_to_pfn(align_down(pgdat.mmap_regions.region[i].base + pgdat.mmap_regions.region[i].size, PAGE_SIZE));
 
-            for (size_t pfn = start_pfn; pfn < pend_pfn; pfn++)
-            {
-
-                /* O pfn==0 NÃO PODE ser utilizado. Gera erros. */
-                if (pfn == 0)
-                {
-                    /* faz nada */
-                }
-                /* os frames ocupados pelo kernel não podem ser utilizados. */
-                else if ((pfn >= pfn_kernel_ini) && (pfn < pfn_kernel_pend))
-                {
-                    /*faz nada */
-                }
-                /* Os frames utilizados pelo bitmap do bootmem não devem ser utilizados. */
-                else if ((pfn >= pfn_bitmap_ini) && (pfn < pfn_bitmap_pend))
-                {
-                    /* faz nada. */
-                }
-                else
-                {
-                    atomic64_inc(&(pgdat.node_free_pages));
-                    free_bootmem_frame(pfn); // Sinalizo na matriz de bits "bitmap"
-                }
-            }
+            /* Sinalizo na matriz de bits "bitmap", uma palavra por vez. */
+            bootmem_free_region(start_pfn, pend_pfn, holes, sizeof(holes) / sizeof(holes[0]));
         }
     }
 
@@ -321,7 +374,7 @@ static void setup_pagemap_vector(void)
     // kprintf("\nphys_to_pfn(map_ini)=%x-> phys_to_pfn(map_end)=%x", phys_to_pfn(map_ini), phys_to_pfn(map_end));
     // debug_pause("P1");
 
-    reserve_bootmem_frame_ranger(phys_to_pfn(map_ini), phys_to_pfn(map_end));
+    bootmem_bitmap_range(phys_to_pfn(map_ini), phys_to_pfn(map_end), true);
 
     kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
 }
@@ -490,43 +543,65 @@ static void remap_full_memory_system(void)
     kprintf("\n(*)%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
 }
 
+/* Os page_t abaixo deste limite são inicializados pelo BSP, em free_area_init().
+Os demais são inicializados pelos APs após o smp_init(), em paralelo. */
+#define BOOTMEM_DEFERRED_LOW_PFN (((size_t)1 << 30) >> PAGE_SHIFT)
+
+/* Tamanho da parte do vetor de pages que um core inicializa por vez. */
+#define DEFERRED_CHUNK_PAGES ((size_t)1 << (MAX_PAGE_ORDER + 6))
+
+/* Primeiro pfn inicializado pelos APs. É múltiplo de um bloco de ordem máxima:
+o buddy de um bloco menor nunca está fora do range que o contém, e nenhuma
+coalescência consulta um page_t ainda não inicializado. */
+static size_t deferred_start_pfn = 0;
+static size_t deferred_next_pfn = 0;
+static volatile size_t deferred_pending = 0;
+static volatile bool deferred_go = false;
+
+/**
+ * @brief Entrega ao buddy os frames livres [start, end) com os maiores blocos
+ * que o alinhamento e a zona permitem. Um bloco de ordem máxima não passa
+ * pela coalescência.
+ */
+static void free_area_range(size_t start, size_t end)
+{
+    while (start < end)
+    {
+        u8_t order = MAX_PAGE_ORDER;
+        size_t nr = (size_t)1 << order;
+
+        while (order > 0 && ((start & (nr - 1)) || (start + nr) > end ||
+                             pfn_to_zoneid(start) != pfn_to_zoneid(start + nr - 1)))
+        {
+            order--;
+            nr >>= 1;
+        }
+
+        page_t *page = &pgdat.node_page_map[start];
+        set_block_level(page, order);
+        free_pages(page);
+
+        start += nr;
+    }
+}
+
 /**
- * -----------------------------------------------------------------------
- * Faz a inicialização do vetor pagemap, utilizando o free/used do bitmap.
- *
- * Inicializa as listas do buddy allocator.
- *
- * É feita também a identificação de alguns pageframes "reservados" pelo
- * hardware para mapear APIC, IOAPIC, HPE etc. Eles recebem o atributo
- * "fixmap" no seu flags.
- * -----------------------------------------------------------------------
+ * @brief Inicializa os page_t de [start, end) e entrega os frames livres ao
+ * buddy. Os pages já utilizados durante o boot(bitmap) ficam reservados e os
+ * reservados pelo hardware(APIC, IOAPIC, HPET etc.) recebem o atributo fixmap.
  */
-static void free_area_init(void)
+static void init_pages_range(size_t start, size_t end)
 {
-    zone_t *zone;
+    size_t run = start;
     page_t *page;
     u8_t zone_id;
 
     /* Limpo a memória física do pagemap vector. */
-    memset(pgdat.node_page_map, 0, pgdat.node_last_pfn * sizeof(page_t));
+    memset(&pgdat.node_page_map[start], 0, (end - start) * sizeof(page_t));
 
-    /*---------------------------------------------------------------*/
-    pgdat.node_free_pages.value = 0; /* Faremos uma nova contagem de frames livre. */
-
-    /**
-     * @brief Atavessa todo o mem_map e complemento a configuração de
-     * cada "struct page", inserindo nas listas do buddy allocator
-     * aquelas que estão sinalizadas como livres.
-     * Faço também a identificação de alguns pageframes "reservados" pelo
-     * hardware para mapear APIC, IOAPIC, HPE etc. Eles recebem o atributo
-     * "fixmap" no seu flags.
-     *
-     */
-
-    for (size_t pfn = 0; pfn < pgdat.node_last_pfn; pfn++)
+    for (size_t pfn = start; pfn < end; pfn++)
     {
         zone_id = pfn_to_zoneid(pfn);
-        zone = zone_obj(zone_id);
         page = &pgdat.node_page_map[pfn];
 
         set_block_level(page, 0);     // Um frame corresponde ao order 0(zero)
@@ -534,12 +609,6 @@ static void free_area_init(void)
 
         set_page_present(page);
 
-        /**
-         * @brief Verifico se o pageframe já foi utilizado, durante
-         * a inicialização do sistema, quando as rotinas usam  o
-         * bitmap(pglist_data.bitmap_mem) para administrar a memória.
-         * Estes frames ficam marcados como reservados
-         */
         if (is_bootmem_frame_used(pfn))
         {
             set_page_used(page);
@@ -550,12 +619,90 @@ static void free_area_init(void)
         }
         else
         {
-            //__free_pages(page);
-            free_pages(page);
+            set_page_free(page);
+            continue;
         }
+
+        /* Fim de uma sequência de frames livres. */
+        free_area_range(run, pfn);
+        run = pfn + 1;
     }
 
-    kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
+    free_area_range(run, end);
+}
+
+/**
+ * -----------------------------------------------------------------------
+ * Faz a inicialização do vetor pagemap, utilizando o free/used do bitmap.
+ *
+ * Inicializa as listas do buddy allocator. A memória livre é entregue em
+ * blocos de ordem máxima, em vez de frame por frame.
+ *
+ * Somente os frames abaixo de BOOTMEM_DEFERRED_LOW_PFN são tratados aqui;
+ * o restante fica para deferred_init_start()/deferred_init_ap().
+ * -----------------------------------------------------------------------
+ */
+static void free_area_init(void)
+{
+    size_t low = round_up(BOOTMEM_DEFERRED_LOW_PFN, (size_t)1 << MAX_PAGE_ORDER);
+
+    if (low > pgdat.node_last_pfn)
+        low = pgdat.node_last_pfn;
+
+    /*---------------------------------------------------------------*/
+    pgdat.node_free_pages.value = 0; /* Faremos uma nova contagem de frames livre. */
+
+    init_pages_range(0, low);
+
+    deferred_start_pfn = low;
+    deferred_next_pfn = low;
+    deferred_pending = (pgdat.node_last_pfn - low + DEFERRED_CHUNK_PAGES - 1) / DEFERRED_CHUNK_PAGES;
+
+    kprintf("\n(*):%s(%d) - Finalizando. Adiados: pfn %x ->| %x", __FUNCTION__, __LINE__,
+            deferred_start_pfn, pgdat.node_last_pfn);
+}
+
+/* Inicializa partes do vetor de pages ainda não tratadas, até que acabem. */
+static void deferred_init_work(void)
+{
+    size_t start;
+
+    while ((start = __atomic_fetch_add(&deferred_next_pfn, DEFERRED_CHUNK_PAGES,
+                                       __ATOMIC_SEQ_CST)) < pgdat.node_last_pfn)
+    {
+        size_t end = start + DEFERRED_CHUNK_PAGES;
+        if (end > pgdat.node_last_pfn)
+            end = pgdat.node_last_pfn;
+
+        init_pages_range(start, end);
+        __atomic_sub_fetch(&deferred_pending, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * @brief Executada pelo BSP após o smp_init(). Libera os APs, participa da
+ * inicialização e só retorna quando todo o vetor de pages estiver pronto.
+ */
+void deferred_init_start(void)
+{
+    __atomic_store_n(&deferred_go, true, __ATOMIC_SEQ_CST);
+
+    deferred_init_work();
+
+    while (__atomic_load_n(&deferred_pending, __ATOMIC_ACQUIRE))
+        __builtin_ia32_pause();
+
+    kprintf("\n(*):%s(%d) - Vetor de pages inicializado. Frames livres: %d", __FUNCTION__,
+            __LINE__, pgdat.node_free_pages.value);
+}
+
+/* Executada por cada AP, antes do scheduler. */
+void deferred_init_ap(void)
+{
+    while (!__atomic_load_n(&deferred_go, __ATOMIC_ACQUIRE))
+        __builtin_ia32_pause();
+
+    deferred_init_work();
 }
 
 void init_bootmem(void)
@@ -668,125 +815,31 @@ static phys_addr_t alloc_bootmem(size_t size_bck)
     return mm_offset;
 }
 
-static inline phys_addr_t bootmem_map_p3(p4e_t *p4e, pgprot_t pg_prot, vm_flags_t flags)
+/* Callbacks do pgwalk. Os pagetables vêm do bootmem e o range físico é sempre
+contínuo. */
+struct bootmem_walk
 {
-    phys_addr_t pgframe = 0;
-
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico. */
-    if (p3_present(p4e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p4e).p4e);
-    }
-    /* Aloca um novo pageframe e insere seu endereço físico no entry. */
-    else
-    {
-        pgframe = alloc_bootmem_pagetable(flags);
-        clear_frame(phys_to_virt(pgframe));
-        (*p4e).p4e = pgframe | pg_prot.value; // Clear NXE bit
-    }
+    vm_area_t *vmm;
+    phys_addr_t base;
+};
 
-    return (pgframe);
-}
-static inline phys_addr_t bootmem_map_p2(p3e_t *p3e, pgprot_t pg_prot, vm_flags_t flags)
+static phys_addr_t bootmem_alloc_table(struct pgwalk *walk, u8_t level)
 {
-    phys_addr_t pgframe = 0;
-
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico. */
-    if (p2_present(p3e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p3e).p3e);
-    }
-    /* Aloca um novo pageframe e insere seu endereço físico no entry. */
-    else
-    {
-        pgframe = alloc_bootmem_pagetable(flags);
-        clear_frame(phys_to_virt(pgframe));
-        (*p3e).p3e = pgframe | pg_prot.value;
-    }
-    return (pgframe);
+    struct bootmem_walk *bw = walk->data;
+    return alloc_bootmem_pagetable(bw->vmm->flags);
 }
-static inline phys_addr_t bootmem_map_p1(p2e_t *p2e, pgprot_t pg_prot, vm_flags_t flags)
-{
-    phys_addr_t pgframe = 0;
 
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico. */
-    if (p1_present(p2e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p2e).p2e);
-    }
-    /* Aloca um novo pageframe e insere seu endereço físico no entry. */
-    else
-    {
-        pgframe = alloc_bootmem_pagetable(flags);
-        clear_frame(phys_to_virt(pgframe));
-        (*p2e).p2e = pgframe | pg_prot.value;
-    }
-    return (pgframe);
+static phys_addr_t bootmem_next_frame(struct pgwalk *walk, size_t index)
+{
+    struct bootmem_walk *bw = walk->data;
+    return bw->base + (index << PAGE_SHIFT);
 }
 
-/**
- * @brief Rotina genérica que recebe o endereço de um entry em P1 e o endereço físico
- * de um pageframe e faz o seu mapeamento.
- *
- * @param p1e
- * @param phys_addr
- * @param pg_flags
- * @return phys_addr_t
- */
-static inline phys_addr_t bootmem_map_frame(p1e_t *p1e, phys_addr_t phys_addr, u64_t pg_flags)
+static bool bootmem_is_contig(struct pgwalk *walk, size_t index, size_t nr)
 {
-    phys_addr_t pgframe = 0;
-
-    // Se o p1e já está mapeando um pageframe, devolve o seu endereço físico.
-    // Mas continuo o mapeamento do novo frame informado em phys_addr
-    if ((p1e->p1e) & PG_FLAG_P)
-    {
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
-    }
-    // Executo o bloco seguinte, inserindo o novo frame
-    else
-    {
-        p1_entry_t pte;
-        pte.value = phys_addr | pg_flags;
-        (p1e)->p1e = pte.value;
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
-
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, PFRAME_ID);
-    }
-
-    return (pgframe);
+    return true;
 }
-/**
- * @brief Rotina faz o mapeamento dos pagetables e devolve uma
- * entry no tablePage1 no qual deve ser inserido o dendereço
- * físico de um frame. Este esquema dá mais flexibilidade para
- * o mapeamento.
- *
- * @param vmm
- * @param vaddr
- * @return p1e_t*
- */
-static p1e_t *bootmem_mmap_frame(vm_area_t *vmm, virt_addr_t vaddr)
-{
-    virt_addr_t pml4 = init_mm.pml4;
-    //*****************************
-    p4e_t *p4e = p4_entry(pml4, (u64_t)vaddr);
-    bootmem_map_p3(p4e, vmm->pgprot, vmm->flags);
 
-    /* Mapeia um pagetable2 para a entrada no P3. */
-    p3e_t *p3e = p3_entry(p4e, (u64_t)vaddr);
-    bootmem_map_p2(p3e, vmm->pgprot, vmm->flags);
-
-    /* Mapeia um pagetable1 para a entrada no P2. */
-    p2e_t *p2e = p2_entry(p3e, (u64_t)vaddr);
-    bootmem_map_p1(p2e, vmm->pgprot, vmm->flags);
-
-    /* Mapeio o pageframe. */
-    p1e_t *p1e = p1_entry(p2e, (u64_t)vaddr);
-
-    return p1e;
-}
 /* Esta rotina só deve ser utilizada para mapear grandes e contínuas áreas
 físicas/virtuais. O flag informará de que área estamos tratando e podemos
 escolher o endereço físico inicial.*/
@@ -795,15 +848,26 @@ static void bootmem_loop_mmap_ranger(vm_area_t *vmm)
 {
     virt_addr_t ini = vmm->vm_start;
     virt_addr_t pend = vmm->vm_pend;
-    phys_addr_t pageframe = 0;
+    struct bootmem_walk bw = {.vmm = vmm, .base = 0};
+
+    struct pgwalk walk = {
+        .pml4 = init_mm.pml4,
+        .table_prot = vmm->pgprot.value,
+        .pte_prot = vmm->pgprot.value,
+        .alloc_table = bootmem_alloc_table,
+        .next_frame = bootmem_next_frame,
+        .huge = 0,
+        .is_contig = bootmem_is_contig,
+        .data = &bw,
+    };
 
     if (vmm->flags & VM_IDENTI)
     {
-        pageframe = (u64_t)ini;
+        bw.base = (u64_t)ini;
     }
     else if (vmm->flags & VM_RANGER)
     {
-        pageframe = vmm->phys_base;
+        bw.base = vmm->phys_base;
     }
     else if (vmm->flags & VM_FALLOC)
     {
@@ -811,64 +875,16 @@ static void bootmem_loop_mmap_ranger(vm_area_t *vmm)
         debug_pause("ERRO - flag VM_FALLOC não permitida.");
     }
 
-    kprintf("\nini=%p ->| pend=%p - pageframe=%x", ini, pend, pageframe);
-
-    for (virt_addr_t i = ini; i < pend; i = incptr(i, PAGE_SIZE))
-    {
-        if (vmm->flags & VM_SYSTEM)
-        {
-            if (pageframe >= ((u64_t)&_rodata_begin_phys) &&
-                pageframe < ((u64_t)&_rodata_end_phys))
-            {
-                // Somente leitura - limpa bit (Write)
-                // Nao permite execução - seta bit 63
-                // prot_tmp = (prot_tmp ^ PG_FLAG_NE);
-                // debug_pause("VM_KERNEL");
-            }
-            // TEXT = Código executável
-            else if (pageframe >= ((u64_t)&_text_begin_phys) &&
-                     pageframe < ((u64_t)&_text_end_phys))
-            {
-                // Somente leitura - limpa bit (Write)
-                // Permite execução - limpa bit 63
-                // prot_tmp = 0;
-            }
-            else
-            {
-                // Permite leitura e gravação
-                // prot_tmp = PG_FLAG_W;
-            }
-
-            if (pageframe > kernel_ini() && pageframe < kernel_pend())
-            {
-                /* PageTable statistic. */
-                // mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, PFRAME_ID);
-            }
-        }
+    /* O range físico é contínuo: a direct map e o vetor de pages são mapeados
+    com pages de 2MiB, ou de 1GiB se a CPU suportar, sempre que o alinhamento
+    permitir. */
+    walk.huge = PGWALK_HUGE_2M;
+    if (cpu_has_gbpages())
+        walk.huge |= PGWALK_HUGE_1G;
 
-        /*
-        Esta rotina é executada para todos os frames do intervalo
-        de memória.
-        */
-        p1e_t *p1e = bootmem_mmap_frame(vmm, i);
+    kprintf("\nini=%p ->| pend=%p - pageframe=%x", ini, pend, bw.base);
 
-        if ((p1e->p1e) & PG_FLAG_P)
-        {
-            kprintf("\ni=%p ->| pend=%p - pageframe=%x", i, pend, pageframe);
-            kprintf("\np1e=%p -> p1e->p1e=%x", p1e, p1e->p1e);
-
-            DBG_LINE();
-            pause_enter();
-        }
-        /**
-         * @brief Faz o mapeamento do frame, que tem o seu endereço
-         * físico inserido no entry do PageTable1.
-         */
-
-        // map_frame(p1e, pageframe, vmm->pgprot.value);
-        bootmem_map_frame(p1e, pageframe, vmm->pgprot.value);
-        pageframe = pageframe + PAGE_SIZE;
-    }
+    pgwalk_map_range(&walk, (mm_addr_t)ini, (mm_addr_t)pend);
 }
 static void mmap_bootmem(vm_area_t *vmm_area)
 {
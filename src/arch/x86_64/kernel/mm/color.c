@@ -0,0 +1,333 @@
+/*--------------------------------------------------------------------------
+*  File name:  color.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Page coloring. O cache L2 é indexado pelo endereço físico: os frames cujo pfn
+tem o mesmo resto na divisão pelo número de cores(tamanho de uma via do cache
+dividido pelo tamanho do page) disputam os mesmos sets. Stacks e pagetables
+alocados em sequência podem cair na mesma cor e se expulsar do cache, mesmo
+com o restante do cache livre.
+
+Esta camada fica sobre o buddy. Cada core mantém um bin por cor, abastecido com
+blocos de ordem log2(cores): um bloco alinhado desse tamanho tem exatamente um
+page de cada cor. As alocações com __GFP_COLOR recebem pages com cores em
+rodízio por core.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "stdio.h"
+#include "list.h"
+#include "kcpuid.h"
+#include "cache.h"
+#include "percpu.h"
+#include "smp.h"
+#include "sync/spin.h"
+#include "mm/mm_types.h"
+#include "mm/page.h"
+#include "mm/page_alloc.h"
+#include "mm/gfp.h"
+#include "mm/color.h"
+#include "../../drivers/time/tsc.h"
+
+struct color_cache
+{
+    spinlock_t lock; /* Só disputado no drain feito por outro core. */
+    list_head_t bins[MAX_CACHE_COLORS];
+    u32_t count;
+    u32_t next; /* Próxima cor do rodízio. */
+};
+
+/* Somente a zona normal é colorida: as demais vão direto ao buddy. */
+static struct color_cache color_caches[MAX_CORES];
+
+static u32_t nr_colors = 1;
+static u8_t color_order = 0;
+
+bool cache_color_enabled = false;
+
+/* Vias do L2 a partir do código de associatividade do CPUID.80000006H. */
+static u32_t l2_ways(void)
+{
+    cpuid_regs_t cpuid_var = cpuid_get(CPUID_EXT_L2_CACHE);
+    static const u8_t ways[16] = {0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0};
+
+    u8_t code = (cpuid_var.ecx >> 12) & 0xF;
+
+    /* Código desconhecido ou totalmente associativo: assumimos 8 vias. */
+    return ways[code] ? ways[code] : 8;
+}
+
+/**
+ * @brief Calcula o número de cores a partir do tamanho e da associatividade
+ * do L2 e ativa a camada de cores se houver mais de uma cor.
+ */
+void setup_cache_color(void)
+{
+    u64_t size = (u64_t)L2_cache_size() * 1024;
+    u32_t ways = l2_ways();
+    u32_t colors;
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        spinlock_init(&color_caches[cpu].lock);
+        for (u32_t c = 0; c < MAX_CACHE_COLORS; c++)
+            init_list_head(&color_caches[cpu].bins[c]);
+        color_caches[cpu].count = 0;
+        color_caches[cpu].next = cpu; /* Cores diferentes começam em cores diferentes. */
+    }
+
+    colors = size / ((u64_t)ways * PAGE_SIZE);
+    if (colors > MAX_CACHE_COLORS)
+        colors = MAX_CACHE_COLORS;
+
+    /* O número de cores precisa ser potência de 2 para o bloco de refill. */
+    color_order = 0;
+    while (colors > 1 && (1U << (color_order + 1)) <= colors)
+        color_order++;
+    nr_colors = 1U << color_order;
+
+    cache_color_enabled = (nr_colors > 1);
+
+    kprintf("\nCACHE COLOR: L2=%d kbytes, %d vias, linha=%d bytes - %d cores.",
+            L2_cache_size(), ways, L2_cache_line_size(), nr_colors);
+}
+
+u32_t cache_colors(void)
+{
+    return nr_colors;
+}
+
+u32_t page_cache_color(page_t *page)
+{
+    return page_to_pfn(page) & (nr_colors - 1);
+}
+
+/* Devolve ao buddy os pages dos bins do core. O lock do core já foi feito. */
+static size_t __color_cache_drain(struct color_cache *cc)
+{
+    page_t *page = NULL;
+    size_t nr = cc->count;
+
+    for (u32_t c = 0; c < nr_colors; c++)
+    {
+        while (!list_is_empty(&cc->bins[c]))
+        {
+            page = list_entry(cc->bins[c].next, page_t, node);
+            list_del(&page->node);
+            cc->count--;
+            free_pages(page);
+        }
+    }
+    return nr;
+}
+
+/* Retira do buddy um bloco com um page de cada cor e o distribui nos bins. O
+lock é liberado durante a alocação: sob pressão, o buddy faz o drain dos bins
+de todos os cores, inclusive deste. */
+static bool color_cache_refill(struct color_cache *cc, gfp_t gfp_mask)
+{
+    page_t *bck = NULL;
+
+    if (cc->count >= COLOR_CACHE_HIGH(nr_colors))
+        __color_cache_drain(cc);
+
+    spinlock_unlock(&cc->lock);
+    bck = alloc_pages(gfp_zone(gfp_mask), color_order);
+    spinlock_lock(&cc->lock);
+
+    if (bck == NULL)
+        return false;
+
+    split_pages_block(bck, color_order);
+    for (u32_t i = 0; i < nr_colors; i++)
+    {
+        list_add(&bck[i].node, &cc->bins[page_cache_color(&bck[i])]);
+        cc->count++;
+    }
+    return true;
+}
+
+static page_t *__alloc_page_color(struct color_cache *cc, gfp_t gfp_mask, u32_t color)
+{
+    page_t *page = NULL;
+
+    /* Outro core pode esvaziar os bins enquanto o refill aloca o bloco. */
+    while (list_is_empty(&cc->bins[color]))
+    {
+        if (!color_cache_refill(cc, gfp_mask))
+            return NULL;
+    }
+
+    page = list_entry(cc->bins[color].next, page_t, node);
+    list_del(&page->node);
+    cc->count--;
+
+    return page;
+}
+
+/**
+ * @brief Aloca um page de ordem 0 com a cor de cache 'color'.
+ *
+ * @param gfp_mask
+ * @param color
+ * @return page_t*
+ */
+page_t *alloc_page_color(gfp_t gfp_mask, u32_t color)
+{
+    struct color_cache *cc = NULL;
+    page_t *page = NULL;
+
+    if (!cache_color_enabled || gfp_zone(gfp_mask) != GFP_ZONE_NORMAL)
+        return alloc_pages(gfp_zone(gfp_mask), 0);
+
+    preempt_disable();
+    cc = &color_caches[cpu_id()];
+    spinlock_lock(&cc->lock);
+    page = __alloc_page_color(cc, gfp_mask, color & (nr_colors - 1));
+    spinlock_unlock(&cc->lock);
+    preempt_enable();
+
+    return page;
+}
+
+/**
+ * @brief Aloca 'nr_pages' pages de ordem 0 com as próximas cores do rodízio
+ * do core. Pages consecutivos têm cores consecutivas.
+ *
+ * @param gfp_mask
+ * @param nr_pages
+ * @param array
+ * @return size_t número de pages efetivamente alocados.
+ */
+size_t alloc_pages_colored(gfp_t gfp_mask, size_t nr_pages, page_t **array)
+{
+    struct color_cache *cc = NULL;
+    size_t nr = 0;
+
+    if (!cache_color_enabled || gfp_zone(gfp_mask) != GFP_ZONE_NORMAL)
+        return 0;
+
+    preempt_disable();
+    cc = &color_caches[cpu_id()];
+    spinlock_lock(&cc->lock);
+    for (; nr < nr_pages; nr++)
+    {
+        array[nr] = __alloc_page_color(cc, gfp_mask, cc->next);
+        if (array[nr] == NULL)
+            break;
+
+        cc->next = (cc->next + 1) & (nr_colors - 1);
+    }
+    spinlock_unlock(&cc->lock);
+    preempt_enable();
+
+    return nr;
+}
+
+/* Devolve ao buddy os pages retidos nos bins de todos os cores. Usada sob
+pressão de memória. */
+size_t cache_color_drain(void)
+{
+    struct color_cache *cc = NULL;
+    size_t total = 0;
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        cc = &color_caches[cpu];
+        if (cc->count == 0)
+            continue;
+
+        spinlock_lock(&cc->lock);
+        total += __color_cache_drain(cc);
+        spinlock_unlock(&cc->lock);
+    }
+    return total;
+}
+
+/*--------------------------------------------------------------------------
+Benchmark: NR_BENCH_STACKS stacks de dois pages, em que só o page do topo é
+usado, como acontece com as stacks dos tasks. Cada rodada percorre o frame de
+cada stack(BENCH_FRAME_SIZE bytes a partir do topo), como numa troca de
+contexto. Sem cores, os pages do topo de blocos de ordem 1 só ocupam cores
+ímpares; com cores, ocupam todas as cores do L2.
+--------------------------------------------------------------------------*/
+#define NR_BENCH_STACKS 64
+#define BENCH_FRAME_SIZE 2048
+#define BENCH_ROUNDS 2000
+
+static u64_t bench_stacks(page_t **tops, u32_t *used_colors)
+{
+    u64_t ini, end;
+    u32_t mask = 0;
+
+    for (size_t i = 0; i < NR_BENCH_STACKS; i++)
+        mask |= 1U << page_cache_color(tops[i]);
+
+    *used_colors = __builtin_popcount(mask);
+
+    ini = tsc_read();
+    for (size_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        for (size_t i = 0; i < NR_BENCH_STACKS; i++)
+        {
+            volatile u64_t *frame = (u64_t *)phys_to_virt(page_to_phys(tops[i]) + PAGE_SIZE - BENCH_FRAME_SIZE);
+
+            for (size_t w = 0; w < BENCH_FRAME_SIZE / sizeof(u64_t); w += 8)
+                frame[w] += r;
+        }
+    }
+    end = tsc_read();
+
+    return (end - ini) / BENCH_ROUNDS;
+}
+
+/**
+ * @brief Compara as stacks alocadas em blocos de ordem 1 do buddy com as
+ * stacks alocadas pela camada de cores. Mostra os ciclos médios por rodada.
+ */
+void cache_color_bench(void)
+{
+    page_t *blocks[NR_BENCH_STACKS] = {NULL};
+    page_t *tops[NR_BENCH_STACKS] = {NULL};
+    u64_t plain = 0, colored = 0;
+    u32_t plain_colors = 0, colored_colors = 0;
+    size_t nr, nr_colored;
+
+    if (!cache_color_enabled)
+    {
+        kprintf("\nCACHE COLOR: desativado(%d cor).", nr_colors);
+        return;
+    }
+
+    for (nr = 0; nr < NR_BENCH_STACKS; nr++)
+    {
+        blocks[nr] = alloc_pages(GFP_ZONE_NORMAL, 1);
+        if (blocks[nr] == NULL)
+            goto out;
+        tops[nr] = blocks[nr] + 1;
+    }
+    plain = bench_stacks(tops, &plain_colors);
+
+    /* tops[] passa a conter os pages coloridos. Os blocos continuam em blocks[]. */
+    nr_colored = alloc_pages_colored(GFP_ZONE_NORMAL, NR_BENCH_STACKS, tops);
+    if (nr_colored == NR_BENCH_STACKS)
+        colored = bench_stacks(tops, &colored_colors);
+
+    /* Mesmo numa alocação parcial, os pages obtidos são devolvidos. */
+    for (size_t i = 0; i < nr_colored; i++)
+        free_pages(tops[i]);
+
+    kprintf("\nCACHE COLOR: %d stacks, frame=%d bytes, %d cores no L2.", NR_BENCH_STACKS,
+            BENCH_FRAME_SIZE, nr_colors);
+    kprintf("\n  buddy:  %d cores usadas - %d ciclos por rodada.", plain_colors, plain);
+    kprintf("\n  cores:  %d cores usadas - %d ciclos por rodada.", colored_colors, colored);
+
+out:
+    for (size_t i = 0; i < nr; i++)
+        free_pages(blocks[i]);
+}
@@ -0,0 +1,38 @@
+/*--------------------------------------------------------------------------
+*  File name:  color.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas da alocação de pages com cores de cache(page
+coloring), a partir da geometria do cache L2.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* CPUID.80000006H:ECX - tamanho(31-16), associatividade(15-12) e tamanho da
+linha(7-0) do cache L2. */
+#define CPUID_EXT_L2_CACHE 0x80000006
+
+#define MAX_CACHE_COLORS 32
+
+/* Acima deste total de pages nos bins de um core, os bins são devolvidos ao
+buddy antes do próximo refill. */
+#define COLOR_CACHE_HIGH(colors) ((colors) * 4)
+
+extern bool cache_color_enabled;
+
+void setup_cache_color(void);
+u32_t cache_colors(void);
+u32_t page_cache_color(page_t *page);
+
+page_t *alloc_page_color(gfp_t gfp_mask, u32_t color);
+size_t alloc_pages_colored(gfp_t gfp_mask, size_t nr_pages, page_t **array);
+size_t cache_color_drain(void);
+
+void cache_color_bench(void);
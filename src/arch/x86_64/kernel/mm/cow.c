@@ -0,0 +1,506 @@
+/*--------------------------------------------------------------------------
+*  File name:  cow.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Espaços de endereçamento por processo e fork com copy-on-write.
+
+Cada processo do user mode possui o seu próprio PML4. A metade do kernel é
+compartilhada: os entries do PML4 apontam para os mesmos P3 do init_mm. O
+user space é duplicado no fork apenas no nível dos pagetables; os frames são
+compartilhados pelo pai e pelo filho, com os entries de P1 sem o bit W e com
+o bit PG_FLAG_COW. A primeira escrita num desses pages provoca um page fault
+de proteção e cow_handle_write() faz a cópia do frame. Assim, o custo do fork
+não depende do tamanho dos dados do processo, e só os pages efetivamente
+escritos são copiados.
+
+O contador de referências de cada frame fica na tabela page_refs, indexada
+pelo pfn. O valor guarda apenas os compartilhamentos extras: zero significa
+que um único espaço de endereçamento mapeia o frame.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "string.h"
+#include "task.h"
+#include "percpu.h"
+#include "sync/spin.h"
+#include "mm/mm.h"
+#include "mm/mm_types.h"
+#include "mm/page.h"
+#include "mm/page_alloc.h"
+#include "mm/pgtable_types.h"
+#include "mm/pgtable.h"
+#include "mm/vmm.h"
+#include "mm/tlb.h"
+#include "mm/kmalloc.h"
+#include "mm/vmalloc.h"
+#include "mm/pgwalk.h"
+#include "mm/cow.h"
+#include "mm/pcid.h"
+#include "mm/gfp.h"
+
+extern node_t pgdat;
+
+/* Flags dos pagetables e dos pages do user space. */
+#define MM_USER_TABLE_PROT (PG_FLAG_P | PG_FLAG_W | PG_FLAG_U)
+#define MM_USER_PAGE_PROT (PG_FLAG_P | PG_FLAG_W | PG_FLAG_U)
+
+/* Protege page_refs e os entries de P1 compartilhados. */
+CREATE_SPINLOCK(cow_lock);
+
+static u32_t *page_refs = NULL;
+static size_t page_refs_nr = 0;
+
+/* Espaço de endereçamento de cada task, indexado pelo pid, como pidTable. */
+static mm_struct_t **mm_table = NULL;
+
+static bool page_refs_init(void)
+{
+    if (page_refs)
+        return true;
+
+    size_t nr = pgdat.node_last_pfn + 1;
+    u32_t *refs = vmalloc(nr * sizeof(u32_t));
+    if (!refs)
+        return false;
+
+    memset(refs, 0, nr * sizeof(u32_t));
+    page_refs_nr = nr;
+    page_refs = refs;
+    return true;
+}
+
+/* Os frames fora da tabela(MMIO, framebuffer) não são contados. */
+static inline void page_ref_inc(phys_addr_t frame)
+{
+    size_t pfn = phys_to_pfn(frame);
+
+    if (!page_refs || pfn >= page_refs_nr)
+        return;
+    page_refs[pfn]++;
+}
+
+/* Devolve true se ainda havia outro espaço de endereçamento mapeando o frame. */
+static inline bool page_ref_dec(phys_addr_t frame)
+{
+    size_t pfn = phys_to_pfn(frame);
+
+    if (!page_refs || pfn >= page_refs_nr || !page_refs[pfn])
+        return false;
+
+    page_refs[pfn]--;
+    return true;
+}
+
+u32_t page_ref_count(phys_addr_t frame)
+{
+    size_t pfn = phys_to_pfn(frame);
+
+    if (!page_refs || pfn >= page_refs_nr)
+        return 1;
+    return page_refs[pfn] + 1;
+}
+
+static inline void mm_free_frame(phys_addr_t frame)
+{
+    free_pages(pfn_to_page(phys_to_pfn(frame)));
+}
+
+mm_struct_t *mm_of_task(pid_t pid)
+{
+    if (!mm_table)
+        return NULL;
+    return mm_table[pid];
+}
+
+/* Devolve false se a tabela não pôde ser alocada. */
+bool mm_set_task(pid_t pid, mm_struct_t *mm)
+{
+    if (!mm_table)
+    {
+        mm_struct_t **table = vmalloc(PID_MAX * sizeof(mm_struct_t *));
+        if (!table)
+            return false;
+
+        memset(table, 0, PID_MAX * sizeof(mm_struct_t *));
+        mm_table = table;
+    }
+    mm_table[pid] = mm;
+    return true;
+}
+
+/* Aloca um pagetable do user space e o grava no entry. */
+static u64_t *mm_table_alloc(mm_struct_t *mm, u64_t *entry, u8_t level)
+{
+    phys_addr_t frame = alloc_zeroed_pagetable();
+    if (!frame)
+        return NULL;
+
+    *entry = frame | MM_USER_TABLE_PROT;
+
+    /* PageTable statistic. */
+    mm_tables_alloc_counter_inc(&mm->mm_pgtables, level);
+
+    return phys_to_virt(frame);
+}
+
+static inline u64_t *mm_table_next(u64_t entry)
+{
+    return phys_to_virt(MASK_PAGE_ENTRY(entry));
+}
+
+/**
+ * @brief Os P3 da metade do kernel são alocados no init_mm antes do primeiro
+ * fork. Como os novos PML4 copiam esses entries, um mapeamento posterior do
+ * kernel(vmalloc, kmap) é visto por todos os espaços de endereçamento sem que
+ * seja preciso sincronizar os PML4.
+ */
+static bool mm_kernel_prealloc(void)
+{
+    static bool done = false;
+    u64_t *pml4 = init_mm.pml4;
+
+    if (done)
+        return true;
+
+    for (size_t i = MM_PML4_KERNEL_FIRST; i < PGWALK_NR_ENTRIES; i++)
+    {
+        if (pml4[i] & PG_FLAG_P)
+            continue;
+
+        if (!mm_table_alloc(&init_mm, &pml4[i], P3_ID))
+            return false;
+    }
+
+    done = true;
+    return true;
+}
+
+/* Compartilha os pages de um P1 do pai com o filho, em copy-on-write. */
+static void mm_share_p1(mm_struct_t *child, u64_t *parent_p1, u64_t *child_p1)
+{
+    for (size_t i = 0; i < PGWALK_NR_ENTRIES; i++)
+    {
+        u64_t pte = parent_p1[i];
+
+        if (!(pte & PG_FLAG_P))
+            continue;
+
+        if (pte & (PG_FLAG_W | PG_FLAG_COW))
+            pte = (pte & ~PG_FLAG_W) | PG_FLAG_COW;
+
+        parent_p1[i] = pte;
+        child_p1[i] = pte;
+        page_ref_inc(MASK_PAGE_ENTRY(pte));
+
+        /* PageTable statistic. */
+        mm_tables_alloc_counter_inc(&child->mm_pgtables, PFRAME_ID);
+    }
+}
+
+/* Duplica um pagetable do user space. 'level' é o nível da tabela recebida:
+P3_ID, P2_ID ou P1_ID. */
+static bool mm_copy_table(mm_struct_t *child, u64_t *parent_tbl, u64_t *child_tbl, u8_t level)
+{
+    for (size_t i = 0; i < PGWALK_NR_ENTRIES; i++)
+    {
+        u64_t entry = parent_tbl[i];
+
+        if (!(entry & PG_FLAG_P))
+            continue;
+
+        /* O user space só é mapeado com pages de 4KiB. */
+        if (entry & PG_FLAG_PS)
+        {
+            WARN_ON("Page grande no user space: entry=%x", entry);
+            continue;
+        }
+
+        u64_t *next = mm_table_alloc(child, &child_tbl[i], level == P3_ID ? P2_ID : P1_ID);
+        if (!next)
+            return false;
+
+        if (level == P2_ID)
+            mm_share_p1(child, mm_table_next(entry), next);
+        else if (!mm_copy_table(child, mm_table_next(entry), next, P2_ID))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Cria o espaço de endereçamento de um processo filho. A metade do
+ * kernel é compartilhada e o user space do pai é compartilhado em
+ * copy-on-write. 'parent' NULL indica o init_mm, que não possui user space.
+ */
+mm_struct_t *mm_fork(mm_struct_t *parent)
+{
+    if (!parent)
+        parent = &init_mm;
+
+    mm_struct_t *mm = kmalloc(sizeof(mm_struct_t));
+    if (!mm)
+        return NULL;
+
+    memset(mm, 0, sizeof(mm_struct_t));
+    pt4_alloc(mm);
+
+    u64_t *parent_pml4 = parent->pml4;
+    u64_t *pml4 = mm->pml4;
+    bool ok = true;
+
+    spinlock_lock(&cow_lock);
+
+    if (!page_refs_init() || !mm_kernel_prealloc())
+    {
+        spinlock_unlock(&cow_lock);
+        mm_free(mm);
+        return NULL;
+    }
+
+    /* Entries do kernel. */
+    pml4[0] = parent_pml4[0];
+    for (size_t i = MM_PML4_KERNEL_FIRST; i < PGWALK_NR_ENTRIES; i++)
+        pml4[i] = parent_pml4[i];
+
+    /* User space. */
+    for (size_t i = MM_PML4_USER_FIRST; ok && i < MM_PML4_KERNEL_FIRST; i++)
+    {
+        if (!(parent_pml4[i] & PG_FLAG_P))
+            continue;
+
+        u64_t *p3 = mm_table_alloc(mm, &pml4[i], P3_ID);
+        ok = (p3 && mm_copy_table(mm, mm_table_next(parent_pml4[i]), p3, P3_ID));
+    }
+
+    spinlock_unlock(&cow_lock);
+
+    /* Os entries do pai perderam o bit W. O pai é o task em execução neste
+    core: a TLB local é descartada e os ASIDs do pai nos demais cores deixam
+    de ser válidos. */
+    if (parent != &init_mm)
+    {
+        if ((__read_cr3() & ~(PAGE_SIZE - 1)) == virt_to_phys(parent->pml4))
+            __vm_flush_tlb();
+        pcid_mm_invalidate(parent, true);
+    }
+
+    if (!ok)
+    {
+        mm_free(mm);
+        return NULL;
+    }
+
+    return mm;
+}
+
+/* Libera os pagetables do user space e os frames que não são mais compar-
+tilhados. 'level' é o nível da tabela recebida. */
+static void mm_free_table(mm_struct_t *mm, u64_t *tbl, u8_t level)
+{
+    for (size_t i = 0; i < PGWALK_NR_ENTRIES; i++)
+    {
+        u64_t entry = tbl[i];
+
+        if (!(entry & PG_FLAG_P))
+            continue;
+
+        if (level == P1_ID)
+        {
+            phys_addr_t frame = MASK_PAGE_ENTRY(entry);
+
+            /* Um frame fora da tabela de referências(MMIO, framebuffer) não
+            pertence ao buddy e não é liberado. */
+            if (!page_ref_dec(frame) && phys_to_pfn(frame) < page_refs_nr)
+                mm_free_frame(frame);
+
+            mm_tables_alloc_counter_dec(&mm->mm_pgtables, PFRAME_ID);
+            continue;
+        }
+
+        if (entry & PG_FLAG_PS)
+            continue;
+
+        u8_t next_level = (level == P3_ID) ? P2_ID : P1_ID;
+        mm_free_table(mm, mm_table_next(entry), next_level);
+        mm_free_frame(MASK_PAGE_ENTRY(entry));
+        mm_tables_alloc_counter_dec(&mm->mm_pgtables, next_level);
+    }
+}
+
+void mm_free(mm_struct_t *mm)
+{
+    if (!mm || mm == &init_mm)
+        return;
+
+    u64_t *pml4 = mm->pml4;
+
+    spinlock_lock(&cow_lock);
+
+    for (size_t i = MM_PML4_USER_FIRST; i < MM_PML4_KERNEL_FIRST; i++)
+    {
+        if (!(pml4[i] & PG_FLAG_P))
+            continue;
+
+        mm_free_table(mm, mm_table_next(pml4[i]), P3_ID);
+        mm_free_frame(MASK_PAGE_ENTRY(pml4[i]));
+        mm_tables_alloc_counter_dec(&mm->mm_pgtables, P3_ID);
+    }
+
+    spinlock_unlock(&cow_lock);
+
+    /* O endereço do mm pode ser reutilizado por um novo espaço de endereça-
+    mento, que não pode herdar os ASIDs deste. */
+    pcid_mm_invalidate(mm, false);
+
+    mm_free_frame(virt_to_phys(pml4));
+    kfree(mm);
+}
+
+/* Carrega o PML4 do espaço de endereçamento, se ele ainda não for o atual.
+Com PCID, as traduções do mm que ainda estiverem na TLB são mantidas. */
+void mm_switch(mm_struct_t *mm)
+{
+    if (!mm)
+        mm = &init_mm;
+
+    phys_addr_t cr3 = virt_to_phys(mm->pml4);
+    if ((__read_cr3() & ~(PAGE_SIZE - 1)) != cr3)
+        pcid_switch_mm(mm, cr3);
+}
+
+/* Devolve o entry de P1 que mapeia 'addr' no user space, criando os page-
+tables ausentes se 'alloc' for true. */
+static u64_t *mm_user_pte(mm_struct_t *mm, mm_addr_t addr, bool alloc)
+{
+    u64_t *tbl = mm->pml4;
+    u8_t level[] = {P3_ID, P2_ID, P1_ID};
+    u8_t shift = 39;
+
+    for (size_t i = 0; i < 3; i++, shift -= 9)
+    {
+        u64_t *entry = &tbl[(addr >> shift) & (PGWALK_NR_ENTRIES - 1)];
+
+        if (!((*entry) & PG_FLAG_P))
+        {
+            if (!alloc || !(tbl = mm_table_alloc(mm, entry, level[i])))
+                return NULL;
+            continue;
+        }
+        if ((*entry) & PG_FLAG_PS)
+            return NULL;
+
+        tbl = mm_table_next(*entry);
+    }
+
+    return &tbl[(addr >> PAGE_SHIFT) & (PGWALK_NR_ENTRIES - 1)];
+}
+
+/**
+ * @brief Mapeia a stack do user mode, com 'size' bytes abaixo de
+ * MM_USER_STACK_TOP. Os pages herdados do pai em copy-on-write são mantidos.
+ * @retval O rsp inicial ou NULL se faltar memória.
+ */
+virt_addr_t mm_user_stack(mm_struct_t *mm, size_t size)
+{
+    mm_addr_t addr = MM_USER_STACK_TOP - round_up(size, PAGE_SIZE);
+    bool ok = true;
+
+    spinlock_lock(&cow_lock);
+
+    for (; ok && addr < MM_USER_STACK_TOP; addr += PAGE_SIZE)
+    {
+        u64_t *pte = mm_user_pte(mm, addr, true);
+        if (!pte)
+        {
+            ok = false;
+            break;
+        }
+        if ((*pte) & PG_FLAG_P)
+            continue;
+
+        phys_addr_t frame = alloc_zeroed_frame(GFP_ZONE_NORMAL | __GFP_COLOR);
+        if (!frame)
+        {
+            ok = false;
+            break;
+        }
+        *pte = frame | MM_USER_PAGE_PROT;
+
+        /* PageTable statistic. */
+        mm_tables_alloc_counter_inc(&mm->mm_pgtables, PFRAME_ID);
+    }
+
+    spinlock_unlock(&cow_lock);
+
+    if (!ok)
+        return NULL;
+    return (virt_addr_t)(MM_USER_STACK_TOP - 16);
+}
+
+/**
+ * @brief Trata um page fault de escrita num page protegido do user space.
+ * Se o frame ainda for compartilhado, o conteúdo é copiado para um novo frame;
+ * se este espaço de endereçamento for o último a mapeá-lo, basta devolver o
+ * bit W ao entry.
+ * @retval true se o fault foi resolvido e a instrução pode ser repetida.
+ */
+bool cow_handle_write(mm_addr_t addr)
+{
+    if (addr < MM_USER_START || addr >= MM_USER_END)
+        return false;
+
+    mm_struct_t *mm = mm_of_task(percpu_current()->pid);
+    if (!mm)
+        return false;
+
+    addr &= ~((mm_addr_t)PAGE_SIZE - 1);
+    bool done = false;
+
+    spinlock_lock(&cow_lock);
+
+    u64_t *pte = mm_user_pte(mm, addr, false);
+    if (pte && ((*pte) & PG_FLAG_P) && ((*pte) & PG_FLAG_W) && ((*pte) & PG_FLAG_U))
+    {
+        /* O entry já permite a escrita: a TLB deste core guardava a tradução
+        anterior à cópia feita em outro core. */
+        done = true;
+    }
+    else if (pte && ((*pte) & PG_FLAG_P) && ((*pte) & PG_FLAG_COW))
+    {
+        phys_addr_t frame = MASK_PAGE_ENTRY(*pte);
+        u64_t flags = ((*pte) & ~MASK_PAGE_ENTRY(*pte) & ~PG_FLAG_COW) | PG_FLAG_W;
+
+        if (page_ref_count(frame) == 1)
+        {
+            *pte = frame | flags;
+            done = true;
+        }
+        else
+        {
+            phys_addr_t copy = alloc_frames(GFP_ZONE_NORMAL, 0);
+            if (copy)
+            {
+                memcpy(phys_to_virt(copy), phys_to_virt(frame), PAGE_SIZE);
+                page_ref_dec(frame);
+                *pte = copy | flags;
+                done = true;
+            }
+        }
+    }
+
+    spinlock_unlock(&cow_lock);
+
+    if (done)
+    {
+        __vm_invlpg_tlb(addr);
+        pcid_mm_invalidate(mm, true);
+    }
+
+    return done;
+}
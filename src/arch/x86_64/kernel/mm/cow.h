@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------------
+*  File name:  cow.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas dos espaços de endereçamento por processo e do
+fork com copy-on-write.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* Bit disponível ao software(bits 9-11) nos entries de P1: o page é compar-
+tilhado por fork e deve ser copiado na primeira escrita. */
+#ifndef PG_FLAG_COW
+#define PG_FLAG_COW (1UL << 9)
+#endif
+
+/* O user space de cada processo ocupa os entries 1 a 255 do PML4. O entry 0
+(identidade dos primeiros megas) e a metade alta pertencem ao kernel e são
+compartilhados por todos os espaços de endereçamento. */
+#define MM_PML4_USER_FIRST 1
+#define MM_PML4_KERNEL_FIRST 256
+#define MM_USER_START ((mm_addr_t)MM_PML4_USER_FIRST << 39)
+#define MM_USER_END ((mm_addr_t)MM_PML4_KERNEL_FIRST << 39)
+
+/* Topo da stack do user mode, no fim do user space. */
+#define MM_USER_STACK_TOP (MM_USER_END - PAGE_SIZE)
+
+/* Quantidade de espaços de endereçamento que mapeiam o frame. */
+u32_t page_ref_count(phys_addr_t frame);
+
+/* Espaço de endereçamento de cada task. NULL indica o init_mm. */
+mm_struct_t *mm_of_task(pid_t pid);
+bool mm_set_task(pid_t pid, mm_struct_t *mm);
+
+mm_struct_t *mm_fork(mm_struct_t *parent);
+void mm_free(mm_struct_t *mm);
+void mm_switch(mm_struct_t *mm);
+virt_addr_t mm_user_stack(mm_struct_t *mm, size_t size);
+
+bool cow_handle_write(mm_addr_t addr);
@@ -0,0 +1,55 @@
+/*--------------------------------------------------------------------------
+*  File name:  gfp.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas do page allocator que complementam
+alloc_pages()/free_pages().
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* Os bits baixos do gfp_t selecionam a zona. Os demais modificam a alocação. */
+#define GFP_ZONE_MASK 0x0F
+
+/* O bloco é devolvido zerado. Os pages isolados vêm, sempre que possível, do
+pool de pages zerados pelo idle task. */
+#define __GFP_ZERO 0x80
+
+/* Pages de ordem 0 com as próximas cores de cache do core(color.c). */
+#define __GFP_COLOR 0x40
+
+static inline gfp_t gfp_zone(gfp_t gfp_mask)
+{
+    return (gfp_mask & GFP_ZONE_MASK);
+}
+
+/* Alocação e liberação em lote de pages de ordem 0. */
+size_t alloc_pages_bulk(gfp_t gfp_mask, size_t nr_pages, page_t **array);
+void free_pages_bulk(page_t **array, size_t nr_pages);
+
+/* Frame de ordem 0 zerado. Usado nos pagetables e nas áreas do user space. */
+phys_addr_t alloc_zeroed_frame(gfp_t gfp_mask);
+phys_addr_t alloc_zeroed_pagetable(void);
+
+/* Pool de pages zerados de cada zona. */
+void zero_pool_refill_idle(void);
+size_t zero_pool_drain(void);
+
+/* Zera um frame com stores non-temporal, sem trazê-lo para o cache. */
+void __clear_frame_nt(virt_addr_t frame);
+
+/* Pages de blocos inconsistentes retirados do buddy. */
+size_t quarantined_pages_nr(void);
+
+/* Divide um bloco alocado em pages de ordem 0. */
+void split_pages_block(page_t *page, u8_t order);
+
+/* Devolução ao page allocator de memória retida pelo heap do kmalloc. */
+void heap_trim_idle(void);
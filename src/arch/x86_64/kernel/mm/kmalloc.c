@@ -16,6 +16,34 @@ Este header reune estruturas para o Page Memory Allocator
 #include "string.h"
 #include "list.h"
 #include "mm/mm_heap.h"
+#include "mm/slab.h"
+#include "mm/page_alloc.h"
+#include "mm/page.h"
+#include "mm/pgtable_types.h"
+#include "mm/pgtable.h"
+#include "mm/vmm.h"
+#include "time.h"
+#include "mm/gfp.h"
+#include "sync/spin.h"
+#include "smp/tlb.h"
+
+/* Lock do buddy do heap. Protege as free lists, o mapa de ordens e o
+crescimento do heap(brk). As classes de tamanho pequenas não passam por
+aqui: são atendidas pelos magazines de cada core, no slab. */
+CREATE_SPINLOCK(spinlock_heap);
+
+/* Mapa de bits das ordens com blocos livres no heap. O bit 'n' está ligado se,
+e somente se, kmm_heap.free_lists[n] não estiver vazia. */
+static u64_t heap_order_map = 0;
+
+/* Devolve a menor ordem >= 'order' presente no mapa, ou -1. */
+static inline int find_first_order(u64_t map, int order)
+{
+    map &= ~((1ULL << order) - 1);
+    if (map == 0)
+        return -1;
+    return __builtin_ctzll(map);
+}
 
 /**
  * @brief Faço a inicialização das listas para serem utilizada pelo
@@ -33,6 +61,7 @@ void init_buddy_free_lists()
         kmm_heap.free_lists[i]
             .counter.value = 0;
     }
+    heap_order_map = 0;
 
     kprintf("\nLinha: %d - INIT_KMALLOC: Finalizado.", __LINE__);
 }
@@ -175,6 +204,100 @@ static inline bool is_buddy_free(freeHead_t *bud)
     return true;
 }
 
+/*-----------------------------------------------------------------------------
+Objetos grandes. Um pedido cujo bloco não cabe num PAGE_SIZE é atendido direto
+por alloc_pages(), sem passar pelo heap. O page head recebe um marcador no seu
+'node', que não é utilizado enquanto o page está alocado, permitindo a kfree()
+reconhecê-lo. A ordem do bloco fica em page->level.
+-----------------------------------------------------------------------------*/
+#define KMALLOC_LARGE_SIZE PAGE_SIZE
+#define PAGE_KMALLOC_LARGE ((list_head_t *)0x6B6D6C67)
+
+static inline page_t *kmalloc_virt_to_page(void *memory)
+{
+    return pfn_to_page(phys_to_pfn(virt_to_phys(memory)));
+}
+
+static virt_addr_t kmalloc_large(size_t mm_size)
+{
+    u8_t order = 0;
+    page_t *page = NULL;
+
+    while ((PAGE_SIZE << order) < mm_size)
+        order++;
+
+    if (order >= MAX_PAGE_ORDER)
+    {
+        WARN_ON("Memory requisitada %d maior que %d.\n", mm_size, PAGE_SIZE << (MAX_PAGE_ORDER - 1));
+        return NULL;
+    }
+
+    page = alloc_pages(GFP_ZONE_NORMAL, order);
+    if (page == NULL)
+        return NULL;
+
+    page->node.next = PAGE_KMALLOC_LARGE;
+    page->node.prev = NULL;
+
+    return (virt_addr_t)phys_to_virt(page_to_phys(page));
+}
+
+static inline bool kfree_large(void *memory)
+{
+    page_t *page = kmalloc_virt_to_page(memory);
+
+    if (page->node.next != PAGE_KMALLOC_LARGE)
+        return false;
+
+    page->node.next = NULL;
+    free_pages(page);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Crescimento do heap. Cada brk() dobra o tamanho atual do heap, limitado a
+HEAP_GROW_MAX e ao tamanho máximo do heap. Os blocos são potências de 2 pages,
+pois maping_heap() obtém um único bloco físico de alloc_heap_block().
+-----------------------------------------------------------------------------*/
+#define HEAP_GROW_MAX (PAGE_SIZE << 8)
+
+static bool heap_refill_trimmed(void);
+
+static bool heap_grow(size_t bck_size)
+{
+    size_t grow = kmm_heap.heap_size;
+
+    /* Antes de avançar o heap, reaproveitamos os blocos desmapeados pelo trim. */
+    if (heap_refill_trimmed())
+        return true;
+
+    if (grow < MIN_BLOCK_SIZE)
+        grow = MIN_BLOCK_SIZE;
+    if (grow > HEAP_GROW_MAX)
+        grow = HEAP_GROW_MAX;
+    while (grow < bck_size)
+        grow <<= 1;
+
+    while (grow > MIN_BLOCK_SIZE && kmm_heap.heap_size + grow > kmm_heap.max_size)
+        grow >>= 1;
+
+    if (grow < bck_size || kmm_heap.heap_size + grow > kmm_heap.max_size)
+    {
+        WARN_ON("\nHeap esgotada: heap_size=%d - max_size=%d.", kmm_heap.heap_size, kmm_heap.max_size);
+        return false;
+    }
+
+    brk(grow);
+    return true;
+}
+
+/* Verifica se o endereço pertence à área virtual do heap. */
+static inline bool is_heap_block(void *memory)
+{
+    return ((mm_addr_t)memory >= (mm_addr_t)kmm_heap.vm_start &&
+            (mm_addr_t)memory < (mm_addr_t)heap_pend());
+}
+
 static inline freeHead_t *get_free_block(u8_t order)
 {
     free_list_head_t *free_lists = kmm_heap.free_lists;
@@ -194,6 +317,7 @@ static inline void block_add(freeHead_t *bck)
     bck->status = eBUDDY_FREE;
 
     free_list_head_counter_inc(head);
+    heap_order_map |= (1ULL << bck->level);
 }
 /* Deleta um bloco da free list. */
 static inline void block_del(freeHead_t *bck)
@@ -204,6 +328,9 @@ static inline void block_del(freeHead_t *bck)
     bck->status = eBUDDY_TAKE;
 
     free_list_head_counter_dec(head);
+
+    if (list_is_empty(&head->list))
+        heap_order_map &= ~(1ULL << bck->level);
 }
 /**
  * Esta rotina faz a busca nas listas de blocos livre, utilizando o valor index para
@@ -217,29 +344,20 @@ static freeHead_t *find(int order)
 {
     freeHead_t *bck = NULL;
     freeHead_t *sup = NULL;
-    free_list_head_t *free_lists = kmm_heap.free_lists;
 
-    /* Verificamos se existem blocos livre nas filas, sempre buscamos nas fila
-    acima, até encontrar. */
+    /* A primeira fila não vazia, a partir de 'order', vem direto do mapa de bits. */
+    int i = find_first_order(heap_order_map, order);
 
-    for (int i = order; i <= MAX_HEAP_ORDER; i++)
-    {
-        if (!is_list_empty(free_lists, i))
-        {
-            bck = get_free_block(i);
-            goto block_found;
-        }
-    }
     /* Se nenhum bloco for encontrado, devolvemos um NULL. Usuário precisa testar o
     retorno. */
-    return NULL;
+    if (i < 0)
+        return NULL;
 
     /* Se foi encontrado um bloco nas filas superiores, ele é de tamanho superior ao buscado.
     Fazemos um loop quebrando esse bloco em blocos menores, até chegar ao tamanho(order) de-
     sejado. */
 
-block_found:
-
+    bck = get_free_block(i);
     block_del(bck);
 
     while (bck->level > order)
@@ -351,6 +469,195 @@ static void insert(freeHead_t *bck)
     return;
 }
 
+/*-----------------------------------------------------------------------------
+Devolução de memória do heap(trim). Blocos livres de ordem MAX_HEAP_ORDER são
+retirados das free lists, desmapeados e os seus frames voltam ao buddy das
+zonas. O heap passa a ter um mapeamento esparso: 'heap_trimmed_map' registra
+os blocos desmapeados, que são remapeados por heap_grow() antes que o heap
+avance além de heap_pend().
+
+O trim desmapeia todos os blocos escolhidos, faz um único TLB shootdown e só
+então devolve os frames ao buddy: antes disso, outro core pode guardar a
+tradução antiga e escrever num frame já reutilizado. Os blocos nesse intervalo
+ficam em 'heap_pending_map', fora das free lists e fora de 'heap_trimmed_map'.
+-----------------------------------------------------------------------------*/
+#define HEAP_TRIM_NR_BLOCKS (MAX_HEAP_SIZE / MAX_BLOCK_SIZE)
+#define HEAP_TRIM_MAP_WORDS ((HEAP_TRIM_NR_BLOCKS + 63) / 64)
+
+/* Blocos livres mantidos no heap, para evitar desmapear e remapear a cada
+oscilação. O trim ocioso roda no máximo uma vez a cada HEAP_TRIM_INTERVAL ms. */
+#define HEAP_TRIM_KEEP 2
+#define HEAP_TRIM_INTERVAL 1000
+
+static u64_t heap_trimmed_map[HEAP_TRIM_MAP_WORDS];
+static size_t heap_nr_trimmed = 0;
+
+/* Blocos desmapeados à espera do shootdown. Um único trim por vez. */
+static u64_t heap_pending_map[HEAP_TRIM_MAP_WORDS];
+CREATE_SPINLOCK(spinlock_heap_trim);
+
+static inline size_t heap_block_index(void *bck)
+{
+    return ((mm_addr_t)bck - (mm_addr_t)kmm_heap.vm_start) / MAX_BLOCK_SIZE;
+}
+
+/* Desmapeia o bloco e insere os seus frames em 'frames'. Eles serão devolvidos,
+um a um, ao page allocator após o shootdown. O bloco físico obtido por
+maping_heap() é devolvido em pages independentes, pois só uma parte dele pode
+estar sendo liberada. */
+static void heap_unmap_block(freeHead_t *bck, list_head_t *frames)
+{
+    mm_addr_t addr = (mm_addr_t)bck;
+    phys_addr_t frame = 0;
+    page_t *page = NULL;
+
+    for (size_t off = 0; off < MAX_BLOCK_SIZE; off += PAGE_SIZE)
+    {
+        frame = MASK_PAGE_ENTRY(kunmap_frame((virt_addr_t)(addr + off)));
+        if (!frame)
+            continue;
+
+        page = pfn_to_page(phys_to_pfn(frame));
+        set_block_level(page, 0);
+        list_add(&page->node, frames);
+    }
+}
+
+/* Remapeia um bloco desmapeado pelo trim e o devolve às free lists. Deve ser
+chamada com o lock do heap. */
+static bool heap_refill_trimmed(void)
+{
+    size_t nr_pages = MAX_BLOCK_SIZE / PAGE_SIZE;
+    page_t *pages[MAX_BLOCK_SIZE / PAGE_SIZE];
+    freeHead_t *bck = NULL;
+
+    if (heap_nr_trimmed == 0)
+        return false;
+
+    for (size_t w = 0; w < HEAP_TRIM_MAP_WORDS; w++)
+    {
+        if (heap_trimmed_map[w] == 0)
+            continue;
+
+        size_t idx = w * 64 + __builtin_ctzll(heap_trimmed_map[w]);
+
+        if (alloc_pages_bulk(GFP_ZONE_NORMAL, nr_pages, pages) < nr_pages)
+        {
+            WARN_ON("\nHeap: memoria insuficiente para remapear o bloco %d.", idx);
+            return false;
+        }
+
+        bck = (freeHead_t *)((mm_addr_t)kmm_heap.vm_start + idx * MAX_BLOCK_SIZE);
+        for (size_t i = 0; i < nr_pages; i++)
+            kmap_frame((virt_addr_t)((mm_addr_t)bck + i * PAGE_SIZE), page_to_phys(pages[i]), pgprot_PW);
+
+        heap_trimmed_map[w] &= ~(1ULL << (idx % 64));
+        heap_nr_trimmed--;
+
+        bck->level = MAX_HEAP_ORDER;
+        insert(bck);
+        update_heap_free_inc(MAX_BLOCK_SIZE);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Devolve ao page allocator até 'nr_blocks' blocos livres de ordem
+ * MAX_HEAP_ORDER, preservando HEAP_TRIM_KEEP blocos livres no heap. Se o heap
+ * ou o trim estiverem em uso por outro core, a rotina não espera e devolve 0.
+ * @note Faz um TLB shootdown e, portanto, precisa das interrupções habilitadas.
+ * Por isso só é chamada pelo idle task(heap_trim_idle), nunca pelo page
+ * allocator.
+ *
+ * @param nr_blocks
+ * @return size_t número de pages devolvidos.
+ */
+static size_t heap_trim(size_t nr_blocks)
+{
+    free_list_head_t *head = &kmm_heap.free_lists[MAX_HEAP_ORDER];
+    CREATE_LIST_HEAD(frames);
+    freeHead_t *bck = NULL;
+    page_t *page = NULL;
+    size_t nr_blocks_trimmed = 0;
+    size_t nr_pages = 0;
+    size_t idx;
+
+    if (MAX_BLOCK_SIZE < PAGE_SIZE)
+        return 0;
+
+    if (!__spin_trylock(&spinlock_heap_trim.key))
+        return 0;
+
+    if (!__spin_trylock(&spinlock_heap.key))
+    {
+        spinlock_unlock(&spinlock_heap_trim);
+        return 0;
+    }
+
+    while (nr_blocks-- > 0 && head->counter.value > HEAP_TRIM_KEEP)
+    {
+        bck = get_free_block(MAX_HEAP_ORDER);
+        block_del(bck);
+        update_heap_free_dec(MAX_BLOCK_SIZE);
+
+        idx = heap_block_index(bck);
+        heap_unmap_block(bck, &frames);
+
+        heap_pending_map[idx / 64] |= (1ULL << (idx % 64));
+        nr_blocks_trimmed++;
+    }
+
+    spinlock_unlock(&spinlock_heap);
+
+    if (nr_blocks_trimmed == 0)
+    {
+        spinlock_unlock(&spinlock_heap_trim);
+        return 0;
+    }
+
+    /* Após o shootdown, nenhum core guarda traduções para os blocos. Só então
+    heap_refill_trimmed() pode remapear a faixa e os frames voltam ao buddy. */
+    flush_tlb_all_cpus();
+
+    spinlock_lock(&spinlock_heap);
+    for (size_t w = 0; w < HEAP_TRIM_MAP_WORDS; w++)
+    {
+        heap_trimmed_map[w] |= heap_pending_map[w];
+        heap_pending_map[w] = 0;
+    }
+    heap_nr_trimmed += nr_blocks_trimmed;
+    spinlock_unlock(&spinlock_heap);
+
+    while (!list_is_empty(&frames))
+    {
+        page = list_entry(frames.next, page_t, node);
+        list_del(&page->node);
+        free_pages(page);
+        nr_pages++;
+    }
+
+    spinlock_unlock(&spinlock_heap_trim);
+
+    return nr_pages;
+}
+
+/* Chamada pela task idle. Só faz o trim se houver blocos excedentes e se já
+passou HEAP_TRIM_INTERVAL desde a última vez. */
+void heap_trim_idle(void)
+{
+    static u64_t next_trim = 0;
+
+    if (kmm_heap.free_lists[MAX_HEAP_ORDER].counter.value <= HEAP_TRIM_KEEP)
+        return;
+
+    if (get_jiffies() < next_trim)
+        return;
+
+    next_trim = get_jiffies() + HEAP_TRIM_INTERVAL;
+    heap_trim(HEAP_TRIM_NR_BLOCKS);
+}
+
 /**
  * Rotina para o usuário final requisitar memória
  */
@@ -363,32 +670,39 @@ virt_addr_t kmalloc(size_t mm_size)
         return NULL;
     }
 
+    /* Objetos pequenos são atendidos pelas classes de tamanho do slab. */
+    if (is_slab_ready() && mm_size <= KMALLOC_MAX_CACHE_SIZE)
+    {
+        return kmalloc_slab(mm_size);
+    }
+
     /* Calculo o leve e o tamanho do bloco a ser utilizado.
     O level é calculado adicionando o sizeof(usedHead_t)*/
 
     int index = level(mm_size);
     u64_t bck_size = (1 << index);
 
-    if (bck_size > (MAX_BLOCK_SIZE - sizeof(usedHead_t)))
-    {
-        WARN_ON("Memory requisitada %d maior que %d.\n", mm_size, MAX_BLOCK_SIZE - sizeof(usedHead_t));
-        return NULL;
-    }
-    /* Se a memória livre na heap não for suficiente para atender à demanda, */
-    if (heap_free_mm() < bck_size)
+    /* Blocos maiores que um page vão direto para o page allocator. */
+    if (bck_size > KMALLOC_LARGE_SIZE || bck_size > MAX_BLOCK_SIZE)
     {
-        WARN_ON("\nAllocando Memory to Heap = %d.", heap_free_mm());
-
-        /* Alloca mais memória para a heap. */
-        brk(MIN_BLOCK_SIZE);
+        return kmalloc_large(mm_size);
     }
+    spinlock_lock(&spinlock_heap);
 
     /* modifico o header do bloco de memória devolvido da freelist.
      Isso economiza memória. */
 
     usedHead_t *taken = (usedHead_t *)find(index);
+
+    /* Se não há bloco livre do tamanho pedido, o heap cresce e tentamos de novo. */
+    if (taken == NULL && heap_grow(bck_size))
+    {
+        taken = (usedHead_t *)find(index);
+    }
+
     if (taken == NULL)
     {
+        spinlock_unlock(&spinlock_heap);
         WARN_ON("\nkfree: taken=%p : mm_size=%d - bck_size=%d - index=%d", taken, mm_size, bck_size, index);
         return taken;
     }
@@ -397,6 +711,7 @@ virt_addr_t kmalloc(size_t mm_size)
     taken->status = eBUDDY_TAKE;
 
     update_heap_free_dec(bck_size);
+    spinlock_unlock(&spinlock_heap);
 
     /* Exclui o header do bloco e devolve o endereço de inicio do espaço útil.*/
     return hide(taken);
@@ -408,6 +723,14 @@ void kfree(void *memory)
 {
     if (memory != NULL)
     {
+        /* Endereços fora do heap pertencem a um slab ou a um objeto grande. */
+        if (!is_heap_block(memory))
+        {
+            if (!kfree_large(memory))
+                kfree_slab(memory);
+            return;
+        }
+
         /* Aplico o cabeçalho de blocos livres, sem preocupação com a eventual
         sobreposição dos dados, já que não tem mais utilidade.*/
 
@@ -415,15 +738,21 @@ void kfree(void *memory)
         int index = block->level;
         u64_t bck_size = (1 << index);
 
+        spinlock_lock(&spinlock_heap);
+
         /*Insiro o bloco de memória nas listas livres. */
         insert(block);
 
         /*Incremento a memória livre o heap. */
         update_heap_free_inc(bck_size);
+
+        spinlock_unlock(&spinlock_heap);
     }
     return;
 }
 
+/* Insere no heap um bloco novo criado por brk(). Quando chamada a partir de
+kmalloc(), o lock do heap já está em poder do chamador. */
 void __brk(freeHead_t *bck)
 {
     insert(bck);
@@ -0,0 +1,18 @@
+/*--------------------------------------------------------------------------
+*  File name:  meminit.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas da inicialização adiada do vetor de pages, feita
+em paralelo pelos cores após o smp_init().
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+
+void deferred_init_start(void);
+void deferred_init_ap(void);
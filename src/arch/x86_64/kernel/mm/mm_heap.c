@@ -18,6 +18,8 @@ Este header reune as rotinas para a inicialização da memória heap.
 #include "debug.h"
 #include "mm/vmm.h"
 #include "mm/vm_area.h"
+#include "mm/slab.h"
+#include "mm/vmap.h"
 
 mm_heap_t kmm_heap;
 vm_area_t vmm_area_heap;
@@ -93,6 +95,12 @@ void setup_heap(void)
     /* Atribuo o primeiro bloco à heap. */
 
     brk(MIN_BLOCK_SIZE);
+
+    /* As classes de tamanho pequenas do kmalloc passam a usar o slab. */
+    kmem_cache_init();
+
+    /* Descritores das áreas do vmalloc. */
+    vmalloc_cache_init();
 }
 
 void sbrk(size_t heap_lim)
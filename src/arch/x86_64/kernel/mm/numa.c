@@ -0,0 +1,346 @@
+/*--------------------------------------------------------------------------
+*  File name:  numa.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Nodes NUMA. O SRAT associa cada faixa de memória e cada local APIC a um pro-
+ximity domain, e o SLIT informa a distância relativa entre os domains. Cada
+domain recebe um nid compacto(0, 1, ...). Sem o SRAT, toda a memória e todos
+os cores ficam no node 0.
+
+O buddy allocator mantém as free lists de cada zona por node e atende cada
+core primeiro com o seu node, seguindo para os demais em ordem crescente de
+distância(fallback).
+
+Para achar o node de um frame sem percorrer as faixas do SRAT, cada bloco de
+ordem máxima do buddy recebe um nid em block_nid. Somente os blocos que cru-
+zam a fronteira entre dois nodes(NUMA_NO_NODE) fazem a busca nas faixas.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "stdio.h"
+#include "string.h"
+#include "percpu.h"
+#include "smp.h"
+#include "mm/mm_types.h"
+#include "mm/page.h"
+#include "mm/page_alloc.h"
+#include "mm/vmalloc.h"
+#include "mm/numa.h"
+
+extern node_t pgdat;
+
+struct numa_memblk
+{
+    u64_t start_pfn;
+    u64_t end_pfn;
+    u8_t nid;
+};
+
+static struct numa_memblk memblks[NUMA_MAX_MEMBLKS];
+static size_t nr_memblks = 0;
+
+/* Até o setup_numa(), o buddy só conhece o node 0. */
+static numa_node_t node_data[MAX_NUMNODES] = {[0] = {.online = true, .nr_fallback = 1}};
+u8_t nr_online_nodes = 1;
+
+/* Proximity domains encontrados no SRAT. O pxm de cada nid fica no node_data. */
+static u8_t nr_pxm = 0;
+
+/* Node de cada core, indexado pelo local APIC id(cpu_id()). */
+static u8_t apic_nid[MAX_CORES];
+
+/* Distâncias do SLIT, indexadas pelo nid. Zero indica ausência do SLIT. */
+static u8_t numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+
+/* Matriz do SLIT, indexada pelo proximity domain(locality). Os domains têm 32
+bits e podem ser esparsos, por isso a matriz não é copiada para uma tabela de
+MAX_NUMNODES entradas: o SLIT pode vir antes do SRAT no RSDT, e a conversão
+para o nid é feita em setup_numa(), quando os domains em uso são conhecidos. */
+static const u8_t *slit_entry = NULL;
+static u64_t slit_nr_localities = 0;
+
+static u8_t *block_nid = NULL;
+static size_t nr_block_nid = 0;
+
+/* Devolve o nid do proximity domain, criando o node na primeira ocorrência. */
+static u8_t pxm_to_nid(u32_t pxm)
+{
+    for (u8_t nid = 0; nid < nr_pxm; nid++)
+    {
+        if (node_data[nid].pxm == pxm)
+            return nid;
+    }
+
+    if (nr_pxm >= MAX_NUMNODES)
+    {
+        WARN_ON("numa: proximity domain %d ignorado, limite de %d nodes.", pxm, MAX_NUMNODES);
+        return NUMA_NO_NODE;
+    }
+
+    node_data[nr_pxm].pxm = pxm;
+    return nr_pxm++;
+}
+
+void numa_add_memblk(u32_t pxm, phys_addr_t base, u64_t length)
+{
+    u8_t nid = pxm_to_nid(pxm);
+
+    if (nid == NUMA_NO_NODE || length == 0)
+        return;
+
+    if (nr_memblks >= NUMA_MAX_MEMBLKS)
+    {
+        WARN_ON("numa: faixa %p-%p ignorada.", base, base + length);
+        return;
+    }
+
+    memblks[nr_memblks].start_pfn = base >> PAGE_SHIFT;
+    memblks[nr_memblks].end_pfn = (base + length) >> PAGE_SHIFT;
+    memblks[nr_memblks].nid = nid;
+    nr_memblks++;
+
+    kprintf("\nSRAT: node %d(pxm %d) - %p-%p", nid, pxm, base, base + length);
+}
+
+void numa_add_cpu(u32_t pxm, u32_t apic_id)
+{
+    u8_t nid = pxm_to_nid(pxm);
+
+    if (nid == NUMA_NO_NODE || apic_id >= MAX_CORES)
+        return;
+
+    apic_nid[apic_id] = nid;
+    node_data[nid].nr_cpus++;
+}
+
+void numa_set_slit(const u8_t *entry, u64_t nr_localities)
+{
+    slit_entry = entry;
+    slit_nr_localities = nr_localities;
+}
+
+numa_node_t *node_obj(u8_t nid)
+{
+    return &node_data[nid];
+}
+
+u8_t node_distance(u8_t from, u8_t to)
+{
+    if (numa_distance[from][to])
+        return numa_distance[from][to];
+
+    return (from == to) ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+}
+
+u8_t cpu_to_node(u8_t cpu)
+{
+    return apic_nid[cpu];
+}
+
+/* Node do core que está executando. */
+u8_t numa_node_id(void)
+{
+    return apic_nid[cpu_id()];
+}
+
+/* Busca nas faixas do SRAT. Um frame fora das faixas(buraco) fica no node da
+faixa anterior. */
+static u8_t memblk_nid(u64_t pfn)
+{
+    u8_t nid = 0;
+
+    for (size_t i = 0; i < nr_memblks; i++)
+    {
+        if (pfn >= memblks[i].start_pfn && pfn < memblks[i].end_pfn)
+            return memblks[i].nid;
+
+        if (pfn >= memblks[i].end_pfn)
+            nid = memblks[i].nid;
+    }
+    return nid;
+}
+
+u8_t pfn_to_nid(u64_t pfn)
+{
+    size_t idx = pfn >> MAX_PAGE_ORDER;
+
+    if (nr_online_nodes == 1 || idx >= nr_block_nid)
+        return 0;
+
+    if (block_nid[idx] != NUMA_NO_NODE)
+        return block_nid[idx];
+
+    return memblk_nid(pfn);
+}
+
+/**
+ * @brief Devolve o node dos frames [pfn, pfn + nr_pages), ou NUMA_NO_NODE se a
+ * faixa pertencer a mais de um node. A faixa é um bloco do buddy: alinhada e
+ * contida num bloco de ordem máxima.
+ */
+u8_t numa_range_nid(u64_t pfn, size_t nr_pages)
+{
+    u8_t nid = pfn_to_nid(pfn);
+
+    if (nr_online_nodes == 1 || nr_pages == 1)
+        return nid;
+
+    if ((pfn >> MAX_PAGE_ORDER) < nr_block_nid && block_nid[pfn >> MAX_PAGE_ORDER] != NUMA_NO_NODE)
+        return nid;
+
+    for (size_t i = 0; i < nr_memblks; i++)
+    {
+        if (memblks[i].nid != nid && memblks[i].start_pfn < pfn + nr_pages &&
+            memblks[i].end_pfn > pfn)
+            return NUMA_NO_NODE;
+    }
+    return nid;
+}
+
+/* Calcula o nid de cada bloco de ordem máxima. */
+static bool setup_block_nid(void)
+{
+    u64_t start, end;
+    u8_t nid;
+
+    nr_block_nid = (pgdat.node_last_pfn >> MAX_PAGE_ORDER) + 1;
+    block_nid = vmalloc(nr_block_nid);
+    if (!block_nid)
+    {
+        nr_block_nid = 0;
+        return false;
+    }
+
+    for (size_t i = 0; i < nr_block_nid; i++)
+    {
+        start = (u64_t)i << MAX_PAGE_ORDER;
+        end = start + ((u64_t)1 << MAX_PAGE_ORDER);
+        nid = memblk_nid(start);
+
+        for (size_t j = 0; j < nr_memblks; j++)
+        {
+            if (memblks[j].nid != nid && memblks[j].start_pfn < end && memblks[j].end_pfn > start)
+            {
+                nid = NUMA_NO_NODE;
+                break;
+            }
+        }
+        block_nid[i] = nid;
+    }
+    return true;
+}
+
+/* Ordena os nodes online pela distância a partir de 'nid'. O próprio node vem
+sempre primeiro, mesmo com um SLIT inconsistente. */
+static void build_fallback(u8_t nid)
+{
+    numa_node_t *node = &node_data[nid];
+    u8_t n = 1;
+
+    node->fallback[0] = nid;
+    for (u8_t i = 0; i < nr_online_nodes; i++)
+    {
+        if (i == nid)
+            continue;
+
+        /* Inserção ordenada: poucos nodes. */
+        u8_t j = n++;
+        while (j > 1 && node_distance(nid, node->fallback[j - 1]) > node_distance(nid, i))
+        {
+            node->fallback[j] = node->fallback[j - 1];
+            j--;
+        }
+        node->fallback[j] = i;
+    }
+    node->nr_fallback = n;
+}
+
+/* Toda a memória e todos os cores no node 0. */
+static void numa_single_node(void)
+{
+    memset(node_data, 0, sizeof(node_data));
+    node_data[0].online = true;
+    node_data[0].start_pfn = 0;
+    node_data[0].end_pfn = pgdat.node_last_pfn;
+    node_data[0].present_pages = pgdat.node_last_pfn;
+    node_data[0].nr_fallback = 1;
+    node_data[0].fallback[0] = 0;
+    memset(apic_nid, 0, sizeof(apic_nid));
+    nr_online_nodes = 1;
+}
+
+/**
+ * @brief Monta os nodes a partir das informações do SRAT/SLIT e redistribui
+ * os blocos livres do buddy entre eles. Executada pelo BSP após setup_acpi() e
+ * antes do smp_init(). Sem o SRAT, mantém o node 0 com toda a memória.
+ */
+void setup_numa(void)
+{
+    kprintf("\n(*):%s(%d) - Configurando os nodes NUMA.", __FUNCTION__, __LINE__);
+
+    if (nr_memblks == 0 || nr_pxm <= 1)
+    {
+        numa_single_node();
+        kprintf("\nNUMA: node único.");
+        return;
+    }
+
+    for (u8_t nid = 0; nid < nr_pxm; nid++)
+    {
+        node_data[nid].online = true;
+        node_data[nid].start_pfn = (u64_t)-1;
+    }
+
+    for (size_t i = 0; i < nr_memblks; i++)
+    {
+        numa_node_t *node = &node_data[memblks[i].nid];
+
+        if (memblks[i].start_pfn < node->start_pfn)
+            node->start_pfn = memblks[i].start_pfn;
+        if (memblks[i].end_pfn > node->end_pfn)
+            node->end_pfn = memblks[i].end_pfn;
+        node->present_pages += memblks[i].end_pfn - memblks[i].start_pfn;
+    }
+
+    /* As distâncias do SLIT passam do proximity domain para o nid. */
+    for (u8_t from = 0; slit_entry && from < nr_pxm; from++)
+    {
+        for (u8_t to = 0; to < nr_pxm; to++)
+        {
+            u64_t pfrom = node_data[from].pxm;
+            u64_t pto = node_data[to].pxm;
+
+            if (pfrom < slit_nr_localities && pto < slit_nr_localities)
+                numa_distance[from][to] = slit_entry[pfrom * slit_nr_localities + pto];
+            else
+                WARN_ON("numa: pxm %d ou %d fora do SLIT.", pfrom, pto);
+        }
+    }
+
+    nr_online_nodes = nr_pxm;
+    if (!setup_block_nid())
+    {
+        numa_single_node();
+        WARN_ERROR("numa: sem memória para o mapa de nodes. Usando um único node.");
+        return;
+    }
+
+    for (u8_t nid = 0; nid < nr_online_nodes; nid++)
+        build_fallback(nid);
+
+    /* Até aqui, todos os frames livres estavam no node 0. */
+    if (nr_online_nodes > 1)
+        free_area_numa_rebuild();
+
+    for (u8_t nid = 0; nid < nr_online_nodes; nid++)
+    {
+        numa_node_t *node = &node_data[nid];
+        kprintf("\nNUMA: node %d - pfn %x-%x, %d cpus, %d pages livres.", nid, node->start_pfn,
+                node->end_pfn, node->nr_cpus, node_free_pages_nr(nid));
+    }
+}
@@ -0,0 +1,137 @@
+/*--------------------------------------------------------------------------
+*  File name:  numa.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as estruturas dos nodes NUMA, obtidos das tabelas SRAT e
+SLIT do ACPI, e a interface dos nodes com o buddy allocator.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "acpi.h"
+#include "mm/mm_types.h"
+#include "mm/page.h"
+
+#define MAX_NUMNODES 8
+#define NUMA_NO_NODE 0xFF
+
+/* Quantidade máxima de faixas de memória do SRAT. */
+#define NUMA_MAX_MEMBLKS 32
+
+/* Distâncias do SLIT. Sem o SLIT, todo node remoto fica a REMOTE_DISTANCE. */
+#define LOCAL_DISTANCE 10
+#define REMOTE_DISTANCE 20
+
+#define SRAT_SIGNATURE "SRAT"
+#define SLIT_SIGNATURE "SLIT"
+
+/* System Resource Affinity Table. Os registros iniciam após o header. */
+typedef struct srat
+{
+    acpi_header_t header;
+    u32_t table_rev;
+    u64_t reserved;
+    u8_t entry[];
+} __attribute__((packed)) srat_t;
+
+#define SRAT_TYPE_LAPIC 0
+#define SRAT_TYPE_MEMORY 1
+#define SRAT_TYPE_X2APIC 2
+
+#define SRAT_ENABLED (1U << 0)
+
+typedef struct srat_entry_head
+{
+    u8_t type;
+    u8_t len;
+} __attribute__((packed)) srat_entry_head_t;
+
+typedef struct srat_lapic
+{
+    u8_t type;
+    u8_t len;
+    u8_t pxm_lo; /* Bits 0-7 do proximity domain. */
+    u8_t apic_id;
+    u32_t flags;
+    u8_t sapic_eid;
+    u8_t pxm_hi[3]; /* Bits 8-31 do proximity domain. */
+    u32_t clock_domain;
+} __attribute__((packed)) srat_lapic_t;
+
+typedef struct srat_memory
+{
+    u8_t type;
+    u8_t len;
+    u32_t pxm;
+    u16_t reserved0;
+    u64_t base;
+    u64_t length;
+    u32_t reserved1;
+    u32_t flags;
+    u64_t reserved2;
+} __attribute__((packed)) srat_memory_t;
+
+typedef struct srat_x2apic
+{
+    u8_t type;
+    u8_t len;
+    u16_t reserved0;
+    u32_t pxm;
+    u32_t x2apic_id;
+    u32_t flags;
+    u32_t clock_domain;
+    u32_t reserved1;
+} __attribute__((packed)) srat_x2apic_t;
+
+/* System Locality Information Table: matriz nr_localities x nr_localities. */
+typedef struct slit
+{
+    acpi_header_t header;
+    u64_t nr_localities;
+    u8_t entry[];
+} __attribute__((packed)) slit_t;
+
+/* Descritor de cada node. Os frames do node são os das faixas do SRAT com o
+seu nid; as free lists de cada zona do node ficam no buddy(page_alloc.c). */
+typedef struct numa_node
+{
+    bool online;
+    u32_t pxm;            /* Proximity domain do ACPI. */
+    u64_t start_pfn;      /* Primeiro frame do node. */
+    u64_t end_pfn;        /* Frame seguinte ao último do node. */
+    u64_t present_pages;  /* Frames das faixas do node. */
+    u32_t nr_cpus;
+    u8_t nr_fallback;
+    u8_t fallback[MAX_NUMNODES]; /* Nodes em ordem crescente de distância. */
+} numa_node_t;
+
+extern u8_t nr_online_nodes;
+
+/* Registro das informações do SRAT/SLIT(acpi.c). */
+void numa_add_memblk(u32_t pxm, phys_addr_t base, u64_t length);
+void numa_add_cpu(u32_t pxm, u32_t apic_id);
+void numa_set_slit(const u8_t *entry, u64_t nr_localities);
+
+void setup_numa(void);
+
+numa_node_t *node_obj(u8_t nid);
+u8_t node_distance(u8_t from, u8_t to);
+u8_t cpu_to_node(u8_t cpu);
+u8_t numa_node_id(void);
+u8_t pfn_to_nid(u64_t pfn);
+u8_t numa_range_nid(u64_t pfn, size_t nr_pages);
+
+static inline u8_t page_to_nid(page_t *page)
+{
+    return pfn_to_nid(page_to_pfn(page));
+}
+
+/* Interface com o buddy allocator(page_alloc.c). */
+void free_area_numa_rebuild(void);
+size_t node_free_pages_nr(u8_t nid);
+page_t *alloc_pages_node(u8_t nid, gfp_t gfp_mask, size_t order);
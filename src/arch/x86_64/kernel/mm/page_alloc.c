@@ -16,25 +16,122 @@ Este heap reune estruturas para o Page Memory Allocator
 #include "mm/page_alloc.h"
 #include "mm/page.h"
 #include "mm/mm_types.h"
+#include "mm/pcp.h"
+#include "mm/gfp.h"
+#include "mm/numa.h"
+#include "mm/color.h"
+#include "mm/slab.h"
+#include "sync/spin.h"
+
+/* Free lists do buddy de cada zona em cada node NUMA. Todos os pages de um
+bloco livre pertencem ao mesmo node: dois buddies de nodes diferentes não são
+mesclados.
+
+O lock protege as free lists. As alocações de ordem 0 passam pelo cache per-cpu
+(pcp.c), que só faz o lock a cada lote.
+
+No mapa de bits das ordens, o bit 'n' está ligado se, e somente se, free_lists[n]
+não estiver vazia. A primeira ordem utilizável é obtida com uma única instrução
+BSF. */
+struct free_area
+{
+    spinlock_t lock;
+    free_list_head_t free_lists[MAX_PAGE_ORDER + 1];
+    u32_t order_map;
+    size_t nr_free; /* Pages livres nas free lists. */
+};
+
+static struct free_area free_areas[MAX_NUMNODES][MAX_ZONE_MEMORY];
+
+static inline struct free_area *free_area_obj(u8_t nid, gfp_t gfp_zone)
+{
+    return &free_areas[nid][gfp_zone];
+}
+
+static inline struct free_area *page_free_area(page_t *page)
+{
+    return free_area_obj(page_to_nid(page), page_zone_id(page));
+}
+
+/* Pool de pages de ordem 0 já zerados de cada zona e node. O idle task o preenche com
+stores non-temporal(zero_pool_refill_idle) e as alocações com __GFP_ZERO o
+consomem, tirando o memset do caminho do fork e do page fault. Os pages do pool
+estão alocados(used) e encadeados pelo 'node'. */
+#define ZERO_POOL_HIGH 256
+#define ZERO_POOL_BATCH 16
+
+/* O idle task só retira pages de uma zona com folga acima desta reserva. */
+#define ZERO_POOL_RESERVE 4096
+
+struct zero_pool
+{
+    spinlock_t lock;
+    list_head_t list;
+    size_t count;
+};
+
+static struct zero_pool zero_pools[MAX_NUMNODES][MAX_ZONE_MEMORY];
+
+/* Blocos retirados do buddy com o estado inconsistente. Eles não voltam às free
+lists, que provavelmente também estão corrompidas, e ficam aqui para inspeção
+(comando mm-size do shell). */
+struct page_quarantine
+{
+    spinlock_t lock;
+    list_head_t list;
+    size_t nr_blocks;
+    size_t nr_pages;
+};
 
-/* Faz a inicialização das free_lists de cada uma das zonas.*/
+static struct page_quarantine quarantine;
+
+/* Devolve a menor ordem >= 'order' presente no mapa, ou -1. */
+static inline int find_first_order(u32_t map, u8_t order)
+{
+    map &= ~((1U << order) - 1);
+    if (map == 0)
+        return -1;
+    return __builtin_ctz(map);
+}
+
+/* Devolve a maior ordem presente no mapa, ou -1. */
+static inline int find_last_order(u32_t map)
+{
+    if (map == 0)
+        return -1;
+    return 31 - __builtin_clz(map);
+}
+
+/* Faz a inicialização das free_lists de cada uma das zonas, em todos os nodes.*/
 void setup_zone_free_list(void)
 {
     zone_t *zone;
-    free_list_head_t *free_lists = NULL;
+    struct free_area *area = NULL;
 
     kprintf("\n(*)%s(%d) - INIT FREE LISTS BY ZONE: Inicializando as free lists por zona.", __FUNCTION__, __LINE__);
 
+    spinlock_init(&quarantine.lock);
+    init_list_head(&quarantine.list);
+    quarantine.nr_blocks = 0;
+    quarantine.nr_pages = 0;
+
     for (u8_t i = 0; i < MAX_ZONE_MEMORY; i++)
     {
         zone = zone_obj(i);
         zone->zone_free_pages.value = 0;
-        free_lists = (free_list_head_t *)&zone->free_lists;
-
-        for (u8_t x = 0; x <= MAX_PAGE_ORDER; x++)
+        for (u8_t nid = 0; nid < MAX_NUMNODES; nid++)
         {
-            // INIT_LIST_HEAD(&free_lists[x].list);
-            init_list_head(&free_lists[x].list);
+            spinlock_init(&zero_pools[nid][i].lock);
+            init_list_head(&zero_pools[nid][i].list);
+            zero_pools[nid][i].count = 0;
+
+            area = free_area_obj(nid, i);
+            spinlock_init(&area->lock);
+            area->order_map = 0;
+            area->nr_free = 0;
+
+            for (u8_t x = 0; x <= MAX_PAGE_ORDER; x++)
+                init_list_head(&area->free_lists[x].list);
         }
 
         if (i == ZONE_DMA)
@@ -51,6 +148,9 @@ void setup_zone_free_list(void)
         }
     }
 
+    /* Os caches per-cpu precisam existir antes da primeira liberação de pages.*/
+    setup_pcp_pages();
+
     kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
 }
 
@@ -65,7 +165,8 @@ static inline unsigned int buddy_order(struct page *page)
  * coalescência.
  * a) verifica se o bloco está na free list(is buddy);
  * b) verifica se o bloco está na mesma ordem;
- * c) verifica se o bloco está na mesma zona.
+ * c) verifica se o bloco está na mesma zona;
+ * d) verifica se o bloco está no mesmo node.
  *
  * For recording whether a page is in the buddy system, we set PageBuddy.
  * Setting, clearing, and testing PageBuddy is serialized by zone->lock.
@@ -89,6 +190,9 @@ static inline bool is_page_buddy_ok(struct page *bck, struct page *bud,
     if (page_zone_id(bck) != page_zone_id(bud))
         return false;
 
+    if (page_to_nid(bck) != page_to_nid(bud))
+        return false;
+
     return true;
 }
 
@@ -163,23 +267,29 @@ static inline page_t *get_free_block(free_list_head_t *free_lists, u8_t order)
 }
 
 /* Adiciona um novo bloco à free list. */
-static inline void block_add(free_list_head_t *free_lists, page_t *bck)
+static inline void block_add(struct free_area *area, page_t *bck)
 {
-    free_list_head_t *head = &free_lists[bck->level];
+    free_list_head_t *head = &area->free_lists[bck->level];
 
     list_add(&bck->node, &head->list);
     set_page_buddy(bck);
 
     free_list_head_counter_inc(head);
+    area->order_map |= (1U << bck->level);
+    area->nr_free += (1UL << bck->level);
 }
 /* Deleta um bloco da free list. */
-static inline void block_del(free_list_head_t *free_lists, page_t *bck)
+static inline void block_del(struct free_area *area, page_t *bck)
 {
-    free_list_head_t *head = &free_lists[bck->level];
+    free_list_head_t *head = &area->free_lists[bck->level];
 
     list_del(&bck->node);
     clear_page_buddy(bck);
     free_list_head_counter_dec(head);
+
+    if (list_is_empty(&head->list))
+        area->order_map &= ~(1U << bck->level);
+    area->nr_free -= (1UL << bck->level);
 }
 
 /**
@@ -191,33 +301,27 @@ static inline void block_del(free_list_head_t *free_lists, page_t *bck)
  * mente, até chegarmos a um bloco do tamanho desejado. A regra é sempre utilizar a metade
  * inferior de cada bloco quebrado.
  */
-static page_t *__buddy_find_block(zone_t *zone, u8_t order)
+static page_t *__buddy_find_block(struct free_area *area, u8_t order)
 {
     page_t *bck = NULL;
     page_t *sup = NULL;
 
-    free_list_head_t *free_lists = zone_freelist(zone);
+    free_list_head_t *free_lists = area->free_lists;
 
-    /* Buscamos nas filas acima, até encontrar um bloco livre. */
-    for (u8_t i = order; i <= MAX_PAGE_ORDER; i++)
-    {
-        if (!is_list_empty(free_lists, i))
-        {
-            bck = get_free_block(free_lists, i);
-            goto block_found;
-        }
-    }
+    /* A primeira fila não vazia, a partir de 'order', vem direto do mapa de bits. */
+    int i = find_first_order(area->order_map, order);
 
     /* Se nenhum bloco for encontrado, devolvemos um NULL. Não existem blocos com o tamanho
     desejado ou superior. O usuário precisa testar o retorno. */
-    return NULL;
+    if (i < 0)
+        return NULL;
 
     /* Se foi encontrado um bloco nas filas superiores, ele é de tamanho superior ao buscado.
     Fazemos um loop quebrando esse bloco em blocos menores, até chegar ao tamanho(order) de-
     sejado. */
 
-block_found:
-    block_del(free_lists, bck);
+    bck = get_free_block(free_lists, i);
+    block_del(area, bck);
 
     while (bck->level > order)
     {
@@ -229,7 +333,7 @@ block_found:
         diatamente inferior. */
 
         sup->level = bck->level;
-        block_add(free_lists, sup);
+        block_add(area, sup);
     }
 
     return bck;
@@ -241,15 +345,13 @@ block_found:
  * lista de blocos superior, cujos blocos tem o tamanho dobrado(soma dos buddy's)
  */
 
-static void __buddy_free_block(zone_t *zone, page_t *bck)
+static void __buddy_free_block(struct free_area *area, page_t *bck)
 {
     page_t *bud = NULL;
     page_t *ini = NULL;
 
-    free_list_head_t *free_lists = zone_freelist(zone);
-
     /* Inserimos o bloco imediatamente.*/
-    block_add(free_lists, bck);
+    block_add(area, bck);
 
     /*Verifico se o o bloco  inserido já alcança o limite das filas. Se já está
     no limite, simplesmente retornamos. Caso contrário, continuamos para tentar
@@ -283,8 +385,8 @@ static void __buddy_free_block(zone_t *zone, page_t *bck)
         /* Como os blocos buddy estão livre, haverá a coalescência. Fazemos a
         exclusão de ambos. */
 
-        block_del(free_lists, bud);
-        block_del(free_lists, ini);
+        block_del(area, bud);
+        block_del(area, ini);
 
         /* A coalescência importa na inserção do dois bloco como um único bloco
         na fila de ordem imediatamene superior. Isso é indicado no level     do
@@ -295,7 +397,7 @@ static void __buddy_free_block(zone_t *zone, page_t *bck)
 
         /* Insiro os dois buddys na fila imediatamente acima.*/
 
-        block_add(free_lists, ini);
+        block_add(area, ini);
 
         /* Como o bloco "ini" acabou de ser inserido na fila, descubro o seu
          bloco buddy na nova fila. Se ele não estiver livre, encerro a coalescência e
@@ -316,12 +418,16 @@ static void __buddy_free_block(zone_t *zone, page_t *bck)
 }
 
 /**
- * Rotina para o usuário final requisitar memória
+ * Rotina para o usuário final requisitar memória. O bloco vem do node 'nid' ou,
+ * na falta, dos demais nodes em ordem crescente de distância.
  */
 
-static page_t *buddy_alloc_pages(gfp_t gfp_zone, size_t order)
+static page_t *buddy_alloc_pages(u8_t nid, gfp_t gfp_zone, size_t order)
 {
     zone_t *zone = zone_obj(gfp_zone);
+    numa_node_t *node = node_obj(nid);
+    struct free_area *area = NULL;
+    page_t *taken = NULL;
 
     if (order >= MAX_PAGE_ORDER)
     {
@@ -334,14 +440,21 @@ static page_t *buddy_alloc_pages(gfp_t gfp_zone, size_t order)
         kprintf("kalloc: Inicialize kalloc - [init_kalloc(void)]");
     }
 
-    page_t *taken = __buddy_find_block(zone, order);
+    for (u8_t i = 0; i < node->nr_fallback && taken == NULL; i++)
+    {
+        area = free_area_obj(node->fallback[i], gfp_zone);
 
-    if (taken == NULL)
-        return NULL;
+        spinlock_lock(&area->lock);
+        taken = __buddy_find_block(area, order);
 
-    /* Atualiza o número de free pages no node e zone. */
-    update_free_pages_sub(zone, order);
-    /*---------------------------------------------------*/
+        if (taken != NULL)
+        {
+            /* Atualiza o número de free pages no node e zone. */
+            update_free_pages_sub(zone, order);
+            /*---------------------------------------------------*/
+        }
+        spinlock_unlock(&area->lock);
+    }
 
     return taken;
 }
@@ -354,19 +467,113 @@ static int buddy_free_page(page_t *page)
     {
         return -1;
     }
-    int idx = page_zone_id(page);
+    u8_t order = page->level;
+    u8_t nid = numa_range_nid(page_to_pfn(page), 1UL << order);
     zone_t *zone = page_zone(page);
+    struct free_area *area = NULL;
+
+    /* Um bloco que cruza a fronteira entre dois nodes(só na inicialização da
+    memória) é dividido ao meio, até que cada parte pertença a um único node. */
+    if (nid == NUMA_NO_NODE)
+    {
+        page_t *upper = page + (1UL << (order - 1));
 
+        set_block_level(page, order - 1);
+        set_block_level(upper, order - 1);
+        buddy_free_page(page);
+        return buddy_free_page(upper);
+    }
+
+    area = free_area_obj(nid, page_zone_id(page));
+
+    spinlock_lock(&area->lock);
     /* Atualiza o número de free pages no node e zone. */
     update_free_pages_add(zone, page->level);
     /*-------------------------------------------------*/
 
-    __buddy_free_block(zone, page);
+    __buddy_free_block(area, page);
     set_page_free(page);
+    spinlock_unlock(&area->lock);
 
     return 0;
 }
 
+/**
+ * @brief Retira até 'count' pages de ordem 0 do buddy e os insere em 'list'.
+ * Utilizada pelo cache per-cpu para o refill. Os pages vêm do node do core e,
+ * na falta, dos mais próximos, com um lock por node.
+ *
+ * @param gfp_zone
+ * @param count
+ * @param list
+ * @return u32_t número de pages efetivamente retirados.
+ */
+u32_t buddy_rmqueue_bulk(gfp_t gfp_zone, u32_t count, list_head_t *list)
+{
+    zone_t *zone = zone_obj(gfp_zone);
+    numa_node_t *node = node_obj(numa_node_id());
+    struct free_area *area = NULL;
+    page_t *page = NULL;
+    u32_t nr = 0;
+
+    for (u8_t i = 0; i < node->nr_fallback && nr < count; i++)
+    {
+        area = free_area_obj(node->fallback[i], gfp_zone);
+
+        spinlock_lock(&area->lock);
+        for (; nr < count; nr++)
+        {
+            page = __buddy_find_block(area, 0);
+            if (page == NULL)
+                break;
+
+            update_free_pages_sub(zone, 0);
+            list_add_tail(&page->node, list);
+        }
+        spinlock_unlock(&area->lock);
+    }
+
+    return nr;
+}
+
+/**
+ * @brief Devolve ao buddy os 'count' pages de ordem 0 encadeados em 'list',
+ * fazendo o lock de cada node uma única vez por sequência de pages do mesmo
+ * node. Utilizada pelo drain do cache per-cpu.
+ *
+ * @param gfp_zone
+ * @param count
+ * @param list
+ */
+void buddy_free_list_bulk(gfp_t gfp_zone, u32_t count, list_head_t *list)
+{
+    zone_t *zone = zone_obj(gfp_zone);
+    struct free_area *locked = NULL;
+    struct free_area *area = NULL;
+    page_t *page = NULL;
+
+    while (count-- > 0 && !list_is_empty(list))
+    {
+        page = list_entry(list->next, page_t, node);
+        list_del(&page->node);
+
+        area = free_area_obj(page_to_nid(page), gfp_zone);
+        if (area != locked)
+        {
+            if (locked)
+                spinlock_unlock(&locked->lock);
+            spinlock_lock(&area->lock);
+            locked = area;
+        }
+
+        update_free_pages_add(zone, 0);
+        __buddy_free_block(area, page);
+    }
+
+    if (locked)
+        spinlock_unlock(&locked->lock);
+}
+
 /**
  * @brief Recebe um bloco e verifica se cada uma das pages não
  * está sendo utilizada, fazendo a inserção por pages na lista
@@ -391,79 +598,540 @@ static inline void free_block_uncontinuos(page_t *bck, int order)
         }
     }
 }
+/**
+ * @brief Marca o bloco como alocado. Somente o page head carrega o estado do
+ * bloco(head, used e level): o custo de uma alocação de ordem N não depende
+ * dos 2^N pages do bloco. Os tail pages nunca têm o flag buddy ligado, pois
+ * block_del() o desliga na divisão e na coalescência.
+ *
+ * @param bck
+ * @param order
+ */
 static inline void prepare_pages_block(page_t *bck, int order)
 {
-    size_t nr_pages = (1 << order);
-    page_t *page = NULL;
-
     set_page_head(bck);
+    set_block_level(bck, order);
     set_page_used(bck);
-    /* Configuro a tail pages. */
-    for (size_t i = 1; i < nr_pages; i++)
-    {
-        page = bck + i;
-        clear_page_head(page);
-        set_block_level(page, 0);
-        set_page_used(page);
-    }
 }
 
 /**
- * @brief Verifica se um bloco de pages é composto apenas por pages
- * não utilizados.
+ * @brief Verifica os invariantes do bloco devolvido pelo buddy, só no page
+ * head: fora das free lists, livre, não fixmap e com a ordem pedida.
  *
- * @param page
+ * @param bck
  * @param order
  * @return true
  * @return false
  */
-static bool is_pages_block_ok(page_t *bck, int order)
+static inline bool is_pages_block_ok(page_t *bck, int order)
 {
-    size_t nr_pages = (1 << order);
-    page_t *page;
+    if (page_buddy(bck) || page_is_fixmap(bck) || !page_is_free(bck))
+        return false;
 
-    for (size_t i = 0; i < nr_pages; i++)
+    return (bck->level == order);
+}
+
+/**
+ * @brief Isola um bloco inconsistente retirado do buddy. O bloco não é
+ * devolvido às free lists: se o seu estado está corrompido, elas também
+ * estão, e reinseri-lo só propagaria o erro.
+ *
+ * @param bck
+ * @param order
+ */
+static void quarantine_pages_block(page_t *bck, int order)
+{
+    spinlock_lock(&quarantine.lock);
+    list_add(&bck->node, &quarantine.list);
+    quarantine.nr_blocks++;
+    quarantine.nr_pages += (1UL << order);
+    spinlock_unlock(&quarantine.lock);
+
+    WARN_ERROR("alloc_pages: bloco pfn=%d inconsistente - order=%d. Em quarentena: %d blocos, %d pages.",
+               page_to_pfn(bck), order, quarantine.nr_blocks, quarantine.nr_pages);
+}
+
+/* Pages em quarentena, em todos os nodes e zonas. */
+size_t quarantined_pages_nr(void)
+{
+    return quarantine.nr_pages;
+}
+
+/**
+ * @brief Retira até 'nr_pages' pages zerados do pool da zona no node 'nid' e
+ * os insere em 'array'.
+ *
+ * @param nid
+ * @param gfp_zone
+ * @param nr_pages
+ * @param array
+ * @return size_t número de pages retirados.
+ */
+static size_t zero_pool_take(u8_t nid, gfp_t gfp_zone, size_t nr_pages, page_t **array)
+{
+    struct zero_pool *pool = &zero_pools[nid][gfp_zone];
+    size_t nr = 0;
+
+    /* Leitura sem lock: o pool vazio é o caso comum fora do idle. */
+    if (pool->count == 0)
+        return 0;
+
+    spinlock_lock(&pool->lock);
+    while (nr < nr_pages && !list_is_empty(&pool->list))
     {
-        page = bck + i;
-        if (page_is_fixmap(page) || !page_is_free(page))
-        {
-            return false;
-        }
+        page_t *page = list_entry(pool->list.next, page_t, node);
+        list_del(&page->node);
+        pool->count--;
+        array[nr++] = page;
     }
-    return true;
+    spinlock_unlock(&pool->lock);
+
+    return nr;
 }
 
-static page_t *__alloc_pages(gfp_t gfp_mask, size_t order)
+static page_t *__alloc_pages(u8_t nid, gfp_t gfp_mask, size_t order)
 {
-    page_t *bck = buddy_alloc_pages(gfp_mask, order);
-    if (order == 0)
+    page_t *bck = NULL;
+
+again:
+    /* Pages isolados do node do core são servidos pelo cache do core. */
+    if (order == 0 && nid == numa_node_id())
     {
-        // return bck;
-        // set_page_used(bck);
+        bck = pcp_alloc_page(gfp_mask, false);
+        if (bck != NULL)
+        {
+            prepare_pages_block(bck, order);
+            return bck;
+        }
+    }
+
+    bck = buddy_alloc_pages(nid, gfp_mask, order);
+
+    /* O buddy não tem o bloco, mas pode haver pages retidos nos caches per-cpu
+    que, devolvidos, completam um bloco maior. */
+    if (bck == NULL)
+    {
+        drain_all_pages();
+        bck = buddy_alloc_pages(nid, gfp_mask, order);
+    }
+
+    /* Pressão de memória: o pool de pages zerados, os bins de cores e os slabs
+    vazios dos caches devolvem os pages que retêm. O heap do kmalloc não é
+    encolhido aqui: o seu trim exige um TLB shootdown e é feito pelo idle task
+    (heap_trim_idle). */
+    if (bck == NULL && zero_pool_drain() + cache_color_drain() + kmem_cache_shrink_all() > 0)
+    {
+        bck = buddy_alloc_pages(nid, gfp_mask, order);
     }
-    /* Se o bloco for maior que um PAGE_SIZE, Verifico se o o bloco encontrado é consistente.
-    Caso contrário, faço uma chamada recursiva até encontrar um bloco consistente. Aqui, con-
-    sistente é aquele bloco em que todos os pages são free. Há o risco de estouro da pilha.
-    Ficar atendo.
-    */
 
-    WARN_DEBUGING("Entrando is_pages_block_continuos.");
+    if (bck == NULL)
+        return NULL;
+
+    /* Um bloco inconsistente fica em quarentena e a alocação é refeita. Cada
+    tentativa retira um bloco das free lists, portanto o laço termina. */
     if (!is_pages_block_ok(bck, order))
     {
-        free_pages(bck);
-        bck = alloc_pages(gfp_mask, order);
+        quarantine_pages_block(bck, order);
+        goto again;
     }
-    /* Ajusta os atributos de todos os pages que compõem o bloco.*/
+
+    /* Ajusta os atributos do bloco, mantidos apenas no page head. */
     prepare_pages_block(bck, order);
 
     return bck;
 }
+/**
+ * @brief Aloca 'nr_pages' pages de ordem 0 e os insere em 'array', com um lock
+ * por node. Em vez de um page por vez, retiramos os maiores blocos disponíveis,
+ * limitados ao que ainda falta, e os quebramos em pages independentes, que
+ * podem ser liberados individualmente. O node do core é esgotado antes dos
+ * demais, em ordem de distância.
+ *
+ * @param gfp_mask
+ * @param nr_pages
+ * @param array
+ * @return size_t número de pages efetivamente alocados.
+ */
+static size_t __alloc_pages_bulk(gfp_t gfp_mask, size_t nr_pages, page_t **array)
+{
+    zone_t *zone = zone_obj(gfp_mask);
+    numa_node_t *node = node_obj(numa_node_id());
+    struct free_area *area = NULL;
+    size_t nr = 0;
+    bool drained = false;
+    page_t *bck = NULL;
+    int order;
+
+again:
+    for (u8_t n = 0; n < node->nr_fallback && nr < nr_pages; n++)
+    {
+        area = free_area_obj(node->fallback[n], gfp_mask);
+
+        spinlock_lock(&area->lock);
+        while (nr < nr_pages)
+        {
+            /* Maior bloco que não ultrapassa o que falta. Se não houver bloco desse
+            tamanho ou maior, usamos o maior bloco livre da zona. */
+            order = 63 - __builtin_clzl(nr_pages - nr);
+            if (order > MAX_PAGE_ORDER)
+                order = MAX_PAGE_ORDER;
+
+            if (find_first_order(area->order_map, order) < 0)
+                order = find_last_order(area->order_map);
+
+            if (order < 0)
+                break;
+
+            bck = __buddy_find_block(area, order);
+            update_free_pages_sub(zone, order);
+
+            for (size_t i = 0; i < (1UL << order); i++)
+            {
+                prepare_pages_block(bck + i, 0);
+                array[nr++] = bck + i;
+            }
+        }
+        spinlock_unlock(&area->lock);
+    }
+
+    /* Podem existir pages retidos nos caches per-cpu. */
+    if (nr < nr_pages && !drained)
+    {
+        drained = true;
+        drain_all_pages();
+        goto again;
+    }
+
+    return nr;
+}
+
+size_t alloc_pages_bulk(gfp_t gfp_mask, size_t nr_pages, page_t **array)
+{
+    gfp_t zone_id = gfp_zone(gfp_mask);
+    size_t nr = 0;
+    size_t taken = 0;
+
+    if (gfp_mask & __GFP_COLOR)
+        nr = alloc_pages_colored(zone_id, nr_pages, array);
+    else if (gfp_mask & __GFP_ZERO)
+        nr = taken = zero_pool_take(numa_node_id(), zone_id, nr_pages, array);
+
+    nr += __alloc_pages_bulk(zone_id, nr_pages - nr, array + nr);
+
+    /* Somente os pages que não vieram do pool precisam ser zerados. */
+    if (gfp_mask & __GFP_ZERO)
+    {
+        for (size_t i = taken; i < nr; i++)
+            clear_frame(phys_to_virt(page_to_phys(array[i])));
+    }
+
+    return nr;
+}
+
+/**
+ * @brief Devolve ao buddy os pages de 'array', fazendo o lock de cada zona e
+ * node uma única vez por sequência de pages da mesma zona e node. Os pages não
+ * passam pelo cache per-cpu: um lote grande apenas o esvaziaria em seguida.
+ *
+ * @param array
+ * @param nr_pages
+ */
+void free_pages_bulk(page_t **array, size_t nr_pages)
+{
+    struct free_area *locked = NULL;
+    struct free_area *area = NULL;
+    page_t *page = NULL;
+
+    for (size_t i = 0; i < nr_pages; i++)
+    {
+        page = array[i];
+        if (page == NULL)
+            continue;
+
+        area = page_free_area(page);
+        if (area != locked)
+        {
+            if (locked)
+                spinlock_unlock(&locked->lock);
+            spinlock_lock(&area->lock);
+            locked = area;
+        }
+
+        update_free_pages_add(page_zone(page), page->level);
+        __buddy_free_block(area, page);
+        set_page_free(page);
+    }
+
+    if (locked)
+        spinlock_unlock(&locked->lock);
+}
+
+/**
+ * @brief Aloca um bloco de preferência no node 'nid'. Na falta, o bloco vem
+ * do node mais próximo que o tenha.
+ *
+ * @param nid
+ * @param gfp_mask
+ * @param order
+ * @return page_t*
+ */
+page_t *alloc_pages_node(u8_t nid, gfp_t gfp_mask, size_t order)
+{
+    gfp_t zone_id = gfp_zone(gfp_mask);
+    page_t *bck = NULL;
+
+    /* Os bins de cores são do core e, portanto, do seu node. */
+    if ((gfp_mask & __GFP_COLOR) && order == 0 && nid == numa_node_id())
+        alloc_pages_colored(zone_id, 1, &bck);
+
+    /* Sem __GFP_ZERO, o page colorido é devolvido sem o memset. */
+    if (bck != NULL && !(gfp_mask & __GFP_ZERO))
+        return bck;
+
+    if (bck == NULL && !(gfp_mask & __GFP_ZERO))
+        return __alloc_pages(nid, zone_id, order);
+
+    if (bck == NULL && order == 0 && zero_pool_take(nid, zone_id, 1, &bck) == 1)
+        return bck;
+
+    if (bck == NULL)
+        bck = __alloc_pages(nid, zone_id, order);
+    if (bck == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < (1UL << order); i++)
+        clear_frame(phys_to_virt(page_to_phys(bck + i)));
+
+    return bck;
+}
+
+/* Os blocos vêm do node do core que faz a alocação. */
 page_t *alloc_pages(gfp_t gfp_mask, size_t order)
 {
-    return __alloc_pages(gfp_mask, order);
+    return alloc_pages_node(numa_node_id(), gfp_mask, order);
+}
+
+/**
+ * @brief Aloca um frame de ordem 0 zerado e devolve o seu endereço físico, ou
+ * 0 se não houver memória.
+ *
+ * @param gfp_mask
+ * @return phys_addr_t
+ */
+phys_addr_t alloc_zeroed_frame(gfp_t gfp_mask)
+{
+    page_t *page = alloc_pages(gfp_mask | __GFP_ZERO, 0);
+    if (page == NULL)
+        return 0;
+
+    return page_to_phys(page);
+}
+
+/**
+ * @brief Versão zerada de alloc_pagetable(). O frame vem do pool de pages
+ * zerados quando houver. Caso contrário, segue o caminho de alloc_pagetable(),
+ * que também atende o mapeamento do kernel antes do page allocator existir.
+ *
+ * @return phys_addr_t
+ */
+phys_addr_t alloc_zeroed_pagetable(void)
+{
+    page_t *page = NULL;
+    phys_addr_t frame = 0;
+
+    /* Com a camada de cores ativa, os pagetables alocados em sequência não
+    disputam os mesmos sets do L2. */
+    if (cache_color_enabled)
+    {
+        page = alloc_pages(GFP_ZONE_NORMAL | __GFP_COLOR | __GFP_ZERO, 0);
+        if (page != NULL)
+            return page_to_phys(page);
+    }
+
+    if (zero_pool_take(numa_node_id(), GFP_ZONE_NORMAL, 1, &page) == 1)
+        return page_to_phys(page);
+
+    frame = alloc_pagetable();
+    if (frame)
+        clear_frame(phys_to_virt(frame));
+
+    return frame;
+}
+
+/**
+ * @brief Preenche o pool de pages zerados de cada zona, no node do core, com
+ * até ZERO_POOL_BATCH pages. Executada pelo idle task antes do HLT: os pages
+ * são retirados cold do cache per-cpu e zerados com stores non-temporal, fora
+ * de qualquer lock.
+ */
+void zero_pool_refill_idle(void)
+{
+    struct zero_pool *pool = NULL;
+    zone_t *zone = NULL;
+    page_t *page = NULL;
+    CREATE_LIST_HEAD(batch);
+    u8_t nid = numa_node_id();
+    size_t nr;
+
+    for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+    {
+        pool = &zero_pools[nid][z];
+        zone = zone_obj(z);
+
+        if (zone->zone_page_map == NULL || pool->count >= ZERO_POOL_HIGH)
+            continue;
+
+        for (nr = 0; nr < ZERO_POOL_BATCH; nr++)
+        {
+            if (zone->zone_free_pages.value <= ZERO_POOL_RESERVE)
+                break;
+
+            page = pcp_alloc_page(z, true);
+            if (page == NULL)
+                break;
+
+            /* O node do core se esgotou e o cache foi completado por outro. */
+            if (page_to_nid(page) != nid)
+            {
+                pcp_free_page(page, true);
+                break;
+            }
+
+            prepare_pages_block(page, 0);
+            __clear_frame_nt(phys_to_virt(page_to_phys(page)));
+            list_add(&page->node, &batch);
+        }
+
+        if (nr == 0)
+            continue;
+
+        spinlock_lock(&pool->lock);
+        while (!list_is_empty(&batch))
+        {
+            page = list_entry(batch.next, page_t, node);
+            list_del(&page->node);
+            list_add(&page->node, &pool->list);
+        }
+        pool->count += nr;
+        spinlock_unlock(&pool->lock);
+    }
+}
+
+/**
+ * @brief Devolve ao buddy todos os pages do pool de pages zerados. Usada sob
+ * pressão de memória.
+ *
+ * @return size_t número de pages devolvidos.
+ */
+size_t zero_pool_drain(void)
+{
+    struct zero_pool *pool = NULL;
+    page_t *page = NULL;
+    size_t total = 0;
+
+    for (u8_t nid = 0; nid < nr_online_nodes; nid++)
+    {
+        for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+        {
+            pool = &zero_pools[nid][z];
+
+            spinlock_lock(&pool->lock);
+            while (!list_is_empty(&pool->list))
+            {
+                page = list_entry(pool->list.next, page_t, node);
+                list_del(&page->node);
+                pool->count--;
+
+                buddy_free_page(page);
+                total++;
+            }
+            spinlock_unlock(&pool->lock);
+        }
+    }
+
+    return total;
+}
+
+/**
+ * @brief Divide um bloco alocado de ordem 'order' em 2^order pages de ordem 0,
+ * que passam a ser liberados um a um(free_pages ou free_pages_bulk). Permite
+ * obter um bloco contínuo e alinhado(ex. um page de 2MiB do vmalloc) sem
+ * impor a sua liberação como um único bloco.
+ *
+ * @param page
+ * @param order
+ */
+void split_pages_block(page_t *page, u8_t order)
+{
+    for (size_t i = 0; i < (1UL << order); i++)
+        prepare_pages_block(page + i, 0);
 }
 
 int free_pages(page_t *page)
 {
+    if (page == NULL)
+    {
+        return -1;
+    }
+
+    /* Um page de outro node volta direto ao buddy, em vez de ser reutilizado
+    pelo cache deste core. */
+    if (page->level == 0 && page_to_nid(page) == numa_node_id())
+    {
+        pcp_free_page(page, false);
+        return 0;
+    }
     return buddy_free_page(page);
 }
+
+/* Pages livres no buddy do node 'nid', somando todas as zonas. */
+size_t node_free_pages_nr(u8_t nid)
+{
+    size_t nr = 0;
+
+    for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+        nr += free_area_obj(nid, z)->nr_free;
+
+    return nr;
+}
+
+/**
+ * @brief Redistribui os blocos livres entre os nodes. Até o setup_numa(), todo
+ * frame pertence ao node 0. Os blocos são retirados das free lists do node 0 e
+ * devolvidos ao buddy, que os insere no node de cada um, dividindo os que
+ * cruzam a fronteira entre dois nodes. Executada pelo BSP antes do smp_init().
+ */
+void free_area_numa_rebuild(void)
+{
+    CREATE_LIST_HEAD(blocks);
+    struct free_area *area = NULL;
+    page_t *bck = NULL;
+
+    /* Os pages retidos nos caches per-cpu também são redistribuídos. */
+    drain_all_pages();
+
+    for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+    {
+        area = free_area_obj(0, z);
+
+        spinlock_lock(&area->lock);
+        for (u8_t order = 0; order <= MAX_PAGE_ORDER; order++)
+        {
+            while ((bck = get_free_block(area->free_lists, order)) != NULL)
+            {
+                block_del(area, bck);
+                list_add(&bck->node, &blocks);
+            }
+        }
+        spinlock_unlock(&area->lock);
+
+        while (!list_is_empty(&blocks))
+        {
+            bck = list_entry(blocks.next, page_t, node);
+            list_del(&bck->node);
+
+            update_free_pages_sub(zone_obj(z), bck->level);
+            buddy_free_page(bck);
+        }
+    }
+}
@@ -0,0 +1,26 @@
+/*--------------------------------------------------------------------------
+*  File name:  pat.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Programação da Page Attribute Table. A PAT deve ser igual em todos os cores
+e, por isso, é gravada pelo BSP e por cada AP na inicialização do percpu.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "msr.h"
+#include "x86_64.h"
+#include "mm/pat.h"
+#include "smp/tlb.h"
+
+void pat_init(void)
+{
+    msr_write(IA32_PAT_MSR, PAT_VALUE);
+
+    /* Descarta as traduções guardadas com o tipo de memória anterior, inclu-
+    sive as globais do kernel. */
+    flush_tlb_global();
+}
@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------------
+*  File name:  pat.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as definições da Page Attribute Table(PAT), que permite
+escolher o tipo de memória(WB, WC, UC...) de cada page.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/pgtable_types.h"
+
+#define IA32_PAT_MSR 0x277
+
+/* Tipos de memória de um registro da PAT. */
+#define PAT_UC 0x00
+#define PAT_WC 0x01
+#define PAT_WT 0x04
+#define PAT_WP 0x05
+#define PAT_WB 0x06
+#define PAT_UC_MINUS 0x07
+
+/* O registro da PAT de um page é escolhido pelos bits PAT, PCD e PWT do entry:
+índice = PAT * 4 + PCD * 2 + PWT. Os registros 0 a 3 mantêm o valor do reset
+(WB, WT, UC-, UC), de modo que os entries sem o bit PAT não mudam de tipo. O
+registro 4 passa a ser WC. */
+#define PAT_ENTRY(i, type) ((u64_t)(type) << ((i) * 8))
+#define PAT_VALUE (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WT) |       \
+                   PAT_ENTRY(2, PAT_UC_MINUS) | PAT_ENTRY(3, PAT_UC) | \
+                   PAT_ENTRY(4, PAT_WC) | PAT_ENTRY(5, PAT_WT) |       \
+                   PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_UC))
+
+/* O bit PAT é o bit 7 nos entries de P1 e o bit 12 nos entries de pages de
+2MiB e 1GiB(o bit 7 é o PS). */
+#define PG_FLAG_PAT (1UL << 7)
+#define PG_FLAG_PAT_LARGE (1UL << 12)
+
+/* Write-combining: as escritas são agrupadas em buffers e enviadas em rajadas,
+sem passar pelo cache. Adequado para framebuffers e BARs prefetchable. */
+#define pgprot_writecombine (PG_FLAG_P | PG_FLAG_W | PG_FLAG_PAT)
+
+void pat_init(void);
@@ -0,0 +1,173 @@
+/*--------------------------------------------------------------------------
+*  File name:  pcid.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+PCID. Sem ele, cada troca do cr3 descarta toda a TLB. Com CR4.PCIDE, cada
+tradução é marcada com o PCID(bits 0-11 do cr3) ativo quando foi criada e a
+troca do cr3 com o bit 63 ligado mantém as traduções dos demais PCIDs.
+
+Cada core distribui os seus ASIDs entre os espaços de endereçamento que exe-
+cuta. Um slot só é válido se a sua geração for a geração do core. Quando os
+ASIDs acabam, ou quando é preciso descartar as traduções de todos os PCIDs
+(mapeamentos do kernel), a geração do core é incrementada e todos os slots
+passam a ser inválidos de uma só vez. Um ASID reatribuído é sempre carregado
+sem o bit 63, o que descarta as suas traduções antigas.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "x86_64.h"
+#include "kcpuid.h"
+#include "smp.h"
+#include "percpu.h"
+#include "mm/mm_types.h"
+#include "mm/pcid.h"
+
+struct pcid_slot
+{
+    mm_struct_t *mm;
+    u64_t gen;
+};
+
+struct pcid_cpu
+{
+    bool enabled;
+    u64_t gen;
+    u16_t next;
+    int cur; /* Slot do espaço de endereçamento carregado no cr3 ou -1. */
+    struct pcid_slot slot[PCID_NR_ASIDS];
+};
+
+static struct pcid_cpu pcid_cpus[MAX_CORES];
+
+static bool cpu_has_pcid(void)
+{
+    cpuid_regs_t cpuid_var = cpuid_get(CPUID_FEATURES);
+    return (cpuid_var.ecx & CPUID_ECX_PCID);
+}
+
+/* Executada por cada core na inicialização do percpu, com o PCID 0 no cr3. */
+void pcid_init(void)
+{
+    struct pcid_cpu *pc = &pcid_cpus[cpu_id()];
+
+    pc->gen = 1;
+    pc->next = 0;
+    pc->cur = -1;
+
+    if (!cpu_has_pcid())
+        return;
+
+    __write_cr4(__read_cr4() | CR4_PCIDE);
+    pc->enabled = true;
+}
+
+/**
+ * @brief Carrega o cr3 com o PML4 'pml4' do espaço de endereçamento 'mm'. Se
+ * o mm ainda possuir um ASID válido neste core, as suas traduções são mantidas.
+ */
+void pcid_switch_mm(mm_struct_t *mm, phys_addr_t pml4)
+{
+    struct pcid_cpu *pc = NULL;
+    u64_t rflags = __read_rflags64();
+    u64_t cr3 = pml4;
+
+    /* Um IPI de shootdown entre a escolha do ASID e a gravação do cr3 deixaria
+    o slot válido sem que a TLB tivesse sido descartada. */
+    local_irq_disable();
+
+    pc = &pcid_cpus[cpu_id()];
+    if (pc->enabled)
+    {
+        int i;
+
+        for (i = 0; i < PCID_NR_ASIDS; i++)
+        {
+            if (pc->slot[i].mm == mm && pc->slot[i].gen == pc->gen)
+                break;
+        }
+
+        if (i < PCID_NR_ASIDS)
+        {
+            cr3 |= (i + 1) | CR3_NOFLUSH;
+        }
+        else
+        {
+            /* Sem ASIDs livres, todos os slots são reciclados. */
+            if (pc->next >= PCID_NR_ASIDS)
+            {
+                pc->next = 0;
+                pc->gen++;
+            }
+
+            i = pc->next++;
+            pc->slot[i].mm = mm;
+            pc->slot[i].gen = pc->gen;
+            cr3 |= (i + 1);
+        }
+        pc->cur = i;
+    }
+
+    __write_cr3(cr3);
+
+    if (rflags & 0x200)
+        local_irq_enable();
+}
+
+/* Invalida os slots do core, exceto o do PCID carregado, que quem chamou já
+descartou da TLB. */
+static inline void pcid_invalidate_others(struct pcid_cpu *pc)
+{
+    if (!pc->enabled)
+        return;
+
+    pc->gen++;
+    if (pc->cur >= 0)
+        pc->slot[pc->cur].gen = pc->gen;
+}
+
+/**
+ * @brief Descarta a TLB do core corrente para todos os PCIDs. O PCID carregado
+ * é descartado imediatamente e os demais, quando forem carregados novamente.
+ */
+void pcid_flush_all(void)
+{
+    __vm_flush_tlb();
+    pcid_invalidate_others(&pcid_cpus[cpu_id()]);
+}
+
+/* Invalida um page do kernel em todos os PCIDs do core corrente. */
+void pcid_flush_kernel_page(mm_addr_t addr)
+{
+    __vm_invlpg_tlb(addr);
+    pcid_invalidate_others(&pcid_cpus[cpu_id()]);
+}
+
+/**
+ * @brief Invalida o ASID do espaço de endereçamento em todos os cores. Deve
+ * ser chamada quando os pagetables do mm perdem permissões ou quando o mm é
+ * liberado. Com 'others_only', o core corrente é mantido: quem chamou já
+ * invalidou a sua TLB.
+ * @note Um mm só executa num core por vez. Os demais cores não o carregam
+ * enquanto o slot é limpo.
+ */
+void pcid_mm_invalidate(mm_struct_t *mm, bool others_only)
+{
+    u8_t cpu = cpu_id();
+
+    for (size_t i = 0; i < MAX_CORES; i++)
+    {
+        if (!pcid_cpus[i].enabled || (others_only && i == cpu))
+            continue;
+
+        for (size_t j = 0; j < PCID_NR_ASIDS; j++)
+        {
+            mm_struct_t *expected = mm;
+            __atomic_compare_exchange_n(&pcid_cpus[i].slot[j].mm, &expected, NULL, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        }
+    }
+}
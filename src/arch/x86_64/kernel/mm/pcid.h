@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------------
+*  File name:  pcid.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas de PCID(Process-Context Identifiers), que marcam
+as traduções da TLB com o espaço de endereçamento que as criou.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* CPUID.01H:ECX[17] - PCID. */
+#define CPUID_FEATURES 0x01
+#define CPUID_ECX_PCID (1U << 17)
+
+#define CR4_PCIDE (1UL << 17)
+
+/* Bit 63 do valor gravado no cr3: mantém as traduções do PCID na TLB. */
+#define CR3_NOFLUSH (1UL << 63)
+
+/* ASIDs dinâmicos de cada core. O PCID gravado no cr3 é o ASID + 1; o PCID 0
+fica apenas com o código executado antes do primeiro mm_switch. */
+#define PCID_NR_ASIDS 32
+
+void __write_cr4(u64_t cr4);
+
+void pcid_init(void);
+void pcid_switch_mm(mm_struct_t *mm, phys_addr_t pml4);
+void pcid_flush_all(void);
+void pcid_flush_kernel_page(mm_addr_t addr);
+void pcid_mm_invalidate(mm_struct_t *mm, bool others_only);
@@ -0,0 +1,181 @@
+/*--------------------------------------------------------------------------
+*  File name:  pcp.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Cache de pages de ordem 0 por CPU(per-cpu pages). A grande maioria das alo-
+cações do kernel são de um único page. Em vez de fazer o lock da zona e per-
+correr o buddy a cada page, cada core mantém um pequeno estoque de pages que
+é reabastecido e esvaziado em lotes.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "list.h"
+#include "percpu.h"
+#include "smp.h"
+#include "sync/spin.h"
+#include "mm/page_alloc.h"
+#include "mm/page.h"
+#include "mm/mm_types.h"
+#include "mm/pcp.h"
+
+/* Os caches deveriam ficar na struct percpu, mas o percpu.h não faz parte da
+árvore. Seguindo o padrão de tss_percpu[] e percpu_table[], eles ficam em um
+vetor estático indexado pelo core e pela zona. */
+static struct per_cpu_pages pcp_table[MAX_CORES][MAX_ZONE_MEMORY];
+
+static inline struct per_cpu_pages *pcp_obj(u8_t cpu, gfp_t gfp_zone)
+{
+    return &pcp_table[cpu][gfp_zone];
+}
+
+/* Inicializa os caches de todos os cores. Deve ser chamada antes da primeira
+liberação de pages para o buddy(free_area_init). */
+void setup_pcp_pages(void)
+{
+    struct per_cpu_pages *pcp = NULL;
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+        {
+            pcp = pcp_obj(cpu, z);
+
+            spinlock_init(&pcp->lock);
+            init_list_head(&pcp->hot);
+            init_list_head(&pcp->cold);
+            pcp->count = 0;
+            pcp->high = PCP_HIGH;
+            pcp->low = PCP_LOW;
+            pcp->batch = PCP_BATCH;
+        }
+    }
+}
+
+/* Retira até 'count' pages do cache, começando pelos cold e depois pelos hot
+mais antigos(cauda da lista), e os devolve ao buddy num único lote. */
+static void pcp_drain(struct per_cpu_pages *pcp, gfp_t gfp_zone, u32_t count)
+{
+    CREATE_LIST_HEAD(batch);
+    list_head_t *src = NULL;
+    u32_t nr = 0;
+
+    while (nr < count && pcp->count > 0)
+    {
+        src = list_is_empty(&pcp->cold) ? &pcp->hot : &pcp->cold;
+
+        page_t *page = list_entry(src->prev, page_t, node);
+        list_del(&page->node);
+        list_add(&page->node, &batch);
+
+        pcp->count--;
+        nr++;
+    }
+
+    if (nr > 0)
+        buddy_free_list_bulk(gfp_zone, nr, &batch);
+}
+
+page_t *pcp_alloc_page(gfp_t gfp_mask, bool cold)
+{
+    struct per_cpu_pages *pcp = NULL;
+    page_t *page = NULL;
+    list_head_t *src = NULL;
+
+    preempt_disable();
+    pcp = pcp_obj(cpu_id(), gfp_mask);
+    spinlock_lock(&pcp->lock);
+
+    /* O cache está no limite inferior. Buscamos um lote no buddy. */
+    if (pcp->count <= pcp->low)
+        pcp->count += buddy_rmqueue_bulk(gfp_mask, pcp->batch, &pcp->hot);
+
+    if (pcp->count > 0)
+    {
+        /* Quem pede um page cold (ex. buffer de DMA) não se beneficia do cache da
+        CPU, deixando os pages hot para quem vai usá-los de imediato. */
+        if (cold)
+            src = list_is_empty(&pcp->cold) ? &pcp->hot : &pcp->cold;
+        else
+            src = list_is_empty(&pcp->hot) ? &pcp->cold : &pcp->hot;
+
+        page = list_entry(src->next, page_t, node);
+        list_del(&page->node);
+        pcp->count--;
+    }
+
+    spinlock_unlock(&pcp->lock);
+    preempt_enable();
+
+    return page;
+}
+
+void pcp_free_page(page_t *page, bool cold)
+{
+    gfp_t gfp_zone = page_zone_id(page);
+    struct per_cpu_pages *pcp = NULL;
+
+    set_block_level(page, 0);
+    set_page_free(page);
+
+    preempt_disable();
+    pcp = pcp_obj(cpu_id(), gfp_zone);
+    spinlock_lock(&pcp->lock);
+
+    if (cold)
+        list_add_tail(&page->node, &pcp->cold);
+    else
+        list_add(&page->node, &pcp->hot);
+    pcp->count++;
+
+    /* O cache alcançou o limite superior: devolvemos um lote à zona. */
+    if (pcp->count >= pcp->high)
+        pcp_drain(pcp, gfp_zone, pcp->batch);
+
+    spinlock_unlock(&pcp->lock);
+    preempt_enable();
+}
+
+/* Esvazia por completo o cache do core corrente. */
+void drain_local_pages(void)
+{
+    struct per_cpu_pages *pcp = NULL;
+
+    preempt_disable();
+    for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+    {
+        pcp = pcp_obj(cpu_id(), z);
+        spinlock_lock(&pcp->lock);
+        pcp_drain(pcp, z, pcp->count);
+        spinlock_unlock(&pcp->lock);
+    }
+    preempt_enable();
+}
+
+/* Esvazia os caches de todos os cores. É o gancho utilizado quando o buddy
+não consegue atender a um pedido: os pages podem estar retidos nos caches. */
+void drain_all_pages(void)
+{
+    struct per_cpu_pages *pcp = NULL;
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        for (u8_t z = 0; z < MAX_ZONE_MEMORY; z++)
+        {
+            pcp = pcp_obj(cpu, z);
+
+            /* Leitura sem o lock do outro core: é apenas uma indicação. O valor
+            é relido sob o lock pelo pcp_drain(). */
+            if (pcp->count == 0)
+                continue;
+
+            spinlock_lock(&pcp->lock);
+            pcp_drain(pcp, z, pcp->count);
+            spinlock_unlock(&pcp->lock);
+        }
+    }
+}
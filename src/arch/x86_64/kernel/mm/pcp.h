@@ -0,0 +1,51 @@
+/*--------------------------------------------------------------------------
+*  File name:  pcp.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as estruturas do cache de pages por CPU(per-cpu pages),
+que fica à frente do buddy allocator de cada zona.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "list.h"
+#include "sync/spin.h"
+#include "mm/mm_types.h"
+
+/* Parâmetros do cache. Os pages são retirados e devolvidos ao buddy em lotes
+de PCP_BATCH. Quando o cache alcança PCP_HIGH, devolvemos um lote à zona;
+quando cai abaixo de PCP_LOW, a próxima alocação faz o refill de um lote. */
+#define PCP_BATCH 16
+#define PCP_HIGH (PCP_BATCH * 6)
+#define PCP_LOW 0
+
+/* Cache de pages de ordem 0 de uma zona em um core. Os pages liberados
+recentemente(hot) ficam na lista 'hot' e tendem a estar no cache da CPU. Os
+pages liberados como 'cold' ficam na lista 'cold' e só são usados quando a
+lista hot estiver vazia. */
+struct per_cpu_pages
+{
+    spinlock_t lock; /* Só disputado quando outro core faz o drain. */
+    list_head_t hot;
+    list_head_t cold;
+    u32_t count; /* Total de pages nas duas listas. */
+    u32_t high;  /* Acima deste valor, devolvemos um lote ao buddy. */
+    u32_t low;   /* Abaixo deste valor, fazemos o refill. */
+    u32_t batch; /* Número de pages movidos por vez. */
+};
+
+void setup_pcp_pages(void);
+page_t *pcp_alloc_page(gfp_t gfp_mask, bool cold);
+void pcp_free_page(page_t *page, bool cold);
+void drain_local_pages(void);
+void drain_all_pages(void);
+
+/* Interface interna com o buddy allocator(page_alloc.c). As duas rotinas
+fazem o lock da zona uma única vez para todo o lote. */
+u32_t buddy_rmqueue_bulk(gfp_t gfp_zone, u32_t count, list_head_t *list);
+void buddy_free_list_bulk(gfp_t gfp_zone, u32_t count, list_head_t *list);
@@ -16,12 +16,11 @@ páginas físicas.
 #include "mm/page.h"
 #include "mm/page-flags.h"
 #include "mm/mm.h"
+#include "mm/gfp.h"
 
 static inline phys_addr_t _pt4_alloc(void)
 {
-    u64_t frame = alloc_frames(GFP_ZONE_NORMAL, 0);
-    memset(phys_to_virt(frame), 0, PAGE_SIZE);
-    return frame;
+    return alloc_zeroed_frame(GFP_ZONE_NORMAL);
 }
 phys_addr_t pt4_alloc(mm_struct_t *mm)
 {
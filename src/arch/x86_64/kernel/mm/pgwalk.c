@@ -0,0 +1,320 @@
+/*--------------------------------------------------------------------------
+*  File name:  pgwalk.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Mapeamento de um range virtual nos pagetables. Em vez de descer P4->P3->P2->P1
+a partir da raiz para cada page, a descida é feita uma única vez por pagetable
+P1 e, em seguida, até 512 entries consecutivos são preenchidos num laço. Os
+pagetables intermediários só são alocados quando o range cruza uma fronteira.
+
+Quando o alinhamento e a continuidade física permitem, o range é mapeado com
+pages de 2MiB(entry em P2) ou 1GiB(entry em P3). Um page grande que passa a
+ser mapeado ou limpo apenas em parte é dividido(split) em um pagetable do
+nível abaixo, com a mesma tradução.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "kcpuid.h"
+#include "mm/mm_types.h"
+#include "mm/pgtable_types.h"
+#include "mm/pgtable.h"
+#include "mm/page_alloc.h"
+#include "mm/vmm.h"
+#include "mm/pgwalk.h"
+#include "mm/pat.h"
+
+/* CPUID.80000001H:EDX[26] - pages de 1GiB. */
+#define CPUID_EXT_FEATURES 0x80000001
+#define CPUID_EXT_EDX_PDPE1GB (1U << 26)
+
+bool cpu_has_gbpages(void)
+{
+    cpuid_regs_t cpuid_var = cpuid_get(CPUID_EXT_FEATURES);
+    return (cpuid_var.edx & CPUID_EXT_EDX_PDPE1GB);
+}
+
+/* Início do próximo bloco de 'span' bytes, limitado a 'end'. */
+static inline mm_addr_t pgwalk_next(mm_addr_t addr, mm_addr_t span, mm_addr_t end)
+{
+    mm_addr_t next = (addr + span) & ~(span - 1);
+
+    if (next > end || next < addr)
+        return end;
+    return next;
+}
+
+/**
+ * @brief Divide o page grande mapeado por 'entry'(span bytes) num pagetable
+ * com 512 entries de span/512 bytes e a mesma tradução. 'table' é o frame do
+ * novo pagetable.
+ */
+static void pgwalk_split_entry(u64_t *entry, mm_addr_t span, phys_addr_t table)
+{
+    u64_t *child = phys_to_virt(table);
+    mm_addr_t child_span = span / PGWALK_NR_ENTRIES;
+    phys_addr_t base = MASK_PAGE_ENTRY(*entry) & ~(span - 1);
+    u64_t flags = (*entry) & ~MASK_PAGE_ENTRY(*entry);
+    u64_t child_flags = flags;
+
+    /* Nos entries de P1 o bit 7 é o PAT, e não o PS. O bit PAT do page
+    grande(bit 12) é levado para a posição correspondente. */
+    if (child_span == PAGE_SIZE)
+    {
+        child_flags &= ~PG_FLAG_PS;
+        if ((*entry) & PG_FLAG_PAT_LARGE)
+            child_flags |= PG_FLAG_PAT;
+    }
+    else if ((*entry) & PG_FLAG_PAT_LARGE)
+    {
+        child_flags |= PG_FLAG_PAT_LARGE;
+    }
+
+    for (size_t i = 0; i < PGWALK_NR_ENTRIES; i++)
+        child[i] = (base + i * child_span) | child_flags;
+
+    *entry = table | (flags & ~PG_FLAG_PS);
+}
+
+/* Devolve o endereço físico do pagetable apontado pelo entry, alocando um
+novo pagetable se o entry não estiver presente ou dividindo o page grande
+que ele mapeia. */
+static inline phys_addr_t pgwalk_table(struct pgwalk *walk, u64_t *entry, u8_t level,
+                                       mm_addr_t span)
+{
+    phys_addr_t frame = 0;
+
+    if ((*entry) & PG_FLAG_P)
+    {
+        if ((*entry) & PG_FLAG_PS)
+            pgwalk_split_entry(entry, span, walk->alloc_table(walk, level));
+
+        return MASK_PAGE_ENTRY(*entry);
+    }
+
+    frame = walk->alloc_table(walk, level);
+    clear_frame(phys_to_virt(frame));
+    *entry = frame | walk->table_prot;
+
+    return frame;
+}
+
+/* Flags de um entry de page grande: o bit PAT muda do bit 7 para o bit 12. */
+static inline u64_t pgwalk_huge_prot(u64_t prot)
+{
+    if (prot & PG_FLAG_PAT)
+        prot = (prot & ~PG_FLAG_PAT) | PG_FLAG_PAT_LARGE;
+    return prot | PG_FLAG_PS;
+}
+
+/* Verifica se o bloco de 'span' bytes em 'addr' pode ser mapeado com um único
+entry de page grande. */
+static inline bool pgwalk_huge_ok(struct pgwalk *walk, u64_t entry, u8_t huge,
+                                  mm_addr_t addr, mm_addr_t end, mm_addr_t span,
+                                  size_t index)
+{
+    size_t nr = span >> PAGE_SHIFT;
+
+    if (!(walk->huge & huge) || walk->is_contig == NULL)
+        return false;
+    if ((entry & PG_FLAG_P) || (addr & (span - 1)) || (end - addr) < span)
+        return false;
+    if (walk->next_frame(walk, index) & (span - 1))
+        return false;
+
+    return walk->is_contig(walk, index, nr);
+}
+
+/**
+ * @brief Mapeia o range [start, end) com os frames fornecidos por
+ * walk->next_frame(). Entries já presentes são preservados.
+ *
+ * @param walk
+ * @param start
+ * @param end
+ * @return o número de pages(4KiB) mapeados.
+ */
+size_t pgwalk_map_range(struct pgwalk *walk, mm_addr_t start, mm_addr_t end)
+{
+    mm_addr_t addr = start;
+    mm_addr_t next = 0;
+    size_t index = 0;
+    size_t mapped = 0;
+    p4e_t *p4e = NULL;
+    p3e_t *p3e = NULL;
+    p2e_t *p2e = NULL;
+    p1e_t *p1e = NULL;
+    u64_t pte_prot = walk->pte_prot;
+
+    /* As traduções do kernel não precisam ser descartadas na troca do cr3. */
+    if (start >= PGWALK_KERNEL_START)
+        pte_prot |= PG_FLAG_G;
+
+    while (addr < end)
+    {
+        p4e = p4_entry(walk->pml4, addr);
+        pgwalk_table(walk, &p4e->p4e, P3_ID, 0);
+
+        p3e = p3_entry(p4e, addr);
+        if (pgwalk_huge_ok(walk, p3e->p3e, PGWALK_HUGE_1G, addr, end, PGWALK_P2_SPAN, index))
+        {
+            p3e->p3e = walk->next_frame(walk, index) | pgwalk_huge_prot(pte_prot);
+            addr += PGWALK_P2_SPAN;
+            index += PGWALK_P2_SPAN >> PAGE_SHIFT;
+            mapped += PGWALK_P2_SPAN >> PAGE_SHIFT;
+            continue;
+        }
+        pgwalk_table(walk, &p3e->p3e, P2_ID, PGWALK_P2_SPAN);
+
+        p2e = p2_entry(p3e, addr);
+        if (pgwalk_huge_ok(walk, p2e->p2e, PGWALK_HUGE_2M, addr, end, PGWALK_P1_SPAN, index))
+        {
+            p2e->p2e = walk->next_frame(walk, index) | pgwalk_huge_prot(pte_prot);
+            addr += PGWALK_P1_SPAN;
+            index += PGWALK_P1_SPAN >> PAGE_SHIFT;
+            mapped += PGWALK_P1_SPAN >> PAGE_SHIFT;
+            continue;
+        }
+        pgwalk_table(walk, &p2e->p2e, P1_ID, PGWALK_P1_SPAN);
+
+        /* Uma descida por pagetable P1. */
+        p1e = p1_entry(p2e, addr);
+        next = pgwalk_next(addr, PGWALK_P1_SPAN, end);
+
+        for (; addr < next; addr += PAGE_SIZE, p1e++, index++)
+        {
+            if ((p1e->p1e) & PG_FLAG_P)
+            {
+                WARN_ERROR("P1 entry=%p ja está mapeado para %x", p1e, p1e->p1e);
+                continue;
+            }
+
+            p1e->p1e = walk->next_frame(walk, index) | pte_prot;
+            mapped++;
+
+            /* PageTable statistic. */
+            mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, PFRAME_ID);
+        }
+    }
+
+    return mapped;
+}
+
+/* Frame para o split fora de um pgwalk_map_range(). */
+static phys_addr_t pgwalk_split_table(u8_t level)
+{
+    phys_addr_t table = alloc_pagetable();
+
+    /* PageTable statistic. */
+    mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, level);
+    return table;
+}
+
+/**
+ * @brief Limpa os entries do range [start, end), sem liberar os pagetables nem
+ * invalidar a TLB, o que fica a cargo de quem chamou. Um page grande coberto
+ * por inteiro é limpo num único entry; coberto em parte, é dividido antes.
+ *
+ * @return o número de pages(4KiB) que estavam mapeados.
+ */
+size_t pgwalk_clear_range(virt_addr_t pml4, mm_addr_t start, mm_addr_t end)
+{
+    mm_addr_t addr = start;
+    mm_addr_t next = 0;
+    size_t cleared = 0;
+    p4e_t *p4e = NULL;
+    p3e_t *p3e = NULL;
+    p2e_t *p2e = NULL;
+    p1e_t *p1e = NULL;
+
+    while (addr < end)
+    {
+        p4e = p4_entry(pml4, addr);
+        if (!p3_present(p4e))
+        {
+            addr = pgwalk_next(addr, PGWALK_P2_SPAN * PGWALK_NR_ENTRIES, end);
+            continue;
+        }
+
+        p3e = p3_entry(p4e, addr);
+        if (!p2_present(p3e))
+        {
+            addr = pgwalk_next(addr, PGWALK_P2_SPAN, end);
+            continue;
+        }
+        if (p3e->p3e & PG_FLAG_PS)
+        {
+            if (!(addr & (PGWALK_P2_SPAN - 1)) && (end - addr) >= PGWALK_P2_SPAN)
+            {
+                p3e->p3e = 0;
+                addr += PGWALK_P2_SPAN;
+                cleared += PGWALK_P2_SPAN >> PAGE_SHIFT;
+                continue;
+            }
+            pgwalk_split_entry(&p3e->p3e, PGWALK_P2_SPAN, pgwalk_split_table(P2_ID));
+        }
+
+        p2e = p2_entry(p3e, addr);
+        if (!p1_present(p2e))
+        {
+            addr = pgwalk_next(addr, PGWALK_P1_SPAN, end);
+            continue;
+        }
+        if (p2e->p2e & PG_FLAG_PS)
+        {
+            if (!(addr & (PGWALK_P1_SPAN - 1)) && (end - addr) >= PGWALK_P1_SPAN)
+            {
+                p2e->p2e = 0;
+                addr += PGWALK_P1_SPAN;
+                cleared += PGWALK_P1_SPAN >> PAGE_SHIFT;
+                continue;
+            }
+            pgwalk_split_entry(&p2e->p2e, PGWALK_P1_SPAN, pgwalk_split_table(P1_ID));
+        }
+
+        p1e = p1_entry(p2e, addr);
+        next = pgwalk_next(addr, PGWALK_P1_SPAN, end);
+
+        for (; addr < next; addr += PAGE_SIZE, p1e++)
+        {
+            if (!((p1e->p1e) & PG_FLAG_P))
+                continue;
+
+            p1e->p1e = 0;
+            cleared++;
+
+            /* PageTable statistic. */
+            mm_tables_alloc_counter_dec(&init_mm.mm_pgtables, PFRAME_ID);
+        }
+    }
+
+    return cleared;
+}
+
+/**
+ * @brief Garante que 'addr' seja mapeado por um entry em P1, dividindo os
+ * pages grandes que o contêm. Utilizada por quem altera um único page dentro
+ * de um range mapeado com pages grandes(kmap_frame, kunmap_frame).
+ */
+void pgwalk_split(virt_addr_t pml4, mm_addr_t addr)
+{
+    p4e_t *p4e = p4_entry(pml4, addr);
+    if (!p3_present(p4e))
+        return;
+
+    p3e_t *p3e = p3_entry(p4e, addr);
+    if (!p2_present(p3e))
+        return;
+    if (p3e->p3e & PG_FLAG_PS)
+        pgwalk_split_entry(&p3e->p3e, PGWALK_P2_SPAN, pgwalk_split_table(P2_ID));
+
+    p2e_t *p2e = p2_entry(p3e, addr);
+    if (!p1_present(p2e))
+        return;
+    if (p2e->p2e & PG_FLAG_PS)
+        pgwalk_split_entry(&p2e->p2e, PGWALK_P1_SPAN, pgwalk_split_table(P1_ID));
+}
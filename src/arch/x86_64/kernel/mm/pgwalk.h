@@ -0,0 +1,73 @@
+/*--------------------------------------------------------------------------
+*  File name:  pgwalk.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas que percorrem os pagetables para mapear e limpar
+um range virtual inteiro, compartilhadas por vmalloc, kmmap e bootmem.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* Um pagetable possui 512 entries. Um P1 mapeia 2MiB e um P2 mapeia 1GiB. */
+#define PGWALK_NR_ENTRIES 512
+#define PGWALK_P1_SPAN ((mm_addr_t)PAGE_SIZE * PGWALK_NR_ENTRIES)
+#define PGWALK_P2_SPAN (PGWALK_P1_SPAN * PGWALK_NR_ENTRIES)
+
+/* Bit PS(page size) dos entries em P3 e P2: o entry mapeia diretamente um page
+de 1GiB ou 2MiB, em vez de apontar para um pagetable. */
+#ifndef PG_FLAG_PS
+#define PG_FLAG_PS (1UL << 7)
+#endif
+
+/* Início da metade do kernel. Os seus mapeamentos são compartilhados por
+todos os espaços de endereçamento e recebem o bit G(global). */
+#define PGWALK_KERNEL_START 0xFFFF800000000000UL
+#ifndef PG_FLAG_G
+#define PG_FLAG_G (1UL << 8)
+#endif
+
+/* Ordem do bloco do buddy que forma um page de 2MiB. */
+#define HUGE_PAGE_ORDER 9
+#define HUGE_PAGE_SIZE PGWALK_P1_SPAN
+
+/* Tamanhos de page grande permitidos em pgwalk.huge. */
+#define PGWALK_HUGE_2M 0x01
+#define PGWALK_HUGE_1G 0x02
+
+/**
+ * Descreve um mapeamento para pgwalk_map_range():
+ *  - pml4: a raiz dos pagetables;
+ *  - table_prot: flags dos entries em P4, P3 e P2;
+ *  - pte_prot: flags dos entries em P1;
+ *  - alloc_table: aloca o frame de um novo pagetable. 'level' é o id usado
+ *    nas estatísticas(P3_ID, P2_ID ou P1_ID);
+ *  - next_frame: devolve o frame que mapeia o page 'index' do range;
+ *  - huge: tamanhos de page grande que podem ser utilizados;
+ *  - is_contig: informa se os 'nr' frames a partir de 'index' são fisica-
+ *    mente contínuos. Só é consultada se 'huge' não for zero e, nesse caso,
+ *    next_frame não pode ter efeitos colaterais;
+ *  - data: dado privado de quem chamou.
+ */
+struct pgwalk
+{
+    virt_addr_t pml4;
+    u64_t table_prot;
+    u64_t pte_prot;
+    phys_addr_t (*alloc_table)(struct pgwalk *walk, u8_t level);
+    phys_addr_t (*next_frame)(struct pgwalk *walk, size_t index);
+    u8_t huge;
+    bool (*is_contig)(struct pgwalk *walk, size_t index, size_t nr);
+    void *data;
+};
+
+bool cpu_has_gbpages(void);
+size_t pgwalk_map_range(struct pgwalk *walk, mm_addr_t start, mm_addr_t end);
+size_t pgwalk_clear_range(virt_addr_t pml4, mm_addr_t start, mm_addr_t end);
+void pgwalk_split(virt_addr_t pml4, mm_addr_t addr);
@@ -0,0 +1,669 @@
+/*--------------------------------------------------------------------------
+*  File name:  slab.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Slab allocator. Cada kmem_cache administra objetos de um único tamanho,
+retirados de slabs(blocos de alloc_pages()). Os objetos são alinhados à
+linha de cache e podem ter um construtor, executado apenas quando o slab é
+criado. Cada core mantém dois magazines(pilhas de objetos) e os troca com o
+depot do cache, de modo que a maioria das alocações e liberações só acessa
+dados do próprio core, sem nenhum lock.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "stdio.h"
+#include "string.h"
+#include "debug.h"
+#include "list.h"
+#include "percpu.h"
+#include "smp.h"
+#include "sync/spin.h"
+#include "mm/page_alloc.h"
+#include "mm/page.h"
+#include "mm/mm_types.h"
+#include "mm/slab.h"
+
+/* O cache dos descritores de cache. É estático, pois precisa existir antes
+de qualquer outro. */
+static kmem_cache_t cache_cache;
+
+/* Lista de todos os caches criados. */
+CREATE_LIST_HEAD(cache_chain);
+CREATE_SPINLOCK(spinlock_cache_chain);
+
+/* Caches das classes de tamanho do kmalloc. */
+static const size_t kmalloc_sizes[] = {32, 64, 128, 192, 256, 512, 1024, 2048};
+#define NR_KMALLOC_CACHES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+static kmem_cache_t *kmalloc_caches[NR_KMALLOC_CACHES];
+
+static bool slab_ready = false;
+
+/*-----------------------------------------------------------------------------
+Um page alocado não utiliza o seu 'node', que só encadeia pages livres. Nos
+pages de um slab, ele guarda o cache e o slab aos quais o page pertence, o que
+permite a kfree() localizar o slab a partir de um endereço qualquer.
+-----------------------------------------------------------------------------*/
+static inline void page_set_slab(page_t *page, kmem_cache_t *cachep, struct slab *slabp)
+{
+    page->node.next = (list_head_t *)cachep;
+    page->node.prev = (list_head_t *)slabp;
+}
+static inline struct slab *page_get_slab(page_t *page)
+{
+    return (struct slab *)page->node.prev;
+}
+static inline page_t *slab_virt_to_page(void *obj)
+{
+    return pfn_to_page(phys_to_pfn(virt_to_phys(obj)));
+}
+
+/**
+ * @brief Calcula quantos objetos cabem num slab de ordem 'order' e o deslo-
+ * camento do primeiro objeto.
+ *
+ * @param cachep
+ * @param order
+ * @return u32_t
+ */
+static u32_t slab_estimate(kmem_cache_t *cachep, u8_t order)
+{
+    size_t slab_bytes = (PAGE_SIZE << order);
+    size_t head = sizeof(struct slab);
+    u32_t nr = (slab_bytes - head) / (cachep->size + sizeof(u16_t));
+
+    while (nr > 0 && ALIGN(head + nr * sizeof(u16_t), cachep->align) + nr * cachep->size > slab_bytes)
+        nr--;
+
+    cachep->mem_offset = ALIGN(head + nr * sizeof(u16_t), cachep->align);
+    return nr;
+}
+
+static void cache_setup(kmem_cache_t *cachep, const char *name, size_t size,
+                        size_t align, flags_t flags, void (*ctor)(void *))
+{
+    memset(cachep, 0, sizeof(kmem_cache_t));
+
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+
+    /* Objetos pequenos não ocupam uma linha inteira: alinhamos à menor fração
+    da linha que ainda os comporta, para não dobrar o seu tamanho. */
+    if (flags & SLAB_HWCACHE_ALIGN)
+    {
+        size_t line = SLAB_CACHE_LINE;
+        while (size <= line / 2 && line / 2 >= align)
+            line /= 2;
+        if (line > align)
+            align = line;
+    }
+
+    cachep->name = name;
+    cachep->obj_size = size;
+    cachep->align = align;
+    cachep->size = ALIGN(size, align);
+    cachep->flags = flags;
+    cachep->ctor = ctor;
+
+    /* Menor ordem que acomode SLAB_MIN_OBJS objetos. */
+    for (cachep->order = 0; cachep->order < SLAB_MAX_ORDER; cachep->order++)
+    {
+        if (slab_estimate(cachep, cachep->order) >= SLAB_MIN_OBJS)
+            break;
+    }
+    cachep->objs_per_slab = slab_estimate(cachep, cachep->order);
+
+    spinlock_init(&cachep->lock);
+    init_list_head(&cachep->slabs_full);
+    init_list_head(&cachep->slabs_partial);
+    init_list_head(&cachep->slabs_free);
+
+    spinlock_init(&cachep->depot.lock);
+    init_list_head(&cachep->depot.full);
+    init_list_head(&cachep->depot.empty);
+
+    /* Os magazines de cada core são obtidos sob demanda, na primeira liberação. */
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        cachep->cpu[cpu].loaded = NULL;
+        cachep->cpu[cpu].previous = NULL;
+    }
+
+    spinlock_lock(&spinlock_cache_chain);
+    list_add_tail(&cachep->next, &cache_chain);
+    spinlock_unlock(&spinlock_cache_chain);
+}
+
+/**
+ * @brief Cria um novo slab para o cache, executando o construtor em cada
+ * objeto. Deve ser chamada sem o lock do cache: sob pressão de memória, o
+ * page allocator encolhe os caches(kmem_cache_shrink_all), o que inclui este.
+ *
+ * @param cachep
+ * @return struct slab*
+ */
+static struct slab *cache_grow(kmem_cache_t *cachep)
+{
+    page_t *page = alloc_pages(GFP_ZONE_NORMAL, cachep->order);
+    if (page == NULL)
+        return NULL;
+
+    struct slab *slabp = (struct slab *)phys_to_virt(page_to_phys(page));
+
+    slabp->cache = cachep;
+    slabp->s_mem = (virt_addr_t)((u64_t)slabp + cachep->mem_offset);
+    slabp->inuse = 0;
+    slabp->free_top = cachep->objs_per_slab;
+
+    /* Os índices são empilhados em ordem decrescente, para que os objetos
+    sejam entregues na ordem dos endereços. */
+    for (u32_t i = 0; i < cachep->objs_per_slab; i++)
+    {
+        slabp->free[i] = (cachep->objs_per_slab - 1) - i;
+
+        if (cachep->ctor)
+            cachep->ctor((void *)((u64_t)slabp->s_mem + i * cachep->size));
+    }
+
+    for (size_t i = 0; i < (1UL << cachep->order); i++)
+        page_set_slab(page + i, cachep, slabp);
+
+    spinlock_lock(&cachep->lock);
+    list_add(&slabp->list, &cachep->slabs_free);
+    cachep->nr_slabs++;
+    cachep->nr_free_slabs++;
+    spinlock_unlock(&cachep->lock);
+
+    return slabp;
+}
+
+/* Devolve ao page allocator um slab sem objetos em uso. Deve ser chamada com
+o lock do cache. */
+static void slab_destroy(kmem_cache_t *cachep, struct slab *slabp)
+{
+    page_t *page = slab_virt_to_page(slabp);
+
+    list_del(&slabp->list);
+    cachep->nr_slabs--;
+    cachep->nr_free_slabs--;
+
+    for (size_t i = 0; i < (1UL << cachep->order); i++)
+        page_set_slab(page + i, NULL, NULL);
+
+    free_pages(page);
+}
+
+static inline void *slab_get_obj(kmem_cache_t *cachep, struct slab *slabp)
+{
+    u16_t idx = slabp->free[--slabp->free_top];
+    slabp->inuse++;
+    return (void *)((u64_t)slabp->s_mem + idx * cachep->size);
+}
+
+static inline void slab_put_obj(kmem_cache_t *cachep, struct slab *slabp, void *obj)
+{
+    u16_t idx = ((u64_t)obj - (u64_t)slabp->s_mem) / cachep->size;
+    slabp->free[slabp->free_top++] = idx;
+    slabp->inuse--;
+}
+
+/* Coloca o slab na lista adequada após a retirada de um objeto. Deve ser
+chamada com o lock do cache. */
+static inline void slab_after_get(kmem_cache_t *cachep, struct slab *slabp)
+{
+    list_del(&slabp->list);
+    if (slabp->free_top == 0)
+        list_add(&slabp->list, &cachep->slabs_full);
+    else
+        list_add(&slabp->list, &cachep->slabs_partial);
+}
+
+/* Devolve um objeto ao seu slab. Mantemos um único slab vazio por cache; os
+demais voltam ao page allocator. Deve ser chamada com o lock do cache. */
+static void __slab_free_obj(kmem_cache_t *cachep, void *obj)
+{
+    struct slab *slabp = page_get_slab(slab_virt_to_page(obj));
+
+    slab_put_obj(cachep, slabp, obj);
+
+    list_del(&slabp->list);
+    if (slabp->inuse == 0)
+    {
+        list_add(&slabp->list, &cachep->slabs_free);
+        cachep->nr_free_slabs++;
+
+        if (cachep->nr_free_slabs > 1)
+            slab_destroy(cachep, slabp);
+    }
+    else
+    {
+        list_add(&slabp->list, &cachep->slabs_partial);
+    }
+}
+
+/**
+ * @brief Camada de slabs: retira um objeto dos slabs parcialmente ocupados,
+ * depois dos vazios, e só então cria um novo slab.
+ *
+ * @param cachep
+ * @return void*
+ */
+static void *slab_alloc_obj(kmem_cache_t *cachep)
+{
+    struct slab *slabp = NULL;
+    void *obj = NULL;
+
+    spinlock_lock(&cachep->lock);
+    if (list_is_empty(&cachep->slabs_partial) && list_is_empty(&cachep->slabs_free))
+    {
+        spinlock_unlock(&cachep->lock);
+        cache_grow(cachep);
+        spinlock_lock(&cachep->lock);
+    }
+
+    if (!list_is_empty(&cachep->slabs_partial))
+    {
+        slabp = list_entry(cachep->slabs_partial.next, struct slab, list);
+    }
+    else
+    {
+        if (!list_is_empty(&cachep->slabs_free))
+        {
+            slabp = list_entry(cachep->slabs_free.next, struct slab, list);
+            cachep->nr_free_slabs--;
+        }
+    }
+
+    if (slabp != NULL)
+    {
+        obj = slab_get_obj(cachep, slabp);
+        slab_after_get(cachep, slabp);
+    }
+    spinlock_unlock(&cachep->lock);
+
+    return obj;
+}
+
+static void slab_free_obj(kmem_cache_t *cachep, void *obj)
+{
+    spinlock_lock(&cachep->lock);
+    __slab_free_obj(cachep, obj);
+    spinlock_unlock(&cachep->lock);
+}
+
+/*-----------------------------------------------------------------------------
+Camada de magazines. Os magazines são objetos do cache 'magazine_cache', que
+não possui magazines próprios.
+-----------------------------------------------------------------------------*/
+static kmem_cache_t *magazine_cache = NULL;
+
+/* Esvazia o magazine, devolvendo todos os objetos aos slabs com um único lock. */
+static void magazine_flush(kmem_cache_t *cachep, struct kmem_magazine *mag)
+{
+    spinlock_lock(&cachep->lock);
+    while (mag->rounds > 0)
+        __slab_free_obj(cachep, mag->objs[--mag->rounds]);
+    spinlock_unlock(&cachep->lock);
+}
+
+static struct kmem_magazine *depot_get_full(kmem_cache_t *cachep)
+{
+    struct kmem_depot *depot = &cachep->depot;
+    struct kmem_magazine *mag = NULL;
+
+    spinlock_lock(&depot->lock);
+    if (!list_is_empty(&depot->full))
+    {
+        mag = list_entry(depot->full.next, struct kmem_magazine, list);
+        list_del(&mag->list);
+        depot->nr_full--;
+    }
+    spinlock_unlock(&depot->lock);
+
+    return mag;
+}
+
+static struct kmem_magazine *depot_get_empty(kmem_cache_t *cachep)
+{
+    struct kmem_depot *depot = &cachep->depot;
+    struct kmem_magazine *mag = NULL;
+
+    spinlock_lock(&depot->lock);
+    if (!list_is_empty(&depot->empty))
+    {
+        mag = list_entry(depot->empty.next, struct kmem_magazine, list);
+        list_del(&mag->list);
+        depot->nr_empty--;
+    }
+    spinlock_unlock(&depot->lock);
+
+    /* O depot não tem magazines vazios: criamos um novo. */
+    if (mag == NULL && magazine_cache != NULL)
+    {
+        mag = slab_alloc_obj(magazine_cache);
+        if (mag != NULL)
+            mag->rounds = 0;
+    }
+    return mag;
+}
+
+static void depot_put_empty(kmem_cache_t *cachep, struct kmem_magazine *mag)
+{
+    struct kmem_depot *depot = &cachep->depot;
+
+    spinlock_lock(&depot->lock);
+    if (depot->nr_empty < SLAB_DEPOT_MAX_EMPTY)
+    {
+        list_add(&mag->list, &depot->empty);
+        depot->nr_empty++;
+        mag = NULL;
+    }
+    spinlock_unlock(&depot->lock);
+
+    if (mag != NULL)
+        slab_free_obj(magazine_cache, mag);
+}
+
+static void depot_put_full(kmem_cache_t *cachep, struct kmem_magazine *mag)
+{
+    struct kmem_depot *depot = &cachep->depot;
+
+    spinlock_lock(&depot->lock);
+    if (depot->nr_full < SLAB_DEPOT_MAX_FULL)
+    {
+        list_add(&mag->list, &depot->full);
+        depot->nr_full++;
+        mag = NULL;
+    }
+    spinlock_unlock(&depot->lock);
+
+    /* O depot já retém objetos suficientes: eles voltam aos slabs. */
+    if (mag != NULL)
+    {
+        magazine_flush(cachep, mag);
+        depot_put_empty(cachep, mag);
+    }
+}
+
+static inline void magazine_swap(struct slab_cpu_cache *cc)
+{
+    struct kmem_magazine *tmp = cc->loaded;
+    cc->loaded = cc->previous;
+    cc->previous = tmp;
+}
+
+/**
+ * @brief Caminho rápido: o objeto sai do magazine carregado do core. Se ele
+ * estiver vazio e o anterior cheio, os dois são trocados. Só quando ambos
+ * estão vazios trocamos um magazine vazio por um cheio no depot.
+ *
+ * @param cachep
+ * @return void*
+ */
+void *kmem_cache_alloc(kmem_cache_t *cachep)
+{
+    struct slab_cpu_cache *cc = NULL;
+    struct kmem_magazine *mag = NULL;
+    void *obj = NULL;
+
+    if (cachep->flags & SLAB_NO_MAGAZINE)
+        return slab_alloc_obj(cachep);
+
+    preempt_disable();
+    cc = &cachep->cpu[cpu_id()];
+
+    for (;;)
+    {
+        if (cc->loaded != NULL && cc->loaded->rounds > 0)
+        {
+            obj = cc->loaded->objs[--cc->loaded->rounds];
+            break;
+        }
+        if (cc->previous != NULL && cc->previous->rounds > 0)
+        {
+            magazine_swap(cc);
+            continue;
+        }
+
+        mag = depot_get_full(cachep);
+        if (mag == NULL)
+        {
+            /* Nenhum magazine cheio: o objeto vem direto dos slabs. */
+            obj = slab_alloc_obj(cachep);
+            break;
+        }
+
+        if (cc->previous != NULL)
+            depot_put_empty(cachep, cc->previous);
+        cc->previous = cc->loaded;
+        cc->loaded = mag;
+    }
+
+    preempt_enable();
+
+    return obj;
+}
+
+/**
+ * @brief Caminho rápido: o objeto entra no magazine carregado do core. Se ele
+ * estiver cheio e o anterior vazio, os dois são trocados. Só quando ambos
+ * estão cheios trocamos um magazine cheio por um vazio no depot.
+ *
+ * @param cachep
+ * @param obj
+ */
+void kmem_cache_free(kmem_cache_t *cachep, void *obj)
+{
+    struct slab_cpu_cache *cc = NULL;
+    struct kmem_magazine *mag = NULL;
+
+    if (obj == NULL)
+        return;
+
+    if (cachep->flags & SLAB_NO_MAGAZINE)
+    {
+        slab_free_obj(cachep, obj);
+        return;
+    }
+
+    preempt_disable();
+    cc = &cachep->cpu[cpu_id()];
+
+    for (;;)
+    {
+        if (cc->loaded != NULL && cc->loaded->rounds < SLAB_MAGAZINE_SIZE)
+        {
+            cc->loaded->objs[cc->loaded->rounds++] = obj;
+            break;
+        }
+        if (cc->previous != NULL && cc->previous->rounds == 0)
+        {
+            magazine_swap(cc);
+            continue;
+        }
+
+        mag = depot_get_empty(cachep);
+        if (mag == NULL)
+        {
+            /* Sem magazines: o objeto volta direto ao seu slab. */
+            slab_free_obj(cachep, obj);
+            break;
+        }
+
+        if (cc->previous != NULL)
+            depot_put_full(cachep, cc->previous);
+        cc->previous = cc->loaded;
+        cc->loaded = mag;
+    }
+
+    preempt_enable();
+}
+
+/**
+ * @brief Devolve aos slabs os objetos dos magazines do core corrente e do
+ * depot, e devolve ao page allocator todos os slabs vazios.
+ *
+ * @param cachep
+ * @return size_t número de pages devolvidos.
+ */
+size_t kmem_cache_shrink(kmem_cache_t *cachep)
+{
+    struct slab_cpu_cache *cc = NULL;
+    struct kmem_magazine *mag = NULL;
+    struct slab *slabp = NULL;
+    size_t nr_pages = 0;
+
+    if (!(cachep->flags & SLAB_NO_MAGAZINE))
+    {
+        preempt_disable();
+        cc = &cachep->cpu[cpu_id()];
+        if (cc->loaded != NULL)
+            magazine_flush(cachep, cc->loaded);
+        if (cc->previous != NULL)
+            magazine_flush(cachep, cc->previous);
+        preempt_enable();
+
+        while ((mag = depot_get_full(cachep)) != NULL)
+        {
+            magazine_flush(cachep, mag);
+            depot_put_empty(cachep, mag);
+        }
+    }
+
+    spinlock_lock(&cachep->lock);
+    while (!list_is_empty(&cachep->slabs_free))
+    {
+        slabp = list_entry(cachep->slabs_free.next, struct slab, list);
+        slab_destroy(cachep, slabp);
+        nr_pages += (1UL << cachep->order);
+    }
+    spinlock_unlock(&cachep->lock);
+
+    return nr_pages;
+}
+
+/**
+ * @brief Encolhe todos os caches. É o gancho utilizado pelo page allocator
+ * quando o buddy não consegue atender a um pedido.
+ *
+ * @return size_t número de pages devolvidos.
+ */
+size_t kmem_cache_shrink_all(void)
+{
+    list_head_t *p = NULL;
+    size_t nr_pages = 0;
+
+    spinlock_lock(&spinlock_cache_chain);
+    list_for_each(p, &cache_chain)
+    {
+        nr_pages += kmem_cache_shrink(list_entry(p, kmem_cache_t, next));
+    }
+    spinlock_unlock(&spinlock_cache_chain);
+
+    return nr_pages;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                flags_t flags, void (*ctor)(void *))
+{
+    kmem_cache_t *cachep = NULL;
+
+    if (size == 0 || size > (PAGE_SIZE << SLAB_MAX_ORDER) / SLAB_MIN_OBJS)
+    {
+        WARN_ERROR("kmem_cache_create: %s - tamanho invalido %d.", name, size);
+        return NULL;
+    }
+
+    cachep = kmem_cache_alloc(&cache_cache);
+    if (cachep == NULL)
+        return NULL;
+
+    cache_setup(cachep, name, size, align, flags, ctor);
+
+    if (cachep->objs_per_slab == 0)
+    {
+        WARN_ERROR("kmem_cache_create: %s - objeto nao cabe no slab.", name);
+
+        spinlock_lock(&spinlock_cache_chain);
+        list_del(&cachep->next);
+        spinlock_unlock(&spinlock_cache_chain);
+
+        kmem_cache_free(&cache_cache, cachep);
+        return NULL;
+    }
+    return cachep;
+}
+
+/**
+ * @brief Inicializa o slab allocator e cria os caches das classes de tamanho
+ * do kmalloc. Deve ser chamada após a inicialização do page allocator.
+ *
+ */
+void kmem_cache_init(void)
+{
+    kprintf("\n(*)%s(%d) - Inicializando o slab allocator.", __FUNCTION__, __LINE__);
+
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+
+    magazine_cache = kmem_cache_create("magazine", sizeof(struct kmem_magazine), 0,
+                                       SLAB_HWCACHE_ALIGN | SLAB_NO_MAGAZINE, NULL);
+
+    for (size_t i = 0; i < NR_KMALLOC_CACHES; i++)
+    {
+        kmalloc_caches[i] = kmem_cache_create("kmalloc", kmalloc_sizes[i], 0, SLAB_HWCACHE_ALIGN, NULL);
+        if (kmalloc_caches[i] == NULL)
+        {
+            WARN_ERROR("kmem_cache_init: falha ao criar kmalloc-%d.", kmalloc_sizes[i]);
+            return;
+        }
+    }
+    slab_ready = true;
+
+    kprintf("\n(*):%s(%d) - Finalizando.", __FUNCTION__, __LINE__);
+}
+
+bool is_slab_ready(void)
+{
+    return slab_ready;
+}
+
+void *kmalloc_slab(size_t size)
+{
+    for (size_t i = 0; i < NR_KMALLOC_CACHES; i++)
+    {
+        if (size <= kmalloc_sizes[i])
+            return kmem_cache_alloc(kmalloc_caches[i]);
+    }
+    return NULL;
+}
+
+void kfree_slab(void *obj)
+{
+    struct slab *slabp = page_get_slab(slab_virt_to_page(obj));
+
+    if (slabp == NULL)
+    {
+        WARN_ERROR("kfree: %p nao pertence a um slab.", obj);
+        return;
+    }
+    kmem_cache_free(slabp->cache, obj);
+}
+
+void show_slab_caches(void)
+{
+    list_head_t *p = NULL;
+    kmem_cache_t *cachep = NULL;
+
+    spinlock_lock(&spinlock_cache_chain);
+    list_for_each(p, &cache_chain)
+    {
+        cachep = list_entry(p, kmem_cache_t, next);
+        kprintf("\n%s-%d: size=%d order=%d objs/slab=%d slabs=%d free=%d",
+                cachep->name, cachep->obj_size, cachep->size, cachep->order,
+                cachep->objs_per_slab, cachep->nr_slabs, cachep->nr_free_slabs);
+    }
+    spinlock_unlock(&spinlock_cache_chain);
+}
@@ -0,0 +1,127 @@
+/*--------------------------------------------------------------------------
+*  File name:  slab.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as estruturas do slab allocator(kmem_cache), que divide
+blocos obtidos com alloc_pages() em objetos de tamanho fixo.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "list.h"
+#include "sync/spin.h"
+#include "smp.h"
+#include "mm/mm_types.h"
+
+/* Tamanho da linha de cache L1 utilizado no alinhamento dos objetos. */
+#define SLAB_CACHE_LINE 64
+
+/* Flags de kmem_cache_create(). */
+#define SLAB_HWCACHE_ALIGN 0x01 /* Alinha os objetos à linha de cache. */
+
+/* Ordem máxima de um slab e número mínimo de objetos desejado por slab. */
+#define SLAB_MAX_ORDER 3
+#define SLAB_MIN_OBJS 8
+
+/* Número de objetos(rounds) de um magazine. Com o cabeçalho, um magazine
+ocupa exatamente duas linhas de cache. */
+#define SLAB_MAGAZINE_SIZE 13
+
+/* Limites de magazines cheios e vazios retidos no depot de cada cache. */
+#define SLAB_DEPOT_MAX_FULL 8
+#define SLAB_DEPOT_MAX_EMPTY 8
+
+/* Cache sem camada de magazines: objetos saem direto dos slabs. Utilizado
+pelo próprio cache de magazines. */
+#define SLAB_NO_MAGAZINE 0x02
+
+/* Classes de tamanho do kmalloc atendidas pelo slab. Acima disso, kmalloc
+continua utilizando o buddy do heap. */
+#define KMALLOC_MIN_CACHE_SIZE 32
+#define KMALLOC_MAX_CACHE_SIZE 2048
+
+/* Um magazine é uma pilha de objetos. */
+struct kmem_magazine
+{
+    list_head_t list;
+    u32_t rounds;
+    void *objs[SLAB_MAGAZINE_SIZE];
+};
+
+/* Camada de cada core: o magazine carregado e o anterior, que está sempre
+cheio ou vazio. Só o próprio core os acessa, com a preempção desativada. */
+struct slab_cpu_cache
+{
+    struct kmem_magazine *loaded;
+    struct kmem_magazine *previous;
+};
+
+/* Depot do cache: magazines cheios e vazios trocados pelos cores. É a única
+estrutura compartilhada no caminho rápido e tem o seu próprio lock. */
+struct kmem_depot
+{
+    spinlock_t lock;
+    list_head_t full;
+    list_head_t empty;
+    u32_t nr_full;
+    u32_t nr_empty;
+};
+
+/* Um slab é um bloco de 2^order pages. O descritor fica no início do bloco,
+seguido da pilha de índices dos objetos livres e dos objetos. Os índices
+ficam fora dos objetos para que um objeto livre mantenha o estado deixado
+pelo construtor. */
+struct slab
+{
+    list_head_t list;
+    struct kmem_cache *cache;
+    virt_addr_t s_mem; /* Primeiro objeto. */
+    u32_t inuse;       /* Objetos alocados. */
+    u32_t free_top;    /* Topo da pilha de livres. */
+    u16_t free[];
+};
+
+typedef struct kmem_cache
+{
+    const char *name;
+    size_t obj_size; /* Tamanho pedido pelo usuário. */
+    size_t size;     /* Tamanho efetivo, já alinhado. */
+    size_t align;
+    u8_t order;
+    u32_t objs_per_slab;
+    size_t mem_offset; /* Deslocamento do primeiro objeto no slab. */
+    flags_t flags;
+    void (*ctor)(void *);
+
+    spinlock_t lock;
+    list_head_t slabs_full;
+    list_head_t slabs_partial;
+    list_head_t slabs_free;
+    u32_t nr_slabs;
+    u32_t nr_free_slabs;
+
+    list_head_t next; /* Encadeamento em cache_chain. */
+
+    struct kmem_depot depot;
+
+    struct slab_cpu_cache cpu[MAX_CORES];
+} kmem_cache_t;
+
+void kmem_cache_init(void);
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                flags_t flags, void (*ctor)(void *));
+void *kmem_cache_alloc(kmem_cache_t *cachep);
+void kmem_cache_free(kmem_cache_t *cachep, void *obj);
+size_t kmem_cache_shrink(kmem_cache_t *cachep);
+size_t kmem_cache_shrink_all(void);
+void show_slab_caches(void);
+
+/* Interface com kmalloc()/kfree(). */
+bool is_slab_ready(void);
+void *kmalloc_slab(size_t size);
+void kfree_slab(void *obj);
@@ -17,6 +17,7 @@ de memória.
 #include "debug.h"
 #include "mm/tlb.h"
 #include "mm/kmalloc.h"
+#include "mm/pgwalk.h"
 
 static inline phys_addr_t alloc_pagetble_frame(vm_flags_t flags)
 {
@@ -24,219 +25,81 @@ static inline phys_addr_t alloc_pagetble_frame(vm_flags_t flags)
     return alloc_frames(GFP_ZONE_NORMAL, 0);
 }
 
-static inline phys_addr_t kalloc_p3(p4e_t *p4e, pgprot_t pg_prot, vm_flags_t flags)
+/* Callbacks do pgwalk. */
+struct mmap_walk
 {
-    phys_addr_t pgframe = 0;
+    vm_area_t *vmm;
+    phys_addr_t base; /* Frame inicial de um range físico contínuo. */
+};
 
-    // Se o pagetable já está mapeado, devolve o seu endereço físico.
-    if (p3_present(p4e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p4e).p4e);
-    }
-    // Aloca um novo pageframe e insere seu endereço físico no entry
-    else
-    {
-        pgframe = alloc_pagetble_frame(flags);
-        clear_frame(phys_to_virt(pgframe));
-        (*p4e).p4e = pgframe | (pg_prot.value);
-
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P3_ID);
-    }
-    return (pgframe);
-}
-static inline phys_addr_t kalloc_p2(p3e_t *p3e, pgprot_t pg_prot, vm_flags_t flags)
+static phys_addr_t mmap_alloc_table(struct pgwalk *walk, u8_t level)
 {
-    phys_addr_t pgframe = 0;
-
-    // Se o pagetable já está mapeado, devolve o seu endereço físico.
-    if (p2_present(p3e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p3e).p3e);
-    }
-    // Aloca um novo pageframe e insere seu endereço físico no entry
-    else
-    {
-        pgframe = alloc_pagetble_frame(flags);
+    struct mmap_walk *mw = walk->data;
 
-        clear_frame(phys_to_virt(pgframe));
-        (*p3e).p3e = pgframe | (pg_prot.value);
-
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P2_ID);
-    }
-    return (pgframe);
+    /* PageTable statistic. */
+    mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, level);
+    return alloc_pagetble_frame(mw->vmm->flags);
 }
-static inline phys_addr_t kalloc_p1(p2e_t *p2e, pgprot_t pg_prot, vm_flags_t flags)
-{
-    phys_addr_t pgframe = 0;
-
-    // Se o pagetable já está mapeado, devolve o seu endereço físico.
-    if (p1_present(p2e))
-    {
-        pgframe = MASK_PAGE_ENTRY((*p2e).p2e);
-    }
-    // Aloca um novo pageframe e insere seu endereço físico no entry
-    else
-    {
-
-        pgframe = alloc_pagetble_frame(flags);
-        clear_frame(phys_to_virt(pgframe));
-        (*p2e).p2e = pgframe | (pg_prot.value);
 
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P1_ID);
-    }
-    return (pgframe);
+/* Range físico contínuo(VM_IDENTI, VM_RANGER e VM_HEAP). */
+static phys_addr_t mmap_contig_frame(struct pgwalk *walk, size_t index)
+{
+    struct mmap_walk *mw = walk->data;
+    return mw->base + (index << PAGE_SHIFT);
 }
 
-/**
- * @brief Rotina genérica que recebe o endereço de um entry em P1 e o endereço físico
- * de um pageframe e faz o seu mapeamento.
- *
- * @param p1e
- * @param phys_addr
- * @param pg_flags
- * @return phys_addr_t
- */
-static inline phys_addr_t map_area_frame(p1e_t *p1e, phys_addr_t phys_addr, u64_t pg_flags)
+/* Um novo frame para cada page. */
+static phys_addr_t mmap_alloc_frame(struct pgwalk *walk, size_t index)
 {
-    phys_addr_t pgframe = 0;
+    phys_addr_t pageframe = alloc_pagetable();
 
-    // Se o p1e já está mapeando um pageframe, devolve o seu endereço físico.
-    // Mas continuo o mapeamento do novo frame informado em phys_addr
-    if ((p1e->p1e) & PG_FLAG_P)
+    if (!pageframe)
     {
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
+        kprintf("\nPageframe == %x. Memory esgotada.", pageframe);
+        pause_enter();
     }
-    // Executo o bloco seguinte, inserindo o novo frame
-    else
-    {
-        p1_entry_t pte;
-        pte.value = phys_addr | pg_flags;
-        (p1e)->p1e = pte.value;
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
-
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, PFRAME_ID);
-    }
-
-    return (pgframe);
+    return pageframe;
 }
-/**
- * @brief Rotina faz o mapeamento dos pagetables e devolve uma
- * entry no tablePage1 no qual deve ser inserido o dendereço
- * físico de um frame. Este esquema dá mais flexibilidade para
- * o mapeamento.
- *
- * @param vmm
- * @param vaddr
- * @return p1e_t*
- */
-static p1e_t *map_pagetables(vm_area_t *vmm, virt_addr_t vaddr)
-{
-
-    virt_addr_t pml4 = init_mm.pml4;
-    //*****************************
-
-    p4e_t *p4e = p4_entry(pml4, (u64_t)vaddr);
-    kalloc_p3(p4e, vmm->pgprot, vmm->flags);
-
-    //  Mapeia um pagetable2 para a entrada no P3
-    p3e_t *p3e = p3_entry(p4e, (u64_t)vaddr);
-    kalloc_p2(p3e, vmm->pgprot, vmm->flags);
 
-    // Mapeia um pagetable1 para a entrada no P2
-    p2e_t *p2e = p2_entry(p3e, (u64_t)vaddr);
-    kalloc_p1(p2e, vmm->pgprot, vmm->flags);
-
-    // Mapeio o pageframe
-    p1e_t *p1e = p1_entry(p2e, (u64_t)vaddr);
-
-    return p1e;
-}
 static void mmap_mem_range(vm_area_t *vmm)
 {
     mm_addr_t ini_range = (mm_addr_t)vmm->vm_start;
     mm_addr_t pend_range = (mm_addr_t)vmm->vm_pend;
     u8_t order = calc_bin_order((pend_range - ini_range) / PAGE_SIZE);
+    struct mmap_walk mw = {.vmm = vmm, .base = 0};
 
-    phys_addr_t pageframe = 0;
-    u64_t prot_tmp = vmm->pgprot.value;
+    struct pgwalk walk = {
+        .pml4 = init_mm.pml4,
+        .table_prot = vmm->pgprot.value,
+        .pte_prot = vmm->pgprot.value,
+        .alloc_table = mmap_alloc_table,
+        .next_frame = mmap_contig_frame,
+        .data = &mw,
+    };
 
     kprintf("\nini_range=%p", ini_range);
     kprintf("\npend_range=%p", pend_range);
-    kprintf("\nprot_tmp=%x - order=%d", prot_tmp, order);
+    kprintf("\nprot_tmp=%x - order=%d", walk.pte_prot, order);
 
     if (vmm->flags & VM_IDENTI)
     {
-        pageframe = ini_range;
+        mw.base = ini_range;
     }
     else if (vmm->flags & VM_RANGER)
     {
-        pageframe = vmm->phys_base;
+        mw.base = vmm->phys_base;
     }
     else if (vmm->flags & VM_HEAP)
     {
-        pageframe = alloc_heap_block(order);
-        kprintf("\npageframe=%x", pageframe);
+        mw.base = alloc_heap_block(order);
+        kprintf("\npageframe=%x", mw.base);
     }
-
     else
     {
-        pageframe = alloc_pagetable();
+        walk.next_frame = mmap_alloc_frame;
     }
 
-    // for (; ini_range < pend_range; ini_range += PAGE_SIZE)
-    do
-    {
-
-        /*
-        Esta rotina é executada para todos os frames do intervalo
-        de memória.
-        */
-        p1e_t *p1e = map_pagetables(vmm, (virt_addr_t)ini_range);
-
-        if ((p1e->p1e) & PG_FLAG_P)
-        {
-            kprintf("\np1e=%x ja existe", p1e->p1e);
-            pause_enter();
-            continue;
-        }
-
-        // pageframe = kalloc_frames(GFP_ZONE_NORMAL_ID, 0);
-        // pageframe = alloc_pagetable();
-
-        if (!pageframe)
-        {
-            kprintf("\nPageframe == %x. Memory esgotada.", pageframe);
-            pause_enter();
-        }
-        /**
-         * @brief Faz o mapeamento do frame, que tem o seu endereço
-         * físico inserido no entry do PageTable1.
-         */
-
-        map_area_frame(p1e, pageframe, prot_tmp);
-
-        ini_range += PAGE_SIZE;
-
-        if ((ini_range < pend_range))
-        {
-            if ((vmm->flags & VM_IDENTI) || (vmm->flags & VM_RANGER) || (vmm->flags & VM_HEAP))
-            {
-                pageframe = pageframe + PAGE_SIZE;
-            }
-            else
-            {
-                pageframe = alloc_pagetable();
-            }
-        }
-
-    } while (ini_range < pend_range);
-
-    kprintf("\npageframe=%x", pageframe);
-    // debug_pause("p1");
+    pgwalk_map_range(&walk, ini_range, pend_range);
 }
 
 void kmmap(vm_area_t *vmm_area)
@@ -20,204 +20,279 @@ de memória.
 #include "mm/tlb.h"
 #include "mm/kmalloc.h"
 #include "mm/vmalloc.h"
+#include "mm/gfp.h"
+#include "mm/pgwalk.h"
+#include "mm/vmap.h"
+#include "rbtree.h"
+#include "smp/tlb.h"
+#include "mm/slab.h"
 
 vmalloc_area_t vmalloc_areas;
 
-/**
- * Calcular o level com tamanho adequado para comportar a memória
- * requisitada, adicionando o tamanho do header
- */
-static inline u8_t calc_list_order(size_t mm_size)
+/*-----------------------------------------------------------------------------
+Índice das áreas do vmalloc. Cada área ocupada é um vmap_area, inserido em duas
+rbtrees:
+  - vmap_addr_tree: ordenada pelo endereço inicial, para localizar a área no
+    vfree() e o seu antecessor;
+  - vmap_gap_tree: ordenada pelo tamanho do espaço livre que segue a área(gap),
+    para encontrar, em O(log n), o menor espaço livre que atende ao pedido.
+Uma área só está em vmap_gap_tree se o seu gap for maior que zero. Uma área
+sentinela, de tamanho zero e posicionada em vm_start, detém o espaço livre do
+início da faixa do vmalloc, de modo que toda área tenha um antecessor. Todas
+as operações são feitas com o vmlist_lock.
+-----------------------------------------------------------------------------*/
+struct vmap_area
 {
-    size_t i = calc_bin_order(mm_size >> PAGE_SHIFT);
-
-    return i;
-}
-
-/**
- * kzalloc_node - allocate zeroed memory from a particular memory node.
- * @size: how many bytes of memory are required.
- * @flags: the type of memory to allocate (see kmalloc).
- * @node: memory node from which to allocate
- */
-static inline void *kzalloc(size_t size, gfp_t flags)
+    mm_addr_t va_start;
+    mm_addr_t va_end;
+    size_t gap; /* Espaço livre entre va_end e a área seguinte. */
+    struct rb_node addr_node;
+    struct rb_node gap_node;
+    struct vm_struct *vm; /* NULL enquanto aguarda o purge. */
+    list_head_t purge_list;
+    gfp_t gfp;       /* Zona e proteção dos frames de uma área VM_LAZY. */
+    pgprot_t prot;
+};
+
+static struct rbtree vmap_addr_tree;
+static struct rbtree vmap_gap_tree;
+static struct vmap_area vmap_sentinel;
+
+/* Áreas liberadas de forma lazy. Os PTEs já foram limpos, mas as faixas
+virtuais só voltam a ser utilizadas após um único TLB shootdown para todo o
+lote, feito quando o número de pages pendentes alcança VMAP_LAZY_MAX_PAGES ou
+quando falta espaço para uma nova área. */
+#define VMAP_LAZY_MAX_PAGES 8192
+CREATE_LIST_HEAD(vmap_purge_list);
+static size_t vmap_lazy_nr = 0;
+
+/* Caches dos descritores de área. Criados em vmalloc_cache_init(), após o slab
+allocator: vmalloc() não é utilizado antes do heap do kernel existir. */
+static kmem_cache_t *vm_struct_cachep = NULL;
+static kmem_cache_t *vmap_area_cachep = NULL;
+
+static inline void vmap_link_node(struct rb_node *node, struct rb_node *parent,
+                                  struct rb_node **link)
 {
-    virt_addr_t zbck = kmalloc(size);
-    if (unlikely(!zbck))
-        return NULL;
-
-    memset(zbck, 0, size);
-    return zbck;
+    node->left = NULL;
+    node->right = NULL;
+    rb_set_parent(node, parent);
+    rb_set_color(node, RB_RED);
+    *link = node;
 }
 
-static inline phys_addr_t vmap_p3(p4e_t *p4e, pgprot_t pg_prot)
+static void vmap_addr_insert(struct vmap_area *va)
 {
-    phys_addr_t frame = 0;
+    struct rb_node **link = &vmap_addr_tree.root;
+    struct rb_node *parent = NULL;
+    struct vmap_area *tmp = NULL;
+    bool leftmost = true;
 
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico.
-    Caso contrário, aloca um novo pageframe. */
-    if (p3_present(p4e))
-    {
-        frame = MASK_PAGE_ENTRY((*p4e).p4e);
-    }
-    else
+    while (*link != NULL)
     {
-        frame = alloc_frame(GFP_ZONE_NORMAL);
-        clear_frame(phys_to_virt(frame));
-        (*p4e).p4e = frame | pg_prot.value;
+        parent = *link;
+        tmp = container_of(parent, struct vmap_area, addr_node);
 
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P3_ID);
+        if (va->va_start < tmp->va_start)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
     }
-    return (frame);
+    vmap_link_node(&va->addr_node, parent, link);
+    rb_insert(&vmap_addr_tree, &va->addr_node, leftmost);
 }
-static inline phys_addr_t vmap_p2(p3e_t *p3e, pgprot_t pg_prot)
+
+/* Chave da vmap_gap_tree: (gap, va_start). */
+static inline bool vmap_gap_less(struct vmap_area *a, struct vmap_area *b)
 {
-    phys_addr_t frame = 0;
+    if (a->gap != b->gap)
+        return (a->gap < b->gap);
+    return (a->va_start < b->va_start);
+}
 
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico.
-    Caso contrário, aloca um novo pageframe. */
-    if (p2_present(p3e))
-    {
-        frame = MASK_PAGE_ENTRY((*p3e).p3e);
-    }
-    else
+static void vmap_gap_insert(struct vmap_area *va)
+{
+    struct rb_node **link = &vmap_gap_tree.root;
+    struct rb_node *parent = NULL;
+    struct vmap_area *tmp = NULL;
+    bool leftmost = true;
+
+    if (va->gap == 0)
+        return;
+
+    while (*link != NULL)
     {
-        frame = alloc_frame(GFP_ZONE_NORMAL);
-        clear_frame(phys_to_virt(frame));
-        (*p3e).p3e = frame | pg_prot.value;
+        parent = *link;
+        tmp = container_of(parent, struct vmap_area, gap_node);
 
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P2_ID);
+        if (vmap_gap_less(va, tmp))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
     }
-    return (frame);
+    vmap_link_node(&va->gap_node, parent, link);
+    rb_insert(&vmap_gap_tree, &va->gap_node, leftmost);
 }
-static inline phys_addr_t vmap_p1(p2e_t *p2e, pgprot_t pg_prot)
+
+static inline void vmap_gap_erase(struct vmap_area *va)
 {
-    phys_addr_t frame = 0;
+    if (va->gap > 0)
+        rb_erase(&vmap_gap_tree, &va->gap_node);
+}
 
-    /* Se o pagetable já está mapeado, devolve o seu endereço físico.
-    Caso contrário, aloca um novo pageframe. */
-    if (p1_present(p2e))
-    {
-        frame = MASK_PAGE_ENTRY((*p2e).p2e);
-    }
-    else
-    {
-        frame = alloc_frame(GFP_ZONE_NORMAL);
-        clear_frame(phys_to_virt(frame));
-        (*p2e).p2e = frame | (pg_prot.value);
+/* Menor gap que comporta 'size' bytes(best fit). */
+static struct vmap_area *vmap_gap_find(size_t size)
+{
+    struct rb_node *n = vmap_gap_tree.root;
+    struct vmap_area *va = NULL;
+    struct vmap_area *best = NULL;
 
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, P1_ID);
+    while (n != NULL)
+    {
+        va = container_of(n, struct vmap_area, gap_node);
+        if (va->gap >= size)
+        {
+            best = va;
+            n = n->left;
+        }
+        else
+        {
+            n = n->right;
+        }
     }
-    return (frame);
+    return best;
 }
 
-/**
- * @brief Rotina genérica que recebe o endereço de um entry em P1 e o endereço físico
- * de um pageframe e faz o seu mapeamento.
- *
- * @param p1e
- * @param phys_addr
- * @param pg_flags
- * @return phys_addr_t
- */
-static inline phys_addr_t map_vm_pageframe(p1e_t *p1e, phys_addr_t phys_addr, pgprot_t prot)
+/* Área que inicia exatamente em 'addr'. */
+static struct vmap_area *vmap_find(mm_addr_t addr)
 {
-    phys_addr_t pgframe = 0;
+    struct rb_node *n = vmap_addr_tree.root;
+    struct vmap_area *va = NULL;
 
-    /* Se o p1e já está mapeando um pageframe, devolve o seu endereço físico.
-    Mas continuo o mapeamento do novo frame informado em phys_addr.*/
-    // if ((p1e->p1e) & PG_FLAG_P)
-    if (pgframe_present(p1e))
+    while (n != NULL)
     {
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
+        va = container_of(n, struct vmap_area, addr_node);
+        if (addr < va->va_start)
+            n = n->left;
+        else if (addr > va->va_start)
+            n = n->right;
+        else
+            return va;
     }
-    else
-    {
-        (p1e)->p1e = phys_addr | prot.value;
-        pgframe = MASK_PAGE_ENTRY((*p1e).p1e);
+    return NULL;
+}
 
-        /* PageTable statistic. */
-        mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, PFRAME_ID);
-    }
+/* Área imediatamente anterior a 'addr'. */
+static struct vmap_area *vmap_find_prev(mm_addr_t addr)
+{
+    struct rb_node *n = vmap_addr_tree.root;
+    struct vmap_area *va = NULL;
+    struct vmap_area *prev = NULL;
 
-    return (pgframe);
+    while (n != NULL)
+    {
+        va = container_of(n, struct vmap_area, addr_node);
+        if (va->va_start < addr)
+        {
+            prev = va;
+            n = n->right;
+        }
+        else
+        {
+            n = n->left;
+        }
+    }
+    return prev;
 }
 
-/**
- * @brief A partir do endereço virtual informado, a rotina faz o mapeamento
- * dos pagetables necessários e devolve o entry no tablePage1 e no qual deve
- * ser inserido o endereço físico de um frame pela rotina que chamou.
- * Este esquema simplifica e dá mais flexibilidade ao mapeamento.
- *
- * @param vmm
- * @param vaddr
- * @return o endereço virtual de um entry em p1e_t*
- */
-static p1e_t *map_vm_pagetables(mm_addr_t mm_addr, pgprot_t prot)
+/* Retira a área dos índices e devolve o seu espaço ao gap do antecessor. */
+static void vmap_area_release(struct vmap_area *va)
 {
+    struct vmap_area *prev = vmap_find_prev(va->va_start);
 
-    p4e_t *p4e = pgd_offset_k(mm_addr);
-    vmap_p3(p4e, prot);
-
-    //  Mapeia um pagetable2 para a entrada no P3
-    p3e_t *p3e = p3_entry(p4e, mm_addr);
-    vmap_p2(p3e, prot);
+    vmap_gap_erase(prev);
+    vmap_gap_erase(va);
 
-    // Mapeia um pagetable1 para a entrada no P2
-    p2e_t *p2e = p2_entry(p3e, mm_addr);
-    vmap_p1(p2e, prot);
+    prev->gap += (va->va_end - va->va_start) + va->gap;
 
-    // Entry na tabela P1
-    p1e_t *p1e = p1_entry(p2e, mm_addr);
+    rb_erase(&vmap_addr_tree, &va->addr_node);
+    vmap_gap_insert(prev);
 
-    return p1e;
+    vmalloc_areas.used_size -= (va->va_end - va->va_start);
 }
 
-static void __map_vm_range(mm_addr_t mm_addr, size_t size,
-                           pgprot_t prot, struct page **pages)
+/**
+ * Calcular o level com tamanho adequado para comportar a memória
+ * requisitada, adicionando o tamanho do header
+ */
+static inline u8_t calc_list_order(size_t mm_size)
 {
-    mm_addr_t start = mm_addr;
-    mm_addr_t end = mm_addr + size;
-    mm_addr_t next = start;
-    size_t nr_frames = (size) >> PAGE_SHIFT;
-    phys_addr_t frame = 0;
-
-    for (size_t i = 0; i < nr_frames; i++)
-    {
+    size_t i = calc_bin_order(mm_size >> PAGE_SHIFT);
 
-        /* O range é mapeado nos pagetables um page/frame por vez e devolve-se
-        o endereço do entry em P1. Se o endereço já está mapeado nos pagetables,
-        apenas devolve o entry em P1. */
+    return i;
+}
 
-        p1e_t *p1e = map_vm_pagetables(next, prot);
+/* Callbacks do pgwalk: os pagetables vêm da zona normal e os frames do vetor
+de pages da área. */
+static phys_addr_t vmap_alloc_table(struct pgwalk *walk, u8_t level)
+{
+    /* PageTable statistic. */
+    mm_tables_alloc_counter_inc(&init_mm.mm_pgtables, level);
+    return alloc_frame(GFP_ZONE_NORMAL);
+}
 
-        /* Se o entre em P1 já está vinculado a um pageframe, significa que estamos
-        mapeando uma área mapeada anteriormente. Possivelmente Há um erro. */
-        if ((p1e->p1e) & PG_FLAG_P)
-        {
-            WARN_ERROR("P1 entry=%p ja está mapeado para %x", p1e, p1e->p1e);
-            continue;
-        }
+static phys_addr_t vmap_next_frame(struct pgwalk *walk, size_t index)
+{
+    struct page **pages = walk->data;
+    phys_addr_t frame = page_to_phys(pages[index]);
 
-        /* Os frames já foram alocados anteriormente e inseridos no vetor pages. */
-        frame = page_to_phys(pages[i]);
+    /* Se o pageframe não existe, houve um erro na allocação. */
+    if (!frame)
+        WARN_ERROR("ERROR: frame not alocado.Memory pode estar esgotada.");
 
-        /* Se o pageframe não existe, houve um erro na allocação. */
-        if (!frame)
-        {
-            WARN_ON("\nERROR: frame == %x. Memory esgotada.", frame);
-            WARN_ERROR("ERROR: frame not alocado.Memory pode estar esgotada.");
-        }
+    return frame;
+}
 
-        /* Mapeia o P1 entry para o frame alocado.*/
-        map_vm_pageframe(p1e, frame, prot);
+/* Os pages de um bloco de ordem HUGE_PAGE_ORDER ocupam posições seguidas em
+pages[] e no vetor de struct page. */
+static bool vmap_is_contig(struct pgwalk *walk, size_t index, size_t nr)
+{
+    struct page **pages = walk->data;
 
-        /* Avançamos para o page/frame seguinte no range. */
-        next += PAGE_SIZE;
+    for (size_t i = 1; i < nr; i++)
+    {
+        if (pages[index + i] != pages[index] + i)
+            return false;
     }
+    return true;
+}
+
+static void __map_vm_range(mm_addr_t mm_addr, size_t size,
+                           pgprot_t prot, struct page **pages)
+{
+    struct pgwalk walk = {
+        .pml4 = init_mm.pml4,
+        .table_prot = prot.value,
+        .pte_prot = prot.value,
+        .alloc_table = vmap_alloc_table,
+        .next_frame = vmap_next_frame,
+        .huge = PGWALK_HUGE_2M,
+        .is_contig = vmap_is_contig,
+        .data = pages,
+    };
+
+    /* Os frames já foram alocados anteriormente e inseridos no vetor pages. */
+    pgwalk_map_range(&walk, mm_addr, mm_addr + size);
 }
 
 static void map_vm_range(mm_addr_t addr, size_t size, pgprot_t prot, struct page **pages)
@@ -225,54 +300,53 @@ static void map_vm_range(mm_addr_t addr, size_t size, pgprot_t prot, struct page
     __map_vm_range(addr, size, prot, pages);
     flush_tlb_range(addr, addr + size);
 }
-/* Somente limpa os entry no pagetable P1, mas não faz a exclusão dos pagetables. */
-static phys_addr_t unmap_frame(mm_addr_t addr)
+/* Somente limpa os entries, mas não faz a exclusão dos pagetables. Os pages de
+2MiB cobertos pela área são limpos num único entry. */
+static void unmap_vm_area(struct vm_struct *area)
 {
-    phys_addr_t pgframe = 0;
+    mm_addr_t addr = (mm_addr_t)area->addr;
+    size_t size = get_vm_area_size(area);
 
-    p4e_t *p4e = pgd_offset_k(addr);
-    if (!p3_present(p4e))
-    {
-        return pgframe;
-    }
+    pgwalk_clear_range(init_mm.pml4, addr, addr + size);
+}
 
-    p3e_t *p3e = p3_entry(p4e, addr);
-    if (!p2_present(p3e))
+/* Faz um único TLB shootdown para todas as áreas lazy e devolve as suas
+faixas virtuais aos índices. Devolve false se não havia áreas pendentes. */
+static bool vmap_purge_lazy(void)
+{
+    CREATE_LIST_HEAD(purge);
+    struct vmap_area *va = NULL;
+
+    spinlock_lock(&vmalloc_areas.vmlist_lock);
+    if (list_is_empty(&vmap_purge_list))
     {
-        return pgframe;
+        spinlock_unlock(&vmalloc_areas.vmlist_lock);
+        return false;
     }
-
-    p2e_t *p2e = p2_entry(p3e, addr);
-    if (!p1_present(p2e))
+    while (!list_is_empty(&vmap_purge_list))
     {
-        return pgframe;
+        va = list_entry(vmap_purge_list.next, struct vmap_area, purge_list);
+        list_del(&va->purge_list);
+        list_add_tail(&va->purge_list, &purge);
     }
+    vmap_lazy_nr = 0;
+    spinlock_unlock(&vmalloc_areas.vmlist_lock);
 
-    p1e_t *p1e = p1_entry(p2e, addr);
-    pgframe = p1e->p1e;
-    p1e->p1e = 0;
-
-    /* PageTable statistic. */
-    mm_tables_alloc_counter_dec(&init_mm.mm_pgtables, PFRAME_ID);
-    // WARN_ON("\naddr=%p", addr);
-
-    __vm_invlpg_tlb(addr);
-    return pgframe;
-}
-
-static void unmap_vm_area(struct vm_struct *area)
-{
-    size_t size = get_vm_area_size(area);
-    mm_addr_t addr = (mm_addr_t)area->addr;
-    mm_addr_t end = (addr + size);
-    mm_addr_t next = addr;
-    phys_addr_t frame;
+    /* Até aqui as faixas continuam reservadas nos índices. Após o shootdown,
+    nenhum core guarda traduções para elas. */
+    flush_tlb_all_cpus();
 
-    for (; next < end; next += PAGE_SIZE)
+    spinlock_lock(&vmalloc_areas.vmlist_lock);
+    while (!list_is_empty(&purge))
     {
-        frame = unmap_frame(next);
+        va = list_entry(purge.next, struct vmap_area, purge_list);
+        list_del(&va->purge_list);
+        vmap_area_release(va);
+        kmem_cache_free(vmap_area_cachep, va);
     }
-    flush_tlb_range((mm_addr_t)addr, end);
+    spinlock_unlock(&vmalloc_areas.vmlist_lock);
+
+    return true;
 }
 
 /**
@@ -286,23 +360,35 @@ static void unmap_vm_area(struct vm_struct *area)
  */
 static struct vm_struct *remove_vm_area(void *addr)
 {
-    struct vm_struct **p, *tmp;
+    struct vmap_area *va = NULL;
+    struct vm_struct *vm = NULL;
+    bool purge = false;
 
     spinlock_lock(&vmalloc_areas.vmlist_lock);
-    for (p = &vmalloc_areas.vmlist; (tmp = *p) != NULL; p = &tmp->next)
+
+    /* A sentinela e as áreas que aguardam o purge não têm vm_struct. */
+    va = vmap_find((mm_addr_t)addr);
+    if (va == NULL || va->vm == NULL)
     {
-        if (tmp->addr == addr)
-            goto found;
+        spinlock_unlock(&vmalloc_areas.vmlist_lock);
+        return NULL;
     }
-    spinlock_unlock(&vmalloc_areas.vmlist_lock);
-    return NULL;
 
-found:
-    unmap_vm_area(tmp);
-    *p = tmp->next;
+    vm = va->vm;
+    va->vm = NULL;
+    unmap_vm_area(vm);
+
+    /* A faixa virtual só é liberada no purge, após o TLB shootdown. */
+    list_add_tail(&va->purge_list, &vmap_purge_list);
+    vmap_lazy_nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+    purge = (vmap_lazy_nr >= VMAP_LAZY_MAX_PAGES);
 
     spinlock_unlock(&vmalloc_areas.vmlist_lock);
-    return tmp;
+
+    if (purge)
+        vmap_purge_lazy();
+
+    return vm;
 }
 
 static void __vunmap(void *addr, int deallocate_pages)
@@ -327,16 +413,8 @@ static void __vunmap(void *addr, int deallocate_pages)
 
     if (deallocate_pages)
     {
-        size_t nr_pages = area->nr_pages;
-
-        for (size_t i = 0; i < nr_pages; i++)
-        {
-            kprintf("\narea->pages=%p - order=%d", area->pages[i], area->pages[i]->level);
-            if (unlikely(!area->pages[i]))
-                WARN_ERROR("vunmap: page not allocated.");
-
-            free_pages(area->pages[i]);
-        }
+        /* Os frames voltam ao buddy num único lote. */
+        free_pages_bulk(area->pages, area->nr_pages);
 
         if (area->nr_pages > PAGE_SIZE / sizeof(struct page *))
             vfree(area->pages);
@@ -344,7 +422,7 @@ static void __vunmap(void *addr, int deallocate_pages)
             kfree(area->pages);
     }
 
-    kfree(area);
+    kmem_cache_free(vm_struct_cachep, area);
     return;
 }
 
@@ -362,6 +440,30 @@ void vmalloc_init(void)
     vmalloc_areas.init = true;
     vmalloc_areas.vmlist = NULL;
     spinlock_init(&vmalloc_areas.vmlist_lock);
+
+    /* A sentinela detém todo o espaço livre da faixa do vmalloc. */
+    vmap_addr_tree.root = NULL;
+    vmap_addr_tree.most_left = NULL;
+    vmap_gap_tree.root = NULL;
+    vmap_gap_tree.most_left = NULL;
+
+    vmap_sentinel.va_start = (mm_addr_t)vmalloc_areas.vm_start;
+    vmap_sentinel.va_end = vmap_sentinel.va_start;
+    vmap_sentinel.gap = (mm_addr_t)vmalloc_areas.vm_pend - (mm_addr_t)vmalloc_areas.vm_start;
+    vmap_sentinel.vm = NULL;
+
+    vmap_addr_insert(&vmap_sentinel);
+    vmap_gap_insert(&vmap_sentinel);
+}
+
+/* Executada em setup_heap(), logo após kmem_cache_init(). */
+void vmalloc_cache_init(void)
+{
+    vm_struct_cachep = kmem_cache_create("vm_struct", sizeof(struct vm_struct), 0, SLAB_HWCACHE_ALIGN, NULL);
+    vmap_area_cachep = kmem_cache_create("vmap_area", sizeof(struct vmap_area), 0, SLAB_HWCACHE_ALIGN, NULL);
+
+    if (vm_struct_cachep == NULL || vmap_area_cachep == NULL)
+        WARN_ERROR("vmalloc: falha ao criar os caches dos descritores de área.");
 }
 
 static void *alloc_vm_pages(struct vm_struct *area, gfp_t gfp_mask,
@@ -372,7 +474,6 @@ static void *alloc_vm_pages(struct vm_struct *area, gfp_t gfp_mask,
     size_t nr_pages = real_size >> PAGE_SHIFT;
     size_t array_size;
     struct page **pages;
-    struct page *page;
 
     array_size = (size_t)nr_pages * sizeof(struct page *);
 
@@ -391,66 +492,94 @@ static void *alloc_vm_pages(struct vm_struct *area, gfp_t gfp_mask,
     area->nr_pages = nr_pages;
     memset(area->pages, 0, array_size);
 
-    for (size_t i = 0; i < area->nr_pages; i++)
+    /* Numa área alinhada em 2MiB, cada trecho de 2MiB é um bloco de ordem
+    HUGE_PAGE_ORDER, mapeado com um único entry em P2. O bloco é dividido em
+    pages de ordem 0 para que a liberação continue sendo feita por page. */
+    area->nr_pages = 0;
+    if (is_aligned((mm_addr_t)area->addr, HUGE_PAGE_SIZE))
     {
-        page = alloc_page(GFP_ZONE_NORMAL);
-        if (unlikely(!page))
+        while (nr_pages - area->nr_pages >= (1UL << HUGE_PAGE_ORDER))
         {
-            /* Successfully allocated i pages, free them in __vfree() */
-            area->nr_pages = i;
-            // atomic_long_add(area->nr_pages, &nr_vmalloc_pages);
-            goto fail;
+            struct page *page = alloc_pages(gfp_mask, HUGE_PAGE_ORDER);
+            if (page == NULL)
+                break;
+
+            split_pages_block(page, HUGE_PAGE_ORDER);
+            for (size_t i = 0; i < (1UL << HUGE_PAGE_ORDER); i++)
+                pages[area->nr_pages++] = page + i;
         }
-        area->pages[i] = page;
-        // kprintf("\narea->pages=%p - order=%d", area->pages[i], area->pages[i]->level);
     }
 
+    /* O restante dos frames é obtido numa única transação com o buddy. */
+    area->nr_pages += alloc_pages_bulk(gfp_mask, nr_pages - area->nr_pages,
+                                       pages + area->nr_pages);
+    if (unlikely(area->nr_pages < nr_pages))
+        goto fail;
+
     return (virt_addr_t)area->addr;
 
 fail:
     WARN_ERROR("vmalloc: allocation failure: alocados %d de %d bytes", (area->nr_pages * PAGE_SIZE), area->size);
+
+    /* Devolve os frames obtidos, já que a área não será mapeada. */
+    free_pages_bulk(area->pages, area->nr_pages);
+    if (array_size > PAGE_SIZE)
+        vfree(area->pages);
+    else
+        kfree(area->pages);
+    area->pages = NULL;
+    area->nr_pages = 0;
     return NULL;
 }
 
-static inline struct vm_struct *find_next_free_area(size_t size, flags_t flags,
+static inline struct vm_struct *find_next_free_area(size_t size, size_t align, flags_t flags,
                                                     mm_addr_t start, mm_addr_t pend)
 {
-    struct vm_struct **p, *tmp, *area;
-    unsigned long align = 1;
-    mm_addr_t addr;
+    struct vm_struct *area = NULL;
+    struct vmap_area *va = NULL;
+    struct vmap_area *prev = NULL;
 
-    area = kzalloc(sizeof(*area), GFP_PLACEHOLD);
+    area = kmem_cache_alloc(vm_struct_cachep);
     if (unlikely(!area))
         return NULL;
+    memset(area, 0, sizeof(*area));
 
-    addr = ALIGN(start, align);
-
-    spinlock_lock(&vmalloc_areas.vmlist_lock);
-    for (p = &vmalloc_areas.vmlist; (tmp = *p) != NULL; p = &tmp->next)
+    va = kmem_cache_alloc(vmap_area_cachep);
+    if (unlikely(!va))
     {
-        if ((unsigned long)tmp->addr < addr)
-        {
-            if ((unsigned long)tmp->addr + tmp->size >= addr)
-                addr = ALIGN(tmp->size +
-                                 (unsigned long)tmp->addr,
-                             align);
-            continue;
-        }
-        if ((size + addr) < addr)
-            goto out;
-        if (size + addr <= (unsigned long)tmp->addr)
-            goto found;
-        addr = ALIGN(tmp->size + (unsigned long)tmp->addr, align);
-        if (addr > pend - size)
-            goto out;
+        kmem_cache_free(vm_struct_cachep, area);
+        return NULL;
     }
 
-found:
-    area->next = *p;
-    *p = area;
+    spinlock_lock(&vmalloc_areas.vmlist_lock);
+
+    /* O menor espaço livre que comporta a área, mesmo no pior alinhamento. A
+    nova área ocupa o primeiro endereço alinhado do espaço e herda o que sobrar
+    dele; o que ficar antes continua com o antecessor. */
+    prev = vmap_gap_find(size + align - PAGE_SIZE);
+    if (prev == NULL)
+        goto out;
+
+    va->va_start = align_up(prev->va_end, align);
+    va->va_end = va->va_start + size;
+    if (va->va_start < start || va->va_end > pend)
+        goto out;
 
+    va->gap = prev->gap - (va->va_end - prev->va_end);
+    va->vm = area;
+
+    vmap_gap_erase(prev);
+    prev->gap = va->va_start - prev->va_end;
+    vmap_gap_insert(prev);
+
+    vmap_addr_insert(va);
+    vmap_gap_insert(va);
+
+    vmalloc_areas.used_size += size;
+
+    area->next = NULL;
     area->flags = flags;
-    area->addr = (virt_addr_t)addr;
+    area->addr = (virt_addr_t)va->va_start;
     area->size = size;
     area->pages = NULL;
     area->nr_pages = 0;
@@ -462,8 +591,8 @@ found:
 
 out:
     spinlock_unlock(&vmalloc_areas.vmlist_lock);
-    kfree(area);
-    WARN_ERROR("vmalloc: allocation failure: %d bytes", size);
+    kmem_cache_free(vmap_area_cachep, va);
+    kmem_cache_free(vm_struct_cachep, area);
     return NULL;
 }
 
@@ -472,15 +601,25 @@ static struct vm_struct *get_vm_area(size_t size, flags_t flags)
     struct vm_struct *area = NULL;
     mm_addr_t start = vmalloc_areas.vm_start;
     mm_addr_t pend = vmalloc_areas.vm_pend;
+    size_t align = PAGE_SIZE;
 
     size = round_up(size, PAGE_SIZE);
     if (!size)
         return NULL;
 
+    /* Áreas de 2MiB ou mais são alinhadas para serem mapeadas com pages de
+    2MiB. */
+    if (size >= HUGE_PAGE_SIZE)
+        align = HUGE_PAGE_SIZE;
+
     if (!(flags & VM_NO_GUARD))
         size += PAGE_SIZE;
 
-    area = find_next_free_area(size, flags, start, pend);
+    area = find_next_free_area(size, align, flags, start, pend);
+
+    /* O espaço pode estar retido em áreas lazy. */
+    if (unlikely(!area) && vmap_purge_lazy())
+        area = find_next_free_area(size, align, flags, start, pend);
 
     if (unlikely(!area))
     {
@@ -505,7 +644,87 @@ static struct vm_struct *get_vm_area(size_t size, flags_t flags)
  * Return: the address of the area or %NULL on failure
  */
 
-static void *__vmalloc_range(size_t size, gfp_t gfp_mask, pgprot_t prot)
+/* Reserva o espaço virtual de uma área VM_LAZY. O vetor pages começa vazio e
+cada posição é preenchida por vmalloc_fault() no primeiro acesso ao page. */
+static void *__vmalloc_lazy_area(struct vm_struct *area, gfp_t gfp_mask, pgprot_t prot)
+{
+    size_t nr_pages = get_vm_area_size(area) >> PAGE_SHIFT;
+    size_t array_size = nr_pages * sizeof(struct page *);
+    struct vmap_area *va = NULL;
+    struct page **pages = NULL;
+
+    if (array_size > PAGE_SIZE)
+        pages = vmalloc(array_size);
+    else
+        pages = kmalloc(array_size);
+
+    if (!pages)
+        return NULL;
+
+    memset(pages, 0, array_size);
+
+    spinlock_lock(&vmalloc_areas.vmlist_lock);
+    va = vmap_find((mm_addr_t)area->addr);
+    va->gfp = gfp_mask;
+    va->prot = prot;
+    area->pages = pages;
+    area->nr_pages = nr_pages;
+    spinlock_unlock(&vmalloc_areas.vmlist_lock);
+
+    return (virt_addr_t)area->addr;
+}
+
+/**
+ * @brief Trata o page fault num endereço de uma área VM_LAZY: aloca um frame
+ * zerado e o mapeia no page do endereço.
+ *
+ * @param addr endereço que gerou o page fault(cr2).
+ * @return true se o page foi mapeado e a instrução pode ser repetida.
+ */
+bool vmalloc_fault(mm_addr_t addr)
+{
+    struct vmap_area *va = NULL;
+    struct vm_struct *vm = NULL;
+    struct page *page = NULL;
+    mm_addr_t vaddr = align_down(addr, PAGE_SIZE);
+    size_t idx = 0;
+
+    if (!vmalloc_areas.init || addr < (mm_addr_t)vmalloc_areas.vm_start ||
+        addr >= (mm_addr_t)vmalloc_areas.vm_pend)
+        return false;
+
+    spinlock_lock(&vmalloc_areas.vmlist_lock);
+
+    /* A área que contém o endereço é a última que inicia até ele. */
+    va = vmap_find_prev(addr + 1);
+    if (va == NULL || (vm = va->vm) == NULL || !(vm->flags & VM_LAZY) ||
+        addr >= va->va_start + get_vm_area_size(vm))
+    {
+        spinlock_unlock(&vmalloc_areas.vmlist_lock);
+        return false;
+    }
+
+    /* Outro core pode ter mapeado o page enquanto aguardávamos o lock. */
+    idx = (vaddr - va->va_start) >> PAGE_SHIFT;
+    if (vm->pages[idx] == NULL)
+    {
+        page = alloc_pages(va->gfp | __GFP_ZERO, 0);
+        if (page == NULL)
+        {
+            spinlock_unlock(&vmalloc_areas.vmlist_lock);
+            WARN_ERROR("vmalloc: VM_LAZY: sem memória para %p", addr);
+            return false;
+        }
+
+        kmap_frame((virt_addr_t)vaddr, page_to_phys(page), va->prot.value);
+        vm->pages[idx] = page;
+    }
+
+    spinlock_unlock(&vmalloc_areas.vmlist_lock);
+    return true;
+}
+
+static void *__vmalloc_range(size_t size, gfp_t gfp_mask, pgprot_t prot, flags_t flags)
 {
     struct vm_struct *area;
     size_t real_size = size;
@@ -518,24 +737,36 @@ static void *__vmalloc_range(size_t size, gfp_t gfp_mask, pgprot_t prot)
 
     size = round_up(size, PAGE_SIZE);
 
-    if (!size || (size >> PAGE_SHIFT) > node_free_pages())
+    if (!size || (!(flags & VM_LAZY) && (size >> PAGE_SHIFT) > node_free_pages()))
     {
         goto fail;
     }
 
     /* Faz a verdadeira alocação da área virtual. */
-    area = get_vm_area(real_size, VM_ALLOC);
+    area = get_vm_area(real_size, VM_ALLOC | flags);
     if (!area)
     {
         WARN_ERROR("vmalloc: __get_vm_area failure: area = %p", area);
         goto fail;
     }
 
+    /* Área sob demanda: nenhum frame é alocado agora. */
+    if (flags & VM_LAZY)
+    {
+        if (__vmalloc_lazy_area(area, gfp_mask, prot) == NULL)
+        {
+            remove_vm_area(area->addr);
+            kmem_cache_free(vm_struct_cachep, area);
+            return NULL;
+        }
+        return (virt_addr_t)area->addr;
+    }
+
     /* Aloca os frames para mapear o virtual range. */
     if (alloc_vm_pages(area, gfp_mask, prot) == NULL)
     {
         remove_vm_area(area->addr);
-        kfree(area);
+        kmem_cache_free(vm_struct_cachep, area);
         return NULL;
     }
     WARN_DEBUGING("Passei alloc_vm_pages.");
@@ -552,7 +783,7 @@ fail:
 
 void *__vmalloc(size_t size, gfp_t gfp_mask, pgprot_t prot)
 {
-    return __vmalloc_range(size, gfp_mask, prot);
+    return __vmalloc_range(size, gfp_mask, prot, 0);
 }
 
 /**
@@ -573,6 +804,53 @@ void *vmalloc(size_t size)
     return __vmalloc(size, GFP_ZONE_NORMAL, pgprot);
 }
 
+/**
+ * vzalloc - allocate virtually contiguous memory with zero fill
+ * @size:    allocation size
+ *
+ * Como vmalloc(), mas os frames são devolvidos zerados. Os pages isolados vêm
+ * do pool de pages zerados pelo idle task.
+ *
+ * Return: pointer to the allocated memory or %NULL on error
+ */
+void *vzalloc(size_t size)
+{
+    pgprot_t pgprot = {.value = pgprot_PW};
+    return __vmalloc(size, GFP_ZONE_NORMAL | __GFP_ZERO, pgprot);
+}
+
+/**
+ * vmalloc_stack - aloca uma stack de kernel ou de user mode
+ * @size:    allocation size
+ *
+ * Como vzalloc(), mas os frames recebem as próximas cores de cache do core
+ * (__GFP_COLOR). As stacks alocadas em sequência não disputam os mesmos sets
+ * do L2.
+ *
+ * Return: pointer to the allocated memory or %NULL on error
+ */
+void *vmalloc_stack(size_t size)
+{
+    pgprot_t pgprot = {.value = pgprot_PW};
+    return __vmalloc(size, GFP_ZONE_NORMAL | __GFP_ZERO | __GFP_COLOR, pgprot);
+}
+
+/**
+ * vmalloc_lazy - reserva uma área virtualmente contínua, mapeada sob demanda
+ * @size:    allocation size
+ *
+ * Somente o espaço virtual é reservado. Cada page recebe um frame zerado no
+ * primeiro acesso, pelo page fault handler. Adequado para buffers grandes e
+ * esparsos. A área é liberada com vfree().
+ *
+ * Return: pointer to the allocated memory or %NULL on error
+ */
+void *vmalloc_lazy(size_t size)
+{
+    pgprot_t pgprot = {.value = pgprot_PW};
+    return __vmalloc_range(size, GFP_ZONE_NORMAL, pgprot, VM_LAZY);
+}
+
 /**
  *	vfree  -  release memory allocated by vmalloc()
  *
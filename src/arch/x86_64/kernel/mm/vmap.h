@@ -0,0 +1,25 @@
+/*--------------------------------------------------------------------------
+*  File name:  vmap.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as extensões do vmalloc para áreas mapeadas sob demanda.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "mm/mm_types.h"
+
+/* Área do vmalloc que reserva o espaço virtual, mas só aloca e mapeia cada
+frame no primeiro acesso ao page(page fault). */
+#define VM_LAZY (1UL << 30)
+
+void *vzalloc(size_t size);
+void *vmalloc_stack(size_t size);
+void *vmalloc_lazy(size_t size);
+bool vmalloc_fault(mm_addr_t addr);
+void vmalloc_cache_init(void);
@@ -22,6 +22,9 @@ páginas físicas.
 #include "ktypes.h"
 #include "mm/zone.h"
 #include "mm/bootmem.h"
+#include "mm/pgwalk.h"
+#include "mm/pcid.h"
+#include "mm/gfp.h"
 
 /**
  * Recebe um endereço virtual  e devolve o endereço virtual da pagetable
@@ -193,6 +196,9 @@ void dump_page_entry(virt_addr_t vtable_address)
         }
     }
 }
+/* Proteção dos entries que apontam para pagetables(P4, P3 e P2). */
+#define KMAP_TABLE_PROT (PG_FLAG_P | PG_FLAG_W)
+
 static inline phys_addr_t map_p3(p4e_t *p4e, u64_t pg_flags)
 {
     phys_addr_t pgframe = 0;
@@ -205,8 +211,7 @@ static inline phys_addr_t map_p3(p4e_t *p4e, u64_t pg_flags)
     // Aloca um novo pageframe e insere seu endereço físico no entry
     else
     {
-        pgframe = alloc_pagetable();
-        clear_frame(phys_to_virt(pgframe));
+        pgframe = alloc_zeroed_pagetable();
         (*p4e).p4e = pgframe | pg_flags;
 
         /* PageTable statistic. */
@@ -226,8 +231,7 @@ static inline phys_addr_t map_p2(p3e_t *p3e, u64_t pg_flags)
     // Aloca um novo pageframe e insere seu endereço físico no entry
     else
     {
-        pgframe = alloc_pagetable();
-        clear_frame(phys_to_virt(pgframe));
+        pgframe = alloc_zeroed_pagetable();
         (*p3e).p3e = pgframe | pg_flags;
 
         /* PageTable statistic. */
@@ -247,8 +251,7 @@ static inline phys_addr_t map_p1(p2e_t *p2e, u64_t pg_flags)
     // Aloca um novo pageframe e insere seu endereço físico no entry
     else
     {
-        pgframe = alloc_pagetable();
-        clear_frame(phys_to_virt(pgframe));
+        pgframe = alloc_zeroed_pagetable();
         (*p2e).p2e = pgframe | pg_flags;
 
         /* PageTable statistic. */
@@ -316,7 +319,12 @@ virt_addr_t kmap_frame(virt_addr_t v_addr, phys_addr_t phys_addr, u64_t pgtable_
     // debug_pause("p1");
 
     p1e_t *p1e = kmap_tables_core(&init_mm, v_addr, pgtable_flags);
-    map_vmm_frame(p1e, phys_addr, pgtable_flags);
+
+    /* Os pages do kernel são globais. O bit G só é gravado no entry de P1. */
+    if ((mm_addr_t)v_addr >= PGWALK_KERNEL_START)
+        map_vmm_frame(p1e, phys_addr, pgtable_flags | PG_FLAG_G);
+    else
+        map_vmm_frame(p1e, phys_addr, pgtable_flags);
 
     // Invalido e atualizo a tlb
     __vm_invlpg_tlb((u64_t)v_addr);
@@ -337,6 +345,9 @@ phys_addr_t kunmap_frame(virt_addr_t v_addr)
         return pgframe;
     }
 
+    /* O page pode estar dentro de um page grande. */
+    pgwalk_split(pml4, (mm_addr_t)v_addr);
+
     // Mapeia um pagetable2 para a entrada no P3
     p3e_t *p3e = p3_entry(p4e, (u64_t)v_addr);
     if (!p2_present(p3e))
@@ -356,7 +367,12 @@ phys_addr_t kunmap_frame(virt_addr_t v_addr)
     pgframe = p1e->p1e;
     p1e->p1e = 0;
 
-    __vm_invlpg_tlb((u64_t)v_addr);
+    /* O invlpg descarta um page global em todos os PCIDs. Um page não global
+    pode estar na TLB sob outros PCIDs. */
+    if (pgframe & PG_FLAG_G)
+        __vm_invlpg_tlb((u64_t)v_addr);
+    else
+        pcid_flush_kernel_page((u64_t)v_addr);
     return pgframe;
 }
 
@@ -376,18 +392,27 @@ virt_addr_t kmap_tables_core(mm_struct_t *mm, virt_addr_t v_addr, u64_t pgtable_
 {
     virt_addr_t pml4 = init_mm.pml4;
 
+    /* Os entries de P4, P3 e P2 apontam para pagetables e não recebem os flags
+    do page: o bit 7(PAT em P1) é reservado em P4 e é o PS em P3 e P2, e os
+    bits PCD/PWT/G selecionariam o tipo de memória da própria pagetable. Só o
+    U é herdado, pois um page de usuário exige o U em todos os níveis. */
+    u64_t table_flags = KMAP_TABLE_PROT | (pgtable_flags & PG_FLAG_U);
+
     //*****************************
     // p4e_t *p4e = p4_entry(mm, (u64_t)v_addr);
     p4e_t *p4e = p4_entry(pml4, (u64_t)v_addr);
-    map_p3(p4e, pgtable_flags);
+    map_p3(p4e, table_flags);
+
+    /* O page pode estar dentro de um page grande. */
+    pgwalk_split(pml4, (mm_addr_t)v_addr);
 
     // Mapeia um pagetable2 para a entrada no P3
     p3e_t *p3e = p3_entry(p4e, (u64_t)v_addr);
-    map_p2(p3e, pgtable_flags);
+    map_p2(p3e, table_flags);
 
     // Mapeia um pagetable1 para a entrada no P2
     p2e_t *p2e = p2_entry(p3e, (u64_t)v_addr);
-    map_p1(p2e, pgtable_flags);
+    map_p1(p2e, table_flags);
 
     // Mapeio a entrada do PageTable.
     p1e_t *p1e = p1_entry(p2e, (u64_t)v_addr);
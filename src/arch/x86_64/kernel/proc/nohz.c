@@ -0,0 +1,134 @@
+/*--------------------------------------------------------------------------
+*  File name:  nohz.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Idle sem tick. O tick periódico do LAPIC timer só é útil quando o core tem
+tasks para alternar. Ao entrar no hlt com a runq vazia, o core troca o tick
+periódico por um único disparo(one-shot ou TSC-deadline), NOHZ_IDLE_MAX_NS à
+frente. Os timers do kernel(timer.c) e o jiffies são atendidos pela interrup-
+ção do HPET e não dependem do LAPIC timer. O core também acorda com o IPI de
+reschedule ou com qualquer outra interrupção.
+
+Ao sair do idle, o tick periódico volta e o contador de ticks do core recebe
+os ticks que não ocorreram. O vruntime é medido pelo sched_clock() e não
+precisa de correção.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "stdio.h"
+#include "task.h"
+#include "percpu.h"
+#include "smp.h"
+#include "runq.h"
+#include "scheduler.h"
+#include "smp/resched.h"
+#include "proc/sched_fair.h"
+#include "proc/nohz.h"
+
+struct tick_nohz
+{
+    bool stopped;        /* Tick periódico desligado. */
+    u64_t idle_start;    /* sched_clock() da entrada no idle sem tick. */
+    u64_t ticks;         /* Ticks do core, inclusive os compensados. */
+    u64_t nr_irqs;       /* Interrupções do LAPIC timer recebidas. */
+    u64_t nr_stops;      /* Entradas no idle sem tick. */
+    u64_t idle_ns;       /* Tempo total sem tick. */
+};
+
+static struct tick_nohz tick_nohz_cpu[MAX_CORES];
+
+static inline u64_t tick_period_ns(void)
+{
+    return (u64_t)SCHEDULER_SLICE_TIME * 1000000;
+}
+
+/* Chamada pelo handler do LAPIC timer. */
+void tick_account(void)
+{
+    struct tick_nohz *ts = &tick_nohz_cpu[cpu_id()];
+
+    ts->ticks++;
+    ts->nr_irqs++;
+}
+
+/**
+ * @brief Executada pelo idle task antes do hlt. Com a runq vazia e sem pedido
+ * de reschedule, desliga o tick periódico e programa um único disparo.
+ */
+void tick_nohz_idle_enter(void)
+{
+    u8_t cpu = cpu_id();
+    struct tick_nohz *ts = &tick_nohz_cpu[cpu];
+    struct runq *rq = get_runq_by_core(cpu);
+
+    if (ts->stopped || rq == NULL || rq->nr_threads != 0 || need_resched(cpu))
+        return;
+
+    preempt_disable();
+    ts->stopped = true;
+    ts->idle_start = sched_clock();
+    ts->nr_stops++;
+    lapic_timer_oneshot(NOHZ_IDLE_MAX_NS);
+    preempt_enable();
+
+    /* Um IPI de reschedule recebido com a preempção desligada não trocou o
+    task: religa o tick para não esperar o disparo único. */
+    if (need_resched(cpu))
+        tick_nohz_idle_exit();
+}
+
+/**
+ * @brief Religa o tick periódico e compensa os ticks que não ocorreram.
+ * Executada pelo idle task após o hlt e pelo scheduler(), pois a interrupção
+ * que acorda o core pode trocar o task antes de o idle task voltar a executar.
+ *
+ * @return true se o tick estava desligado.
+ */
+bool tick_nohz_idle_exit(void)
+{
+    struct tick_nohz *ts = NULL;
+    u64_t elapsed;
+
+    preempt_disable();
+
+    ts = &tick_nohz_cpu[cpu_id()];
+    if (!ts->stopped)
+    {
+        preempt_enable();
+        return false;
+    }
+
+    lapic_timer_periodic();
+    ts->stopped = false;
+
+    elapsed = sched_clock() - ts->idle_start;
+    ts->idle_ns += elapsed;
+    ts->ticks += elapsed / tick_period_ns();
+
+    preempt_enable();
+    return true;
+}
+
+void tick_nohz_show(void)
+{
+    struct tick_nohz *ts = NULL;
+    struct percpu *pcpu = NULL;
+
+    kprintf("\nNOHZ: LAPIC timer %s.", lapic_has_tsc_deadline() ? "TSC-deadline" : "one-shot");
+
+    for (size_t i = 0; i < smp_nr_cpus(); i++)
+    {
+        pcpu = percpu_by_core(i);
+        if (pcpu->cpu_id != i)
+            continue;
+
+        ts = &tick_nohz_cpu[i];
+        kprintf("\nCPU[ %d ]: ticks=%d - irqs=%d - idle sem tick=%d vezes, %d ms", i, ts->ticks, ts->nr_irqs,
+                ts->nr_stops, ts->idle_ns / 1000000);
+    }
+}
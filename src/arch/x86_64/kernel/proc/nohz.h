@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------------
+*  File name:  nohz.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas do idle sem tick(dynamic ticks): o core ocioso
+desliga o tick periódico do LAPIC timer e programa um único disparo.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+
+/* Intervalo máximo sem tick de um core ocioso. Ao acordar, ele faz o balancea-
+mento ocioso(runq_balance). */
+#define NOHZ_IDLE_MAX_NS 64000000ULL
+
+/* CPUID.01H:ECX[24] - modo TSC-deadline do LAPIC timer. */
+#define CPUID_ECX_TSC_DEADLINE (1U << 24)
+#define MSR_IA32_TSC_DEADLINE 0x6E0
+
+/* Modo do LAPIC timer, bits 17-18 do LVT timer. */
+#define LAPIC_TIMER_ONESHOT (0U << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2U << 17)
+
+void tick_nohz_idle_enter(void);
+bool tick_nohz_idle_exit(void);
+void tick_account(void);
+void tick_nohz_show(void);
+
+/* LAPIC timer(lapic.c). */
+bool lapic_has_tsc_deadline(void);
+void lapic_timer_oneshot(u64_t ns);
+void lapic_timer_periodic(void);
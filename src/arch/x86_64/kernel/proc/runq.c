@@ -6,6 +6,7 @@
  *  Rotina principal de entrada no kernel.
  *--------------------------------------------------------------------------*/
 #include "list.h"
+#include "debug.h"
 #include "percpu.h"
 #include "task.h"
 #include "rbtree.h"
@@ -15,6 +16,57 @@
 #include "scheduler.h"
 #include "lapic.h"
 #include "runq.h"
+#include "proc/runq_prio.h"
+#include "proc/sched_fair.h"
+#include "smp/resched.h"
+#include "mm/slab.h"
+
+/*
+Scheduler O(1). Cada core tem dois prio_array_t: o active, de onde saem os
+tasks para execução, e o expired, que recebe os tasks que esgotaram o time-
+slice. Quando o active esvazia, os dois trocam de papel. Cada array tem um bit
+por prioridade com tasks, e o próximo task é o primeiro da fila do primeiro
+bit ligado(bsf), qualquer que seja a quantidade de tasks.
+
+O struct runq só tem um array(rq->arrays); o segundo array, os bitmaps e os
+ponteiros active/expired ficam em runq_prios, indexado pelo core.
+
+Os tasks da classe fair(sched_fair.c) ficam numa rbtree do core, protegida
+pelo mesmo lock da runq. A classe de prioridades é atendida primeiro.
+*/
+struct runq_prio
+{
+    prio_array_t *active;
+    prio_array_t *expired;
+    prio_array_t spare; /* O outro array é o rq->arrays. */
+    u64_t bitmap[2][PRIO_BITMAP_WORDS];
+    u64_t nr_swaps; /* Trocas entre active e expired. */
+    struct task *curr; /* Task escolhido pelo último runq_next(). */
+};
+
+static struct runq_prio runq_prios[MAX_CORES];
+
+/* Cache das runqs, criado pelo BSP em sched_setup(), antes do runq_init() de
+qualquer core. */
+static kmem_cache_t *runq_cachep = NULL;
+
+void runq_cache_init(void)
+{
+    runq_cachep = kmem_cache_create("runq", sizeof(struct runq), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (runq_cachep == NULL)
+        WARN_ERROR("runq: falha ao criar o cache das runqs.");
+}
+
+/* O idle task nunca muda de core: o seu cpu identifica a fila. */
+static inline struct runq_prio *runq_prio_of(struct runq *rq)
+{
+    return &runq_prios[get_task_cpu(rq->idle)];
+}
+
+static inline u64_t *array_bitmap(struct runq_prio *rp, prio_array_t *array)
+{
+    return rp->bitmap[array == &rp->spare];
+}
 
 /*
 A Estrutura RUNQ possui um campo chamado "idle" que deve aponta para uma
@@ -24,13 +76,20 @@ ATENÇÃO: Esta rotina deve ser chamada uma única vez por cada CORE.
 */
 void runq_init(struct task *idle)
 {
-    struct runq *rq = kmalloc(sizeof(struct runq));
+    struct runq *rq = kmem_cache_alloc(runq_cachep);
+    struct runq_prio *rp = &runq_prios[percpu_cpu_id()];
     memset(rq, 0, sizeof(struct runq));
+    memset(rp, 0, sizeof(struct runq_prio));
 
     for (int i = 0; i <= MAX_PRIO; i++)
     {
         init_list_head(&rq->arrays.queue[i]);
+        init_list_head(&rp->spare.queue[i]);
     }
+    rp->active = &rq->arrays;
+    rp->expired = &rp->spare;
+
+    fair_rq_init(percpu_cpu_id());
 
     /* Atribuimos a nova fila de execução ao PERCPU do core que está
     executando o código. percpu->run_queue(struct runq *run_queue). */
@@ -52,19 +111,18 @@ void runq_init(struct task *idle)
 /*
  * Adding/removing a task to/from a priority array:
  */
-static void dequeue_task(struct task *p, prio_array_t *array)
+static void dequeue_task(struct runq_prio *rp, struct task *p, prio_array_t *array)
 {
     array->nr_active--;
     list_del(&p->run_list);
-    // if (list_empty(array->queue + p->priority))
-    //     __clear_bit(p->priority, array->bitmap);
+    if (list_is_empty(array->queue + p->priority))
+        prio_bitmap_clear(array_bitmap(rp, array), p->priority);
 }
 
-static void enqueue_task(struct task *p, prio_array_t *array)
+static void enqueue_task(struct runq_prio *rp, struct task *p, prio_array_t *array)
 {
-    // sched_info_queued(p);
     list_add_tail(&p->run_list, array->queue + p->priority);
-    //__set_bit(p->prio, array->bitmap);
+    prio_bitmap_set(array_bitmap(rp, array), p->priority);
     array->nr_active++;
     p->array = array;
 }
@@ -76,20 +134,74 @@ static void requeue_task(struct task *p, prio_array_t *array)
 {
     list_move_tail(&p->run_list, array->queue + p->priority);
 }
-/* Procura a primeira fila no array que possui tasks. */
-int runq_find_first_queue(struct runq *rq)
-{
-    struct list_head *head = NULL;
 
-    for (size_t i = 0; i < MAX_PRIO; i++)
+/* Prioridade dinâmica: cada timeslice esgotado rebaixa o task um nível, até
+LOW_PRIO, quando ele volta à prioridade estática. Chamada com o task fora das
+filas, pois a prioridade indexa a fila. */
+static void recalc_priority(task_t *t)
+{
+    if (t->priority < LOW_PRIO)
     {
-        head = &rq->arrays.queue[i];
-        if (!list_is_empty(head))
-        {
-            return i;
-        }
+        t->priority++;
+    }
+    else
+    {
+        t->priority = t->static_priority;
     }
-    return -1;
+}
+
+static inline void runq_stamp(struct task *t, u64_t now)
+{
+    struct sched_entity *se = task_se(t);
+    if (se != NULL)
+        se->last_ran = now;
+}
+
+/**
+ * @brief Executada por __switch_to(), já na stack do próximo task e com as
+ * interrupções desabilitadas. A partir daqui, este core não usa mais a stack
+ * de 'prev', que pode ser migrado por outro core.
+ *
+ * @param prev
+ */
+void sched_finish_switch(struct task *prev)
+{
+    struct sched_entity *se = NULL;
+
+    /* O task continuou no core. */
+    if (prev == percpu_current())
+        return;
+
+    se = task_se(prev);
+    if (se != NULL)
+        __atomic_store_n(&se->on_cpu, false, __ATOMIC_RELEASE);
+}
+
+/* Indica se o task 't', que acabou de entrar na runq do core 'cpu', deve tomar
+o core do task em execução. A classe de prioridades vem antes da fair. Com o
+lock da runq. */
+static bool runq_check_preempt(u8_t cpu, struct runq *rq, struct task *t)
+{
+    struct task *curr = runq_prios[cpu].curr;
+
+    if (curr == NULL || curr == rq->idle)
+        return true;
+
+    if (task_is_fair(t) != task_is_fair(curr))
+        return !task_is_fair(t);
+
+    if (!task_is_fair(t))
+        return (t->priority < curr->priority);
+
+    return fair_wakeup_preempt(t, curr);
+}
+
+/* Procura a primeira fila do array active que possui tasks. */
+int runq_find_first_queue(struct runq *rq)
+{
+    struct runq_prio *rp = runq_prio_of(rq);
+
+    return prio_find_first(array_bitmap(rp, rp->active));
 }
 void runq_requeue(struct task *t, u8_t cpu)
 {
@@ -100,7 +212,41 @@ void runq_requeue(struct task *t, u8_t cpu)
     /* Faz um lock. */
     struct runq *rq = task_runq_lock(t);
 
-    requeue_task(t, t->array);
+    if (task_is_fair(t))
+        fair_requeue(cpu, t);
+    else
+        requeue_task(t, t->array);
+
+    /* Faz unlock. */
+    task_runq_unlock(rq);
+}
+
+/**
+ * @brief Chamada quando o task esgota o timeslice: recalcula a prioridade e
+ * move o task para o array expired, onde fica até o active esvaziar. Na classe
+ * fair, apenas atualiza o vruntime do task.
+ *
+ * @param t
+ * @param cpu
+ */
+void runq_expire(struct task *t, u8_t cpu)
+{
+    set_task_cpu(t, cpu);
+
+    /* Faz um lock. */
+    struct runq *rq = task_runq_lock(t);
+    struct runq_prio *rp = runq_prio_of(rq);
+
+    if (task_is_fair(t))
+    {
+        fair_requeue(cpu, t);
+    }
+    else
+    {
+        dequeue_task(rp, t, t->array);
+        recalc_priority(t);
+        enqueue_task(rp, t, rp->expired);
+    }
 
     /* Faz unlock. */
     task_runq_unlock(rq);
@@ -108,44 +254,77 @@ void runq_requeue(struct task *t, u8_t cpu)
 
 void runq_add(struct task *t, u8_t cpu)
 {
+    bool preempt = false;
+
     /* Essa atribuição é essencial, pois grava no task o CORE da runqueue. */
     set_task_cpu(t, cpu);
 
+    /* A sched_entity é criada fora do lock. */
+    sched_entity_get(t);
+
     /* Faz um lock. */
     struct runq *rq = task_runq_lock(t);
 
-    set_task_array(t, rq);
     rq->nr_threads++;
-    enqueue_task(t, t->array);
+    if (task_is_fair(t))
+        fair_enqueue(cpu, t);
+    else
+        enqueue_task(runq_prio_of(rq), t, runq_prio_of(rq)->active);
+
+    preempt = runq_check_preempt(cpu, rq, t);
 
     /* Faz unlock. */
     task_runq_unlock(rq);
+
+    /* O core de destino é avisado na hora, e não no próximo tick. */
+    if (preempt)
+        resched_cpu(cpu);
 }
 
-// Pops the next task from the rbtree
+/* Devolve o primeiro task da fila de maior prioridade do array active, sem
+retirá-lo da fila. Com o active vazio, os arrays trocam de papel. Sem tasks na
+classe de prioridades, devolve o task mais à esquerda da classe fair. */
 struct task *runq_next(u8_t cpu)
 {
     struct runq *rq = get_runq_by_core(cpu);
-    prio_array_t *array = &rq->arrays;
-    task_t *next = NULL;
-    int idx = runq_find_first_queue(rq);
+    struct runq_prio *rp = runq_prio_of(rq);
+    prio_array_t *array = NULL;
+    task_t *next = rq->idle;
+    task_t *fair = NULL;
+    u64_t now = sched_clock();
+    int idx;
+
+    __spin_lock(&rq->lock.key);
 
-    if (idx < 0)
+    if (rp->active->nr_active == 0 && rp->expired->nr_active > 0)
     {
-        return rq->idle;
+        array = rp->active;
+        rp->active = rp->expired;
+        rp->expired = array;
+        rp->nr_swaps++;
     }
-    struct list_head *head = array->queue + idx;
 
-    if (list_is_empty(head))
+    idx = prio_find_first(array_bitmap(rp, rp->active));
+    if (idx >= 0)
     {
-        next = rq->idle;
+        next = list_entry(rp->active->queue[idx].next, task_t, run_list);
     }
-    else
+    else if ((fair = fair_pick_next(cpu)) != NULL)
     {
-        next = list_entry(head->next, task_t, run_list);
-        // kprintf("\ncpu[ %d ]: PID[ %d ] = next=%p - IDX=%d", cpu, next->pid, next, idx);
+        next = fair;
     }
 
+    /* Marca o task que deixa o core e o que entra, para o balanceamento. O
+    task escolhido só pode ser migrado depois que outro o substituir no core e
+    o __switch_to() terminar(sched_finish_switch). */
+    runq_stamp(percpu_current(), now);
+    runq_stamp(next, now);
+    if (task_se(next) != NULL)
+        task_se(next)->on_cpu = true;
+    rp->curr = next;
+
+    __spin_unlock(&rq->lock.key);
+
     return next;
 }
 
@@ -155,8 +334,273 @@ void runq_remove(struct task *t)
     struct runq *rq = task_runq_lock(t);
 
     rq->nr_threads--;
-    dequeue_task(t, t->array);
+    if (task_is_fair(t))
+        fair_dequeue(get_task_cpu(t), t);
+    else
+        dequeue_task(runq_prio_of(rq), t, t->array);
 
     /* Faz unlock. */
     task_runq_unlock(rq);
 }
+
+/*--------------------------------------------------------------------------
+Balanceamento(work stealing). O core puxa tasks da runq com mais threads sem-
+pre que fica ocioso e, nos demais casos, a cada BALANCE_INTERVAL_NS. As duas
+runqs são travadas em ordem crescente de core: dois cores que balanceiam um
+contra o outro nunca esperam pelo lock que o outro já detém.
+
+Um task que deixou o core há menos de SCHED_MIGRATION_COST_NS ainda tem os seus
+dados no cache do core e não é migrado(cache-hot). Após BALANCE_HOT_TRIES ten-
+tativas seguidas sem sucesso, os tasks cache-hot também são aceitos.
+
+Nunca é migrado um task com o flag on_cpu: ele está em execução na origem ou
+a troca de contexto que o tira do core ainda salva os seus registros na sua
+stack.
+--------------------------------------------------------------------------*/
+struct runq_balance_stats
+{
+    u64_t last_balance;    /* sched_clock() do último balanceamento. */
+    u64_t nr_balance;      /* Tentativas. */
+    u64_t nr_idle_balance; /* Tentativas com o core ocioso. */
+    u64_t nr_pulled;       /* Tasks migrados para este core. */
+    u64_t nr_hot;          /* Candidatos recusados por serem cache-hot. */
+    u64_t nr_failed;       /* Tentativas com desequilíbrio e sem task migrável. */
+    u32_t failed_seq;      /* Falhas consecutivas. */
+};
+
+static struct runq_balance_stats balance_stats[MAX_CORES];
+
+static void double_runq_lock(struct runq *rq1, u8_t cpu1, struct runq *rq2, u8_t cpu2)
+{
+    if (cpu1 < cpu2)
+    {
+        __spin_lock(&rq1->lock.key);
+        __spin_lock(&rq2->lock.key);
+    }
+    else
+    {
+        __spin_lock(&rq2->lock.key);
+        __spin_lock(&rq1->lock.key);
+    }
+}
+
+static void double_runq_unlock(struct runq *rq1, struct runq *rq2)
+{
+    __spin_unlock(&rq1->lock.key);
+    __spin_unlock(&rq2->lock.key);
+}
+
+/* Core com mais threads na runq, exceto 'cpu'. Devolve 'cpu' se não houver. */
+static u8_t find_busiest_cpu(u8_t cpu, size_t *nr)
+{
+    struct percpu *pcpu = NULL;
+    u8_t busiest = cpu;
+    size_t max = 0;
+
+    for (size_t i = 0; i < smp_nr_cpus(); i++)
+    {
+        pcpu = percpu_by_core(i);
+
+        /* Core ainda sem runq(antes do runq_init). */
+        if (i == cpu || pcpu->cpu_id != i || pcpu->run_queue == NULL)
+            continue;
+
+        if (pcpu->run_queue->nr_threads > max)
+        {
+            max = pcpu->run_queue->nr_threads;
+            busiest = i;
+        }
+    }
+    *nr = max;
+    return busiest;
+}
+
+static bool can_migrate_task(struct task *t, u8_t src, u64_t now, bool allow_hot,
+                             struct runq_balance_stats *st)
+{
+    struct sched_entity *se = task_se(t);
+    int64_t idle;
+
+    if (se == NULL || t == runq_prios[src].curr || t == percpu_by_core(src)->current_task)
+        return false;
+
+    if (__atomic_load_n(&se->on_cpu, __ATOMIC_ACQUIRE))
+        return false;
+
+    /* O tempo desde a última execução só decide se o task é cache-hot. */
+    idle = (int64_t)(now - se->last_ran);
+
+    if (idle < (int64_t)SCHED_MIGRATION_COST_NS && !allow_hot)
+    {
+        st->nr_hot++;
+        return false;
+    }
+    return true;
+}
+
+/* Escolhe até 'max' tasks migráveis da runq de 'src': primeiro os do array
+expired da classe de prioridades, que são os que mais vão esperar, depois os
+do active e, por fim, os da classe fair. */
+static size_t collect_tasks(u8_t src, u64_t now, bool allow_hot, struct runq_balance_stats *st,
+                            struct task **cand, size_t max)
+{
+    struct runq_prio *rp = &runq_prios[src];
+    prio_array_t *arrays[2] = {rp->expired, rp->active};
+    struct list_head *p = NULL;
+    struct task *t = NULL;
+    size_t scanned = 0;
+    size_t n = 0;
+    int idx;
+
+    for (size_t a = 0; a < 2; a++)
+    {
+        u64_t bitmap[PRIO_BITMAP_WORDS];
+        memcpy(bitmap, array_bitmap(rp, arrays[a]), sizeof(bitmap));
+
+        while (n < max && scanned < BALANCE_MAX_SCAN && (idx = prio_find_first(bitmap)) >= 0)
+        {
+            prio_bitmap_clear(bitmap, idx);
+            list_for_each(p, &arrays[a]->queue[idx])
+            {
+                if (n >= max || scanned++ >= BALANCE_MAX_SCAN)
+                    break;
+
+                t = list_entry(p, task_t, run_list);
+                if (can_migrate_task(t, src, now, allow_hot, st))
+                    cand[n++] = t;
+            }
+        }
+    }
+
+    for (t = fair_next_task(src, NULL); t != NULL && n < max && scanned < BALANCE_MAX_SCAN;
+         t = fair_next_task(src, t), scanned++)
+    {
+        if (can_migrate_task(t, src, now, allow_hot, st))
+            cand[n++] = t;
+    }
+    return n;
+}
+
+/* Move o task da runq de 'src' para a de 'dst'. As duas runqs estão travadas. */
+static void move_task(struct task *t, struct runq *src_rq, u8_t src, struct runq *dst_rq, u8_t dst)
+{
+    struct runq_prio *src_rp = &runq_prios[src];
+    struct runq_prio *dst_rp = &runq_prios[dst];
+    bool expired = false;
+
+    if (task_is_fair(t))
+    {
+        /* Fora da árvore, o vruntime fica relativo ao min_vruntime da origem. */
+        fair_dequeue(src, t);
+        set_task_cpu(t, dst);
+        fair_enqueue(dst, t);
+    }
+    else
+    {
+        expired = (t->array == src_rp->expired);
+        dequeue_task(src_rp, t, t->array);
+        set_task_cpu(t, dst);
+        enqueue_task(dst_rp, t, expired ? dst_rp->expired : dst_rp->active);
+    }
+
+    src_rq->nr_threads--;
+    dst_rq->nr_threads++;
+}
+
+/**
+ * @brief Puxa para a runq do core 'cpu' metade da diferença entre a runq mais
+ * carregada e a sua. Executada pelo próprio core, com a preempção desativada.
+ *
+ * @param cpu
+ * @return size_t número de tasks migrados.
+ */
+size_t runq_balance_pull(u8_t cpu)
+{
+    struct runq_balance_stats *st = &balance_stats[cpu];
+    struct runq *dst_rq = get_runq_by_core(cpu);
+    struct runq *src_rq = NULL;
+    struct task *cand[BALANCE_MAX_MOVE];
+    size_t src_nr, nr_move;
+    size_t n = 0;
+    u64_t now = sched_clock();
+    u8_t src;
+
+    st->nr_balance++;
+
+    src = find_busiest_cpu(cpu, &src_nr);
+    if (src == cpu || src_nr < dst_rq->nr_threads + 2)
+    {
+        st->failed_seq = 0;
+        return 0;
+    }
+    src_rq = get_runq_by_core(src);
+
+    double_runq_lock(dst_rq, cpu, src_rq, src);
+
+    /* As runqs podem ter mudado até o lock. */
+    if (src_rq->nr_threads >= dst_rq->nr_threads + 2)
+    {
+        nr_move = (src_rq->nr_threads - dst_rq->nr_threads) / 2;
+        if (nr_move > BALANCE_MAX_MOVE)
+            nr_move = BALANCE_MAX_MOVE;
+
+        n = collect_tasks(src, now, st->failed_seq >= BALANCE_HOT_TRIES, st, cand, nr_move);
+        for (size_t i = 0; i < n; i++)
+            move_task(cand[i], src_rq, src, dst_rq, cpu);
+    }
+
+    double_runq_unlock(dst_rq, src_rq);
+
+    if (n == 0)
+    {
+        st->nr_failed++;
+        st->failed_seq++;
+    }
+    else
+    {
+        st->nr_pulled += n;
+        st->failed_seq = 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Chamada pelo scheduler() a cada troca de contexto. O core ocioso
+ * balanceia sempre; os demais, a cada BALANCE_INTERVAL_NS.
+ *
+ * @param cpu
+ * @param idle
+ * @return size_t número de tasks migrados.
+ */
+size_t runq_balance(u8_t cpu, bool idle)
+{
+    struct runq_balance_stats *st = &balance_stats[cpu];
+    u64_t now = sched_clock();
+
+    if (!idle && (now - st->last_balance) < BALANCE_INTERVAL_NS)
+        return 0;
+
+    if (idle)
+        st->nr_idle_balance++;
+
+    st->last_balance = now;
+    return runq_balance_pull(cpu);
+}
+
+void runq_balance_show(void)
+{
+    struct runq_balance_stats *st = NULL;
+    struct percpu *pcpu = NULL;
+
+    for (size_t i = 0; i < smp_nr_cpus(); i++)
+    {
+        pcpu = percpu_by_core(i);
+        if (pcpu->cpu_id != i || pcpu->run_queue == NULL)
+            continue;
+
+        st = &balance_stats[i];
+        kprintf("\nCPU[ %d ]: threads=%d - balance=%d(idle=%d) - pulled=%d - hot=%d - failed=%d", i,
+                pcpu->run_queue->nr_threads, st->nr_balance, st->nr_idle_balance, st->nr_pulled, st->nr_hot,
+                st->nr_failed);
+    }
+}
@@ -0,0 +1,59 @@
+/*--------------------------------------------------------------------------
+*  File name:  runq_prio.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune o mapa de prioridades da fila de execução de cada core e
+as rotinas dos arrays active/expired do scheduler O(1).
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "task.h"
+#include "runq.h"
+
+/* Um bit por fila do prio_array_t(0..MAX_PRIO). */
+#define PRIO_BITMAP_WORDS ((MAX_PRIO + 1 + 63) / 64)
+
+static inline void prio_bitmap_set(u64_t *bitmap, size_t prio)
+{
+    bitmap[prio / 64] |= (1ULL << (prio % 64));
+}
+
+static inline void prio_bitmap_clear(u64_t *bitmap, size_t prio)
+{
+    bitmap[prio / 64] &= ~(1ULL << (prio % 64));
+}
+
+/* Devolve a primeira prioridade com tasks no mapa, ou -1. O número de palavras
+é fixo: o custo não depende da quantidade de tasks nem de prioridades em uso. */
+static inline int prio_find_first(const u64_t *bitmap)
+{
+    for (size_t w = 0; w < PRIO_BITMAP_WORDS; w++)
+    {
+        if (bitmap[w])
+            return (w * 64) + __builtin_ctzll(bitmap[w]);
+    }
+    return -1;
+}
+
+/* Balanceamento entre as runqs dos cores. */
+#define BALANCE_INTERVAL_NS 4000000ULL
+#define SCHED_MIGRATION_COST_NS 500000ULL /* Abaixo disso, o task é cache-hot. */
+#define BALANCE_HOT_TRIES 4
+#define BALANCE_MAX_SCAN 32
+#define BALANCE_MAX_MOVE 8
+
+void runq_cache_init(void);
+int runq_find_first_queue(struct runq *rq);
+void runq_expire(struct task *t, u8_t cpu);
+
+void sched_finish_switch(struct task *prev);
+
+size_t runq_balance_pull(u8_t cpu);
+size_t runq_balance(u8_t cpu, bool idle);
+void runq_balance_show(void);
@@ -0,0 +1,452 @@
+/*--------------------------------------------------------------------------
+*  File name:  sched_fair.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Classe de scheduling fair. Cada task acumula em sched.vruntime o seu tempo de
+execução em nanossegundos, dividido pelo seu peso(nice) e multiplicado pelo
+peso do nice 0. Cada core mantém os seus tasks numa rbtree ordenada pelo
+vruntime e executa sempre o mais à esquerda(most_left, guardado pela própria
+rbtree), isto é, o que recebeu menos CPU em relação ao seu peso.
+
+O task em execução continua na árvore: a cada troca de contexto, o seu vrun-
+time é atualizado e ele é reposicionado. O timer preempta o task quando ele
+esgota o seu slice, a fração do período SCHED_LATENCY_NS proporcional ao seu
+peso. Assim, com N tasks prontos, nenhum espera mais de um período.
+
+O relógio é o TSC calibrado pelo HPET, quando o TSC é invariante; caso con-
+trário, o próprio main counter do HPET.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "debug.h"
+#include "stdio.h"
+#include "string.h"
+#include "rbtree.h"
+#include "task.h"
+#include "percpu.h"
+#include "smp.h"
+#include "hpet.h"
+#include "runq.h"
+#include "mm/kmalloc.h"
+#include "mm/vmap.h"
+#include "../../drivers/time/tsc.h"
+#include "proc/sched_fair.h"
+
+/* Peso de cada nice(-20..19). A razão entre pesos vizinhos é ~1,25: cada nível
+de nice muda ~10% da CPU recebida pelo task. */
+static const u32_t nice_to_weight[40] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+struct fair_rq
+{
+    struct rbtree tasks; /* tasks.most_left: próximo task. */
+    u64_t min_vruntime;  /* Cresce sempre: base dos tasks que entram na fila. */
+    u64_t load;          /* Soma dos pesos dos tasks na árvore. */
+    u32_t nr_running;
+};
+
+static struct fair_rq fair_rqs[MAX_CORES];
+
+/* sched_entity de cada task, indexada pelo pid. Criada na primeira entrada do
+task numa run queue. */
+static struct sched_entity **fair_se = NULL;
+
+static bool sched_clock_tsc = false;
+static u64_t sched_clock_mult = 0; /* ns por ciclo do TSC, em ponto fixo 32.32. */
+static u64_t sched_clock_tsc_base = 0;
+
+/* Ticks do HPET para ns. O período do HPET é informado em femtossegundos. */
+static inline u64_t hpet_ticks_to_ns(u64_t ticks)
+{
+    u64_t period = hpet_clk_periodo();
+    return ((ticks / 1000000) * period) + (((ticks % 1000000) * period) / 1000000);
+}
+
+/**
+ * @brief Calibra o TSC pelo HPET. Executada pelo BSP, após o time_init().
+ */
+void sched_clock_init(void)
+{
+    u64_t hpet_start, hpet_end, tsc_start, tsc_end, ns;
+
+    if (!is_tsc_present() || !is_tsc_invariant())
+    {
+        kprintf("\nSCHED: clock pelo HPET(TSC não invariante).");
+        return;
+    }
+
+    hpet_start = hpet_main_counter();
+    tsc_start = tsc_read();
+    hpet_sleep_milli(SCHED_CLOCK_CALIBRATE_MS);
+    hpet_end = hpet_main_counter();
+    tsc_end = tsc_read();
+
+    ns = hpet_ticks_to_ns(hpet_end - hpet_start);
+    if (tsc_end <= tsc_start || ns == 0)
+        return;
+
+    sched_clock_mult = (ns << 32) / (tsc_end - tsc_start);
+    sched_clock_tsc_base = tsc_end;
+    sched_clock_tsc = true;
+
+    kprintf("\nSCHED: clock pelo TSC - %d ciclos em %d ns.", tsc_end - tsc_start, ns);
+}
+
+/* Nanossegundos desde a calibração. Só as diferenças entre duas leituras do
+mesmo core têm significado. */
+u64_t sched_clock(void)
+{
+    if (sched_clock_tsc)
+        return (u64_t)(((unsigned __int128)(tsc_read() - sched_clock_tsc_base) * sched_clock_mult) >> 32);
+
+    return hpet_ticks_to_ns(hpet_main_counter());
+}
+
+/* Ciclos do TSC em 'ns' nanossegundos, ou 0 se o clock não usa o TSC. */
+u64_t sched_clock_cycles(u64_t ns)
+{
+    if (!sched_clock_tsc || sched_clock_mult == 0)
+        return 0;
+    return (u64_t)(((unsigned __int128)ns << 32) / sched_clock_mult);
+}
+
+void sched_fair_init(void)
+{
+    fair_se = vzalloc(PID_MAX * sizeof(struct sched_entity *));
+    if (fair_se == NULL)
+        WARN_ERROR("sched: sem memória para as entidades da classe fair.");
+
+    sched_clock_init();
+}
+
+/* Executada uma única vez por core, em runq_init(). */
+void fair_rq_init(u8_t cpu)
+{
+    struct fair_rq *frq = &fair_rqs[cpu];
+
+    frq->tasks.root = NULL;
+    frq->tasks.most_left = NULL;
+    frq->min_vruntime = 0;
+    frq->load = 0;
+    frq->nr_running = 0;
+}
+
+struct sched_entity *task_se(struct task *t)
+{
+    if (fair_se == NULL)
+        return NULL;
+    return fair_se[t->pid];
+}
+
+/**
+ * @brief Devolve a sched_entity do task, criando-a com nice 0 na classe fair.
+ * Não pode ser chamada com o lock da runq, por conta do kmalloc.
+ *
+ * @param t
+ * @return struct sched_entity*
+ */
+struct sched_entity *sched_entity_get(struct task *t)
+{
+    struct sched_entity *se = task_se(t);
+
+    if (se != NULL || fair_se == NULL)
+        return se;
+
+    se = kmalloc(sizeof(struct sched_entity));
+    if (se == NULL)
+        return NULL;
+
+    memset(se, 0, sizeof(struct sched_entity));
+    se->task = t;
+    se->weight = NICE_0_WEIGHT;
+    se->policy = SCHED_POLICY_FAIR;
+    fair_se[t->pid] = se;
+
+    return se;
+}
+
+/* Sem a sched_entity, o task fica na classe de prioridades. */
+bool task_is_fair(struct task *t)
+{
+    struct sched_entity *se = task_se(t);
+    return (se != NULL && se->policy == SCHED_POLICY_FAIR);
+}
+
+/**
+ * @brief Atribui o nice(NICE_MIN..NICE_MAX) e o peso correspondente ao task.
+ *
+ * @param t
+ * @param nice
+ * @return int 0 ou -1, se o nice for inválido.
+ */
+int sched_set_nice(struct task *t, int nice)
+{
+    struct sched_entity *se = NULL;
+    struct runq *rq = NULL;
+    u32_t weight;
+
+    if (nice < NICE_MIN || nice > NICE_MAX)
+        return -1;
+
+    se = sched_entity_get(t);
+    if (se == NULL)
+        return -1;
+
+    weight = nice_to_weight[nice - NICE_MIN];
+
+    rq = task_runq_lock(t);
+    if (se->on_rq)
+        fair_rqs[get_task_cpu(t)].load += (u64_t)weight - se->weight;
+    se->nice = nice;
+    se->weight = weight;
+    task_runq_unlock(rq);
+
+    return 0;
+}
+
+/**
+ * @brief Escolhe a classe de scheduling do task. Somente antes da primeira
+ * entrada do task numa run queue.
+ *
+ * @param t
+ * @param policy SCHED_POLICY_FAIR ou SCHED_POLICY_PRIO.
+ * @return int 0 ou -1.
+ */
+int sched_setpolicy(struct task *t, u8_t policy)
+{
+    struct sched_entity *se = NULL;
+
+    if (policy != SCHED_POLICY_FAIR && policy != SCHED_POLICY_PRIO)
+        return -1;
+
+    if (t->state != eSTATE_NEW)
+        return -1;
+
+    se = sched_entity_get(t);
+    if (se == NULL)
+        return -1;
+
+    se->policy = policy;
+    return 0;
+}
+
+static inline struct sched_entity *se_of(struct rb_node *node)
+{
+    return container_of(node, struct sched_entity, run_node);
+}
+
+/* Compara vruntimes com sinal: a diferença é pequena mesmo após o wraparound. */
+static inline bool vruntime_before(u64_t a, u64_t b)
+{
+    return ((int64_t)(a - b) < 0);
+}
+
+static inline u64_t calc_delta_fair(u64_t delta, struct sched_entity *se)
+{
+    if (se->weight == NICE_0_WEIGHT)
+        return delta;
+    return (delta * NICE_0_WEIGHT) / se->weight;
+}
+
+/* O min_vruntime acompanha o task mais à esquerda, sem nunca recuar. */
+static void update_min_vruntime(struct fair_rq *frq)
+{
+    struct rb_node *left = frq->tasks.most_left;
+
+    if (left == NULL)
+        return;
+
+    if (vruntime_before(frq->min_vruntime, se_of(left)->task->sched.vruntime))
+        frq->min_vruntime = se_of(left)->task->sched.vruntime;
+}
+
+/* Contabiliza o tempo de execução do task corrente desde a última chamada. */
+static void update_curr(struct sched_entity *se)
+{
+    u64_t now = sched_clock();
+    u64_t delta = now - se->exec_start;
+
+    if ((int64_t)delta <= 0)
+        return;
+
+    se->exec_start = now;
+    se->sum_exec += delta;
+    se->task->sched.vruntime += calc_delta_fair(delta, se);
+}
+
+static void __enqueue_entity(struct fair_rq *frq, struct sched_entity *se)
+{
+    struct rb_node **link = &frq->tasks.root;
+    struct rb_node *parent = NULL;
+    u64_t key = se->task->sched.vruntime;
+    bool leftmost = true;
+
+    while (*link != NULL)
+    {
+        parent = *link;
+
+        if (vruntime_before(key, se_of(parent)->task->sched.vruntime))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    se->run_node.left = NULL;
+    se->run_node.right = NULL;
+    rb_set_parent(&se->run_node, parent);
+    rb_set_color(&se->run_node, RB_RED);
+    *link = &se->run_node;
+
+    rb_insert(&frq->tasks, &se->run_node, leftmost);
+}
+
+/**
+ * @brief Insere o task na árvore do core. Fora da árvore, o vruntime do task é
+ * relativo ao min_vruntime do core em que ele estava: o task novo(vruntime 0)
+ * entra no min_vruntime do core, e o task migrado mantém a sua vantagem ou
+ * atraso em relação aos demais.
+ *
+ * @param cpu
+ * @param t
+ */
+void fair_enqueue(u8_t cpu, struct task *t)
+{
+    struct fair_rq *frq = &fair_rqs[cpu];
+    struct sched_entity *se = task_se(t);
+
+    t->sched.vruntime += frq->min_vruntime;
+
+    /* A vantagem acumulada fora da fila fica limitada a meio período. */
+    if (vruntime_before(t->sched.vruntime, frq->min_vruntime - (SCHED_LATENCY_NS / 2)))
+        t->sched.vruntime = frq->min_vruntime - (SCHED_LATENCY_NS / 2);
+
+    __enqueue_entity(frq, se);
+    frq->load += se->weight;
+    frq->nr_running++;
+    se->on_rq = true;
+}
+
+void fair_dequeue(u8_t cpu, struct task *t)
+{
+    struct fair_rq *frq = &fair_rqs[cpu];
+    struct sched_entity *se = task_se(t);
+
+    if (!se->on_rq)
+        return;
+
+    rb_erase(&frq->tasks, &se->run_node);
+    frq->load -= se->weight;
+    frq->nr_running--;
+    se->on_rq = false;
+
+    update_min_vruntime(frq);
+    t->sched.vruntime -= frq->min_vruntime;
+}
+
+/* Atualiza o vruntime do task corrente e o reposiciona na árvore. */
+void fair_requeue(u8_t cpu, struct task *t)
+{
+    struct fair_rq *frq = &fair_rqs[cpu];
+    struct sched_entity *se = task_se(t);
+
+    rb_erase(&frq->tasks, &se->run_node);
+    update_curr(se);
+    __enqueue_entity(frq, se);
+
+    update_min_vruntime(frq);
+}
+
+/* Devolve o task mais à esquerda sem retirá-lo da árvore, ou NULL. */
+struct task *fair_pick_next(u8_t cpu)
+{
+    struct rb_node *left = fair_rqs[cpu].tasks.most_left;
+    struct sched_entity *se = NULL;
+
+    if (left == NULL)
+        return NULL;
+
+    se = se_of(left);
+    se->exec_start = sched_clock();
+    se->slice_start = se->sum_exec;
+
+    return se->task;
+}
+
+/* Percorre os tasks da árvore do core em ordem de vruntime. Com 'prev' nulo,
+devolve o mais à esquerda. Usada pelo balanceamento, com o lock da runq. */
+struct task *fair_next_task(u8_t cpu, struct task *prev)
+{
+    struct rb_node *node = NULL;
+
+    if (prev == NULL)
+        node = fair_rqs[cpu].tasks.most_left;
+    else
+        node = rb_next(&task_se(prev)->run_node);
+
+    return (node != NULL) ? se_of(node)->task : NULL;
+}
+
+/* Fração do período proporcional ao peso do task. */
+static u64_t sched_slice(struct fair_rq *frq, struct sched_entity *se)
+{
+    u64_t period = SCHED_LATENCY_NS;
+    u64_t slice;
+
+    if (frq->nr_running > (SCHED_LATENCY_NS / SCHED_MIN_GRANULARITY_NS))
+        period = frq->nr_running * SCHED_MIN_GRANULARITY_NS;
+
+    if (frq->load == 0)
+        return period;
+
+    slice = (period * se->weight) / frq->load;
+    return (slice < SCHED_MIN_GRANULARITY_NS) ? SCHED_MIN_GRANULARITY_NS : slice;
+}
+
+/**
+ * @brief Chamada pelo handler do timer. Indica se o task corrente esgotou o
+ * seu slice e deve ceder o core.
+ *
+ * @param t
+ * @return true
+ * @return false
+ */
+bool fair_tick(struct task *t)
+{
+    struct sched_entity *se = task_se(t);
+    struct fair_rq *frq = NULL;
+    u64_t ran;
+
+    if (se == NULL || !se->on_rq)
+        return false;
+
+    frq = &fair_rqs[get_task_cpu(t)];
+    if (frq->nr_running <= 1)
+        return false;
+
+    ran = se->sum_exec + (sched_clock() - se->exec_start) - se->slice_start;
+    return (ran >= sched_slice(frq, se));
+}
+
+/* Indica se o task 't', que acabou de entrar na árvore, deve tomar o core de
+'curr'. O vruntime de 'curr' é o da última troca de contexto. */
+bool fair_wakeup_preempt(struct task *t, struct task *curr)
+{
+    return vruntime_before(t->sched.vruntime + SCHED_WAKEUP_GRANULARITY_NS, curr->sched.vruntime);
+}
@@ -0,0 +1,78 @@
+/*--------------------------------------------------------------------------
+*  File name:  sched_fair.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as estruturas da classe de scheduling fair, em que cada core
+ordena os seus tasks numa rbtree pelo vruntime(tempo de execução em nanossegun-
+dos ponderado pelo peso do nice).
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "rbtree.h"
+#include "task.h"
+
+/* Classes de scheduling. A classe de prioridades(arrays active/expired) é
+atendida antes da classe fair. Todo task começa na classe fair. */
+#define SCHED_POLICY_FAIR 0
+#define SCHED_POLICY_PRIO 1
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024
+
+/* Período em que todos os tasks prontos de um core devem executar ao menos uma
+vez, dividido entre eles pelo peso. Com muitos tasks, o período cresce para que
+nenhum slice fique abaixo da granularidade mínima. */
+#define SCHED_LATENCY_NS 6000000ULL
+#define SCHED_MIN_GRANULARITY_NS 750000ULL
+
+/* Vantagem mínima de vruntime para que o task acordado tome o core. */
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000ULL
+
+/* Tempo de calibração do TSC pelo HPET. */
+#define SCHED_CLOCK_CALIBRATE_MS 10
+
+struct sched_entity
+{
+    struct rb_node run_node; /* Chave: task->sched.vruntime. */
+    struct task *task;
+    u64_t exec_start;  /* sched_clock() da última contabilização. */
+    u64_t sum_exec;    /* Tempo total de execução em ns. */
+    u64_t slice_start; /* sum_exec quando o task foi escolhido. */
+    u64_t last_ran;    /* sched_clock() da última vez que o task deixou ou recebeu o core. */
+    u32_t weight;
+    int8_t nice;
+    u8_t policy;
+    bool on_rq;
+    volatile bool on_cpu; /* De runq_next() até o __switch_to() que o tira do core. */
+};
+
+void sched_clock_init(void);
+u64_t sched_clock(void);
+u64_t sched_clock_cycles(u64_t ns);
+
+void sched_fair_init(void);
+void fair_rq_init(u8_t cpu);
+
+struct sched_entity *task_se(struct task *t);
+struct sched_entity *sched_entity_get(struct task *t);
+bool task_is_fair(struct task *t);
+
+int sched_set_nice(struct task *t, int nice);
+int sched_setpolicy(struct task *t, u8_t policy);
+
+/* Chamadas com o lock da runq do core. */
+void fair_enqueue(u8_t cpu, struct task *t);
+void fair_dequeue(u8_t cpu, struct task *t);
+void fair_requeue(u8_t cpu, struct task *t);
+struct task *fair_pick_next(u8_t cpu);
+struct task *fair_next_task(u8_t cpu, struct task *prev);
+
+bool fair_tick(struct task *t);
+bool fair_wakeup_preempt(struct task *t, struct task *curr);
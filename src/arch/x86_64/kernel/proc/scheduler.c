@@ -18,40 +18,21 @@
 #include "smp.h"
 #include "percpu.h"
 #include "runq.h"
+#include "proc/runq_prio.h"
+#include "proc/sched_fair.h"
+#include "smp/resched.h"
+#include "proc/nohz.h"
 #include "lapic.h"
 #include "../drivers/graphic/console.h"
 #include "scheduler.h"
 #include "tss.h"
 #include "mm/vmalloc.h"
+#include "mm/cow.h"
 
 static atomic32_t schedulers_waiting;
 CREATE_SPINLOCK(spinlock_task);
 extern virt_addr_t pidTable;
 
-static void recalc_priority(task_t *t)
-{
-    u8_t cpu = get_task_cpu(t);
-    struct runq *rq = percpu_table[cpu].run_queue;
-    prio_array_t *array = &rq->arrays;
-
-    __spin_lock(&rq->lock.key);
-
-    // dequeue_task(t, array);
-    runq_remove(t);
-    if (t->priority < LOW_PRIO)
-    {
-        t->priority++;
-    }
-    else
-    {
-        t->priority = t->static_priority;
-    }
-    // enqueue_task(t, array);
-    runq_add(t, cpu);
-
-    __spin_unlock(&rq->lock.key);
-}
-
 /* É possível fazer muita coisa em C, sem a necessidade de utilizar Assembly. */
 static void switch_to(task_t *task_curr, task_t *task_next)
 {
@@ -59,6 +40,10 @@ static void switch_to(task_t *task_curr, task_t *task_next)
     tss_t *tss = percepu_get_tss(cpu);
     tss->rsp0 = (mm_addr_t)task_next->rsp0;
 
+    /* Os tasks do user mode possuem o próprio espaço de endereçamento. Os
+    demais executam no init_mm. */
+    mm_switch(mm_of_task(task_next->pid));
+
     // tss->rsp0 = (mm_addr_t)task_next->stack_rsp;
 }
 
@@ -80,30 +65,39 @@ void scheduler(void)
     CORE pelo tempo desejado. Ele será reativado diretametne ou mediante sched_yield(). */
     percpu_reschedule_enable();
 
-    // Update scheduler statistics for the previous task
-    percpu_current()->sched.vruntime++;
+    /* O próximo task é escolhido agora: os pedidos de reschedule pendentes
+    estão atendidos. */
+    clear_need_resched(cpu);
 
-    /* Se o task atualmente em execução tiver alguma atividade útil e não apenas um
-    loop infinito, como no idle task, o reinserimos na rbtree. Isso é necessário porque
-    todas as fezes que invocamos runq_next(), ela devolve um task para excução, mas o
-    exclui da fila de execução. O task que está em execução foi excluído e é aqui que
-    decidimos se ele deve continuar sendo executado.
-    */
-    if (!is_task_idle(percpu_current()))
+    /* Se a interrupção que acordou o core ocioso trouxe um task, o tick periódico
+    volta antes da troca de contexto. */
+    tick_nohz_idle_exit();
+
+    /* O task em execução continua na fila do array active. Se ele esgotou o
+    timeslice, recalculamos a sua prioridade e o passamos para o array expired;
+    caso contrário(yield voluntário), ele vai para o fim da fila da sua priori-
+    dade. Na classe fair, o vruntime é atualizado e o task é reposicionado na
+    rbtree. O idle task não fica em fila alguma. */
+    if (percpu_current()->sched.num_slices >= TASK_SLICES_MAX)
     {
-        // recalc_priority(percpu_current());
-        runq_requeue(percpu_current(), cpu);
+        percpu_current()->sched.num_slices = 0;
+        if (!is_task_idle(percpu_current()))
+            runq_expire(percpu_current(), cpu);
     }
-
-    // struct task *next = find_next_task();
-    if (is_task_idle(percpu_current()))
+    else if (!is_task_idle(percpu_current()))
     {
-        //  runq_balance_pull(); //Sempre gera erro na inicialização. DEscobrir motivo.
-        //  next = runq_next();
+        runq_requeue(percpu_current(), cpu);
     }
 
+    /* Balanceamento periódico entre as runqs. */
+    runq_balance(cpu, false);
+
     next = runq_next(cpu);
 
+    /* Sem tasks na runq, o core puxa tasks da runq mais carregada. */
+    if (is_task_idle(next) && runq_balance(cpu, true) > 0)
+        next = runq_next(cpu);
+
     /* Altero o state do task atual e do próximo. */
     switch_to(percpu_current(), next);
 
@@ -118,15 +112,27 @@ esteja ativada, para evitar a troca de contexto dentro de uma área crítica.
 static void apic_timer_handler(cpu_regs_t *tsk_contxt)
 {
     struct task *t = percpu_current();
+    bool expired = false;
     t->sched.num_slices++;
+    tick_account();
 
-    /* Preempt a task after it's ran for 5 time slices. */
-    if (t->sched.num_slices >= TASK_SLICES_MAX)
+    /* Preempt a task after it's ran for 5 time slices. O scheduler() zera o
+    contador ao mover o task para o array expired. O task da classe fair cede o
+    core ao esgotar o seu slice ou quando há tasks na classe de prioridades. */
+    if (task_is_fair(t))
+        expired = fair_tick(t) || runq_find_first_queue(get_runq_by_core(get_task_cpu(t))) >= 0;
+    else
+        expired = (t->sched.num_slices >= TASK_SLICES_MAX);
+
+    /* Pedido de reschedule que chegou numa área crítica ou feito pelo próprio core. */
+    if (need_resched(cpu_id()))
+        expired = true;
+
+    if (expired)
     {
         /* Se a interrupção não tiver acontecido dentro de uma área crítica, faz o switch. */
         if (is_percpu_preempt() && is_percpu_reschedule())
         {
-            t->sched.num_slices = 0;
             sched_yield();
         }
     }
@@ -143,6 +149,15 @@ static void sched_setup(void)
 
     /* Atribuo o handler do ISR que fará o tratamento das interrupções do Apic Timer. */
     add_handler_irq(ISR_VECTOR_TIMER, apic_timer_handler);
+
+    /* As runqs dos cores vêm do seu próprio cache. */
+    runq_cache_init();
+
+    /* Entidades da classe fair e calibração do relógio do scheduler. */
+    sched_fair_init();
+
+    /* IPI que avisa um core de que um task mais prioritário entrou na sua runq. */
+    setup_resched_ipi();
 }
 static inline void wait_for_schedulers(void)
 {
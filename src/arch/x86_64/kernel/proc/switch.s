@@ -13,6 +13,7 @@ section .text
 
 ;align 16
 extern tss64
+extern sched_finish_switch
 
 
 global flush_gdt_tss
@@ -192,6 +193,15 @@ __switch_to:
 	;****************************************************************
 	mov [PERCPU_CURRENT], rdi  ;"next task"
 	mov rsp, [rdi + TASK_STACK_RSP]	;RSP deve apontar para task->stack_rsp
+
+	;A stack do task anterior(RAX) não é mais utilizada: ele pode ser
+	;migrado para outro core. RBX é preservado pela chamada e restaurado
+	;pelo POP_ALL.
+	mov rbx, rsp
+	and rsp, -16
+	mov rdi, rax
+	call sched_finish_switch
+	mov rsp, rbx
 		
 	;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 	;Faço as modificações no TSS que usará o mecanismo IST.
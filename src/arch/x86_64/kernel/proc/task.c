@@ -38,8 +38,13 @@
 #include "../drivers/graphic/console.h"
 #include "smp.h"
 #include "scheduler.h"
+#include "mm/gfp.h"
 #include "gdt.h"
 #include "mm/vmalloc.h"
+#include "mm/cow.h"
+#include "mm/vmap.h"
+#include "smp/resched.h"
+#include "proc/nohz.h"
 
 /* O contador global de available process ID. */
 static atomic32_t next_pid = {PID_IDLE};
@@ -85,8 +90,20 @@ static void cpu_idle(void)
 {
     while (true)
     {
+        /* Trabalho de manutenção feito apenas quando o core está ocioso. */
+        heap_trim_idle();
+        zero_pool_refill_idle();
+
+        /* Com a runq vazia, o tick periódico fica desligado até o próximo evento. */
+        tick_nohz_idle_enter();
+
         __PAUSE__();
-        __HLT__();
+        if (!need_resched(cpu_id()))
+            __HLT__();
+
+        /* O core acordou sem tick: faz o balanceamento ocioso no scheduler(). */
+        if (tick_nohz_idle_exit() || need_resched(cpu_id()))
+            sched_yield();
     }
 }
 /* Configura e devolve um união descritor/task para cada core, a partir do vetor
@@ -171,8 +188,7 @@ struct task *get_init_task(u8_t cpu_id)
 
 static struct task *copy_task(task_t *parent, virt_addr_t entry, uint64_t flags, pt_regs_t *regs, pid_t pid)
 {
-    task_t *task_new = vmalloc(PAGE_SIZE * 2); /* Reservo duas página. */
-    clear_vm_range(task_new, PAGE_SIZE * 2);
+    task_t *task_new = vmalloc_stack(PAGE_SIZE * 2); /* Reservo duas página. */
     task_new->rsp0 = (mm_addr_t)incptr(task_new, (PAGE_SIZE * 2) - 16);
 
     task_new->pid = pid;
@@ -209,10 +225,26 @@ struct task *task_fork(task_t *parent, virt_addr_t entry, uint64_t flags, pt_reg
 
     if ((flags & MODE_USER))
     {
-        /* Crio uma stack de trabalho para o task no mode user.*/
-        virt_addr_t stk = vmalloc(PAGE_SIZE * 2); /* Reservo duas página. */
-        clear_vm_range(stk, PAGE_SIZE * 2);
-        user_stk = (incptr(stk, (PAGE_SIZE * 2) - 16));
+        /* O task no mode user recebe um espaço de endereçamento próprio. O user
+        space do pai é compartilhado em copy-on-write e a stack de trabalho fica
+        no topo do user space. Se ela for herdada do pai, só os pages escritos
+        pelo filho serão copiados. */
+        mm_struct_t *mm = mm_fork(mm_of_task(parent->pid));
+        if (mm)
+        {
+            /* Sem a tabela de mm, o task segue no init_mm com a stack antiga. */
+            if (mm_set_task(task_new->pid, mm))
+                user_stk = mm_user_stack(mm, PAGE_SIZE * 2);
+            else
+                mm_free(mm);
+        }
+
+        if (!user_stk)
+        {
+            /* Crio uma stack de trabalho para o task no mode user.*/
+            virt_addr_t stk = vmalloc_stack(PAGE_SIZE * 2); /* Reservo duas página. */
+            user_stk = (incptr(stk, (PAGE_SIZE * 2) - 16));
+        }
 
         // WARN_ON("USER MODE: PID=[ %d ]: kernel stack=%p - User stack=%p", task_new->pid, task_new->rsp0, user_stk);
         //  dump_task_regs(regs); /* Dump do frame recebido. */
@@ -19,6 +19,9 @@ IDT e seus descritores, necessários para a manipulação das interrupções.
 #include "gdt.h"
 #include "idt.h"
 #include "interrupt.h"
+#include "mm/pat.h"
+#include "mm/pcid.h"
+#include "smp/tlb.h"
 
 /*----------------------------------------*/
 /* Criamos três vetores cujos elementos são a GDT, IDT e TSS que será utilizada por cada CORE.
@@ -115,6 +118,15 @@ void percpu_init_ap(void)
 	cpu->tss = tss;
 
 	percpu_set_addr(cpu);
+
+	/* Mapeamentos globais do kernel(CR4.PGE). */
+	pge_init();
+
+	/* A PAT deve ser a mesma em todos os cores. */
+	pat_init();
+
+	/* PCID, enquanto o cr3 ainda usa o PCID 0. */
+	pcid_init();
 }
 
 /* Esta rotina faz a atribuição da primeira estrutura PERCPU para o núcleo BSP. */
@@ -154,6 +166,15 @@ void percpu_init_bsp(void)
 	/* Atualizo o percpu e gravo o endreço da estrutura no GSbase do CORE. */
 	cpu->tss = tss;
 	percpu_set_addr(cpu);
+
+	/* Mapeamentos globais do kernel(CR4.PGE). */
+	pge_init();
+
+	/* Tipos de memória por page(PAT), antes de qualquer mapeamento WC. */
+	pat_init();
+
+	/* PCID, enquanto o cr3 ainda usa o PCID 0. */
+	pcid_init();
 }
 /* Como cada núcleo possui um conjunto próprio de registros(RAX, GS, FS) eles podem ser utilizados
  independentemente. Neste caso, o registro GS está sendo utilizado para guardar o endereço da
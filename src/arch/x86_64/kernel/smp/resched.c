@@ -0,0 +1,77 @@
+/*--------------------------------------------------------------------------
+*  File name:  resched.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+IPI de reschedule. Quando um task entra na runq de outro core e deve tomar o
+lugar do task em execução(ou do idle task), o core é avisado por um IPI, em
+vez de só perceber o novo task no próximo tick do timer.
+
+Cada core tem um flag need_resched. O IPI só é enviado quando o flag passa de
+0 para 1: vários tasks acordados antes da troca de contexto geram um único
+IPI. O scheduler() limpa o flag do core ao escolher o próximo task.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "x86_64.h"
+#include "isr.h"
+#include "lapic.h"
+#include "smp.h"
+#include "percpu.h"
+#include "scheduler.h"
+#include "smp/resched.h"
+
+static volatile u8_t need_resched_flag[MAX_CORES];
+
+/* Se o core estiver numa área crítica, o flag continua ligado e o próximo
+tick do timer faz a troca de contexto. */
+static void resched_ipi_handler(cpu_regs_t *regs)
+{
+    apic_eoi();
+
+    if (is_percpu_preempt() && is_percpu_reschedule())
+        sched_yield();
+}
+
+void setup_resched_ipi(void)
+{
+    add_handler_ipi(ISR_VECTOR_RESCHEDULE, resched_ipi_handler);
+}
+
+bool need_resched(u8_t cpu)
+{
+    return __atomic_load_n(&need_resched_flag[cpu], __ATOMIC_ACQUIRE);
+}
+
+void clear_need_resched(u8_t cpu)
+{
+    __atomic_store_n(&need_resched_flag[cpu], 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Pede ao core 'cpu' uma troca de contexto. No próprio core, apenas
+ * liga o flag, tratado no próximo tick do timer.
+ *
+ * @param cpu
+ */
+void resched_cpu(u8_t cpu)
+{
+    u64_t rflags;
+
+    /* Já existe um pedido pendente: o IPI não se repete. */
+    if (__atomic_exchange_n(&need_resched_flag[cpu], 1, __ATOMIC_ACQ_REL))
+        return;
+
+    if (cpu == cpu_id())
+        return;
+
+    /* A escrita do ICR(high e low) não pode ser interrompida por outro IPI. */
+    rflags = __read_rflags64();
+    local_irq_disable();
+    send_apic_ipi(cpu, ISR_VECTOR_RESCHEDULE);
+    if (rflags & 0x200)
+        local_irq_enable();
+}
@@ -0,0 +1,23 @@
+/*--------------------------------------------------------------------------
+*  File name:  resched.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas do IPI de reschedule, que avisa um core de que
+um task mais prioritário entrou na sua runq.
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+
+/* Vetor do IPI de reschedule. O 0xF0 é o do TLB shootdown. */
+#define ISR_VECTOR_RESCHEDULE 0xF1
+
+void setup_resched_ipi(void);
+void resched_cpu(u8_t cpu);
+bool need_resched(u8_t cpu);
+void clear_need_resched(u8_t cpu);
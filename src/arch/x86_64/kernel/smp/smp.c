@@ -22,6 +22,8 @@ Rotinas para a inicialização de todos os cores do processador.
 #include "scheduler.h"
 // #include "syscall/syscall_gen.h"
 #include "syscall/syscalls.h"
+#include "mm/meminit.h"
+#include "smp/tlb.h"
 
 volatile bool smp_ap_started_flag = false;
 
@@ -181,11 +183,18 @@ void smp_ap_kmain(void)
 
     local_irq_enable();
 
+    /* A partir daqui o core atende aos TLB shootdowns. */
+    tlb_shootdown_online();
+
     syscall_enable();
 
     atomic_inc_read32(&smp_nr_cpus_ready);
     kprintf("\nAP[%d]: Concluida.", cpu_id);
 
+    /* Inicialização do restante do vetor de pages, em paralelo com os demais
+    cores, quando o BSP concluir o smp_init(). */
+    deferred_init_ap();
+
     // debug_pause("p1");
     scheduler_ap();
 }
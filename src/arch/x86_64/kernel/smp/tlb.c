@@ -0,0 +1,151 @@
+/*--------------------------------------------------------------------------
+*  File name:  tlb.c
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+TLB shootdown. Um invlpg ou a recarga do cr3 só invalidam a TLB do core que
+os executa. Quando o kernel desfaz um mapeamento compartilhado por todos os
+cores(ex. vmalloc), os demais cores precisam ser avisados por um IPI para que
+nenhum deles continue com uma tradução antiga.
+
+Os mapeamentos do kernel são globais(bit G) e sobrevivem à troca do cr3. Por
+isso a invalidação completa é feita alternando o CR4.PGE, o que descarta
+todas as traduções, globais ou não, de todos os PCIDs.
+--------------------------------------------------------------------------*/
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+#include "x86_64.h"
+#include "isr.h"
+#include "kcpuid.h"
+#include "lapic.h"
+#include "smp.h"
+#include "sync/spin.h"
+#include "smp/tlb.h"
+#include "mm/pcid.h"
+
+/* Um único shootdown por vez. Cada shootdown tem um número de geração; cada
+core confirma a invalidação gravando, na sua própria entrada, a geração que
+leu antes de invalidar a TLB. Assim um IPI atrasado de um shootdown anterior
+não é confundido com a confirmação do atual. */
+CREATE_SPINLOCK(tlb_shootdown_lock);
+static volatile u64_t tlb_shootdown_gen = 0;
+static volatile u64_t tlb_shootdown_ack[MAX_CORES];
+
+/* Cores que já atendem ao IPI. Só eles recebem o shootdown. */
+static volatile bool tlb_cpu_online[MAX_CORES];
+
+static void tlb_shootdown_handler(cpu_regs_t *regs)
+{
+    u8_t cpu = cpu_id();
+    u64_t gen = __atomic_load_n(&tlb_shootdown_gen, __ATOMIC_ACQUIRE);
+
+    flush_tlb_global();
+    __atomic_store_n(&tlb_shootdown_ack[cpu], gen, __ATOMIC_RELEASE);
+    apic_eoi();
+}
+
+void setup_tlb_shootdown(void)
+{
+    spinlock_init(&tlb_shootdown_lock);
+    add_handler_ipi(ISR_VECTOR_TLB_SHOOTDOWN, tlb_shootdown_handler);
+
+    /* O BSP, que executa esta rotina. */
+    tlb_shootdown_online();
+}
+
+/**
+ * @brief Inclui o core corrente nos shootdowns. Executada por cada AP logo
+ * após habilitar as interrupções. Um shootdown que tenha lido o core como
+ * ausente não o aguarda; por isso o core invalida a própria TLB depois de se
+ * registrar.
+ */
+void tlb_shootdown_online(void)
+{
+    __atomic_store_n(&tlb_cpu_online[cpu_id()], true, __ATOMIC_SEQ_CST);
+    flush_tlb_global();
+}
+
+/* Executada por cada core na inicialização do percpu. O boot.s e o tramp.s já
+ligam o CR4.PGE; aqui ele é confirmado antes de os mapeamentos globais serem
+utilizados. */
+void pge_init(void)
+{
+    cpuid_regs_t cpuid_var = cpuid_get(CPUID_FEATURES);
+
+    if ((cpuid_var.edx & CPUID_EDX_PGE) && !(__read_cr4() & CR4_PGE))
+        __write_cr4(__read_cr4() | CR4_PGE);
+}
+
+/**
+ * @brief Invalida toda a TLB do core corrente, inclusive as traduções globais
+ * do kernel e as dos demais PCIDs. Utilizada apenas quando um mapeamento do
+ * kernel é desfeito ou muda de atributos.
+ */
+void flush_tlb_global(void)
+{
+    u64_t rflags = __read_rflags64();
+    u64_t cr4 = __read_cr4();
+
+    if (!(cr4 & CR4_PGE))
+    {
+        pcid_flush_all();
+        return;
+    }
+
+    local_irq_disable();
+    __write_cr4(cr4 & ~CR4_PGE);
+    __write_cr4(cr4);
+    if (rflags & 0x200)
+        local_irq_enable();
+}
+
+/**
+ * @brief Invalida toda a TLB do core corrente e dos demais cores online e
+ * só retorna após a confirmação de todos eles.
+ * @note Não pode ser chamada com as interrupções desabilitadas: dois cores
+ * fazendo o shootdown ao mesmo tempo precisam atender ao IPI um do outro.
+ */
+void flush_tlb_all_cpus(void)
+{
+    bool targets[MAX_CORES];
+    u8_t self;
+    u64_t gen;
+    u64_t rflags;
+
+    flush_tlb_global();
+
+    spinlock_lock(&tlb_shootdown_lock);
+
+    gen = __atomic_add_fetch(&tlb_shootdown_gen, 1, __ATOMIC_SEQ_CST);
+
+    /* O core corrente não muda enquanto o IPI é enviado. */
+    rflags = __read_rflags64();
+    local_irq_disable();
+    self = cpu_id();
+
+    /* O IPI vai apenas aos cores online, um a um. A lista é fixada aqui e a
+    espera abaixo é exatamente por esses cores. */
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        targets[cpu] = (cpu != self && __atomic_load_n(&tlb_cpu_online[cpu], __ATOMIC_SEQ_CST));
+        if (targets[cpu])
+            send_apic_ipi(cpu, ISR_VECTOR_TLB_SHOOTDOWN);
+    }
+
+    if (rflags & 0x200)
+        local_irq_enable();
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++)
+    {
+        if (!targets[cpu])
+            continue;
+
+        while (__atomic_load_n(&tlb_shootdown_ack[cpu], __ATOMIC_ACQUIRE) < gen)
+            __builtin_ia32_pause();
+    }
+
+    spinlock_unlock(&tlb_shootdown_lock);
+}
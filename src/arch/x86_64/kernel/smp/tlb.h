@@ -0,0 +1,29 @@
+/*--------------------------------------------------------------------------
+*  File name:  tlb.h
+*  Author:  Aldenor Sombra de Oliveira
+*  Data de criação: 18-10-2026
+*--------------------------------------------------------------------------
+Este header reune as rotinas de invalidação da TLB em todos os cores(TLB
+shootdown).
+--------------------------------------------------------------------------*/
+#pragma once
+
+#include "../include/libc/stdint.h"
+#include "../include/libc/stddef.h"
+#include "../include/libc/stdbool.h"
+
+#include "ktypes.h"
+
+/* Vetor do IPI que solicita a invalidação da TLB aos demais cores. Os vetores
+de 240 a 255 estão livres na IDT. */
+#define ISR_VECTOR_TLB_SHOOTDOWN 0xF0
+
+/* CPUID.01H:EDX[13] - global pages. */
+#define CPUID_EDX_PGE (1U << 13)
+#define CR4_PGE (1UL << 7)
+
+void setup_tlb_shootdown(void);
+void pge_init(void);
+void flush_tlb_global(void);
+void flush_tlb_all_cpus(void);
+void tlb_shootdown_online(void);